@@ -0,0 +1,83 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Microbenchmark: BBMap edge table across edge distributions, and vs. the
+// former std::map implementation.
+//
+
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <vector>
+
+#include "common/bbmap.h"
+#include "./synth.h"
+
+static const int NUM_EDGES = 5000;
+static const int NUM_COLD_EDGES = 500000;
+static const int NUM_EVENTS = 1000000;
+static const int NUM_ROUNDS = 10;
+
+// The original BBMap::AddEdge(), kept here as a reference
+class StdMapBBMap {
+ public:
+  void AddEdge(target_addr prev, target_addr next) {
+    bbmap_edge edge(prev, next);
+
+    if (bb_map_.find(edge) == bb_map_.end()) {
+      bb_map_[edge] = 1;
+    } else {
+      bb_map_[edge]  += 1;
+    }
+  }
+
+  int size() const { return bb_map_.size(); }
+
+ private:
+  std::map<bbmap_edge, unsigned int > bb_map_;
+};
+
+template <class T>
+static double run(const std::vector<bbmap_edge> &stream, int *nedges) {
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+
+  for (int round = 0; round < NUM_ROUNDS; round++) {
+    T map;
+    for (std::vector<bbmap_edge>::const_iterator it = stream.begin();
+         it != stream.end(); it++) {
+      map.AddEdge(it->first, it->second);
+    }
+    *nedges = map.size();
+  }
+
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+int main(int argc, char **argv) {
+  std::vector<bbmap_edge> stream;
+  double total = static_cast<double>(NUM_EVENTS) * NUM_ROUNDS;
+  int nedges;
+
+  static const SynthDistribution dists[] = {
+    SynthUniform, SynthZipf, SynthLoops, SynthCold
+  };
+  for (size_t i = 0; i < sizeof(dists) / sizeof(dists[0]); i++) {
+    int n_edges = (dists[i] == SynthCold) ? NUM_COLD_EDGES : NUM_EDGES;
+    synth_edge_stream(dists[i], n_edges, NUM_EVENTS, 0x5eed, &stream);
+    double t = run<BBMap>(stream, &nedges);
+    printf("bbmap/%-13s %8.2f Mevents/s (%d edges)\n",
+           synth_distribution_name(dists[i]), total / t / 1e6, nedges);
+  }
+
+  // Hot loops dominate real traces
+  synth_edge_stream(SynthZipf, NUM_EDGES, NUM_EVENTS, 0x5eed, &stream);
+  double t_map = run<StdMapBBMap>(stream, &nedges);
+  double t_table = run<BBMap>(stream, &nedges);
+  printf("bbmap/std::map      %8.2f Mevents/s (%d edges)\n",
+         total / t_map / 1e6, nedges);
+  printf("bbmap/speedup       %8.2fx\n", t_map / t_table);
+  return 0;
+}
@@ -0,0 +1,262 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Microbenchmark: decoding of perf ring buffers. Synthetic ring images (BTS
+// samples, with MMAP, LOST, FORK and EXIT records, wrapping around the end
+// of the ring) are fed to ring_decode() alone, and to the monitor, through
+// monitor_process_events(), without and with an address filter. The same
+// chunks are then appended to a capture file (bts_trace -R), and decoded
+// offline by capture_decode().
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common/filter.h"
+#include "common/parallel.h"
+#include "bts/bts_trace.h"
+#include "bts/capture.h"
+#include "bts/monitor.h"
+#include "bts/perf.h"
+#include "bts/ring.h"
+#include "./synth.h"
+
+static const int NUM_EDGES = 5000;
+static const int NUM_EVENTS = 2000000;
+static const int NUM_ROUNDS = 5;
+
+// Same data area size as bts_trace. Records are written half a ring at a
+// time, as the kernel wakes up the drain thread well before the ring is full
+static const uint64_t RING_SIZE = DEFAULT_MMAP_PAGES * 4096;
+static const uint64_t RING_CHUNK = RING_SIZE / 2;
+
+static void count_record(struct perf_event_header *event, void *opaque) {
+  (*static_cast<uint64_t *>(opaque))++;
+}
+
+// Time ring_decode() alone over the whole record stream
+static double run_ring_decode(const std::vector<unsigned char> &records,
+                              uint64_t *n_records) {
+  std::vector<unsigned char> ring(RING_SIZE);
+  std::vector<unsigned char> bounce(RING_BOUNCE_SIZE);
+  std::chrono::duration<double> elapsed(0);
+  uint64_t head = 0x1000;       // Records wrap from the first chunk on
+
+  *n_records = 0;
+  for (int round = 0; round < NUM_ROUNDS; round++) {
+    for (size_t from = 0; from < records.size(); ) {
+      size_t to = synth_records_chunk(records, from, RING_CHUNK);
+      uint64_t tail = head;
+      head = synth_ring_write(ring.data(), RING_SIZE, head, records, from, to);
+      from = to;
+
+      std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+      ring_decode(ring.data(), RING_SIZE, tail, head, bounce.data(),
+                  count_record, n_records);
+      elapsed += std::chrono::steady_clock::now() - start;
+    }
+  }
+  return elapsed.count();
+}
+
+// Time monitor_process_events() on a single ring, whose control page and
+// data area live in ordinary memory. Return the samples kept in the last
+// round in n_samples
+static double run_monitor(const std::vector<unsigned char> &records,
+                          const struct monitor_options &options,
+                          int *n_samples) {
+  long page_size = getpagesize();
+  std::vector<unsigned char> mmap_area(page_size + RING_SIZE + page_size);
+  unsigned char *base = reinterpret_cast<unsigned char *>(
+    (reinterpret_cast<uintptr_t>(mmap_area.data()) + page_size - 1) &
+    ~(page_size - 1));
+  struct perf_event_mmap_page *control_page =
+    reinterpret_cast<struct perf_event_mmap_page *>(base);
+  unsigned char *data = base + page_size;
+
+  struct monitor_session session;
+  std::unique_ptr<struct perf_ring> ring_ptr(new perf_ring());
+  struct perf_ring *ring = ring_ptr.get();
+  ring->data = static_cast<unsigned char *>(malloc(RING_BOUNCE_SIZE));
+  ring->last_map = NULL;
+  ring->mmap = base;
+  ring->prev_head = 0;
+  session.perf.rings.push_back(std::move(ring_ptr));
+  session.perf.n_rings = 1;
+  session.perf.data_size = RING_SIZE;
+
+  monitor_init(&session, options);
+  std::chrono::duration<double> elapsed(0);
+  uint64_t head = 0;
+
+  for (int round = 0; round < NUM_ROUNDS; round++) {
+    monitor_reset(&session);
+    for (size_t from = 0; from < records.size(); ) {
+      size_t to = synth_records_chunk(records, from, RING_CHUNK);
+      head = synth_ring_write(data, RING_SIZE, head, records, from, to);
+      control_page->data_head = head;
+      from = to;
+
+      std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+      monitor_process_events(&session);
+      elapsed += std::chrono::steady_clock::now() - start;
+    }
+  }
+
+  *n_samples = ring->n_events;
+  return elapsed.count();
+}
+
+// Time the capture of the whole record stream, as the drain threads of
+// bts_trace -R append ring chunks to the capture file
+static double run_capture_write(const std::vector<unsigned char> &records,
+                                const std::string &filename) {
+  std::vector<unsigned char> ring(RING_SIZE);
+  CaptureWriter capture;
+  if (!capture.Open(filename)) {
+    return -1;
+  }
+
+  std::chrono::duration<double> elapsed(0);
+  uint64_t head = 0x1000;
+  for (size_t from = 0; from < records.size(); ) {
+    size_t to = synth_records_chunk(records, from, RING_CHUNK);
+    uint64_t tail = head;
+    head = synth_ring_write(ring.data(), RING_SIZE, head, records, from, to);
+    from = to;
+
+    std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+    if (!capture.AddRecords(0, ring.data(), RING_SIZE, tail, head)) {
+      return -1;
+    }
+    elapsed += std::chrono::steady_clock::now() - start;
+  }
+  return capture.Close() ? elapsed.count() : -1;
+}
+
+// Time the offline decoding of a capture file. Return the samples kept in
+// the last round in n_samples
+static double run_capture_decode(const std::string &filename,
+                                 AddressFilter *filter, uint64_t *n_samples) {
+  CaptureReader capture;
+  if (!capture.Open(filename)) {
+    return -1;
+  }
+
+  struct capture_decode_options options;
+  options.filter = filter;
+  options.n_threads = parallel_threads();
+  options.segment_size = 4 << 20;
+
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  for (int round = 0; round < NUM_ROUNDS; round++) {
+    ExecutionTrace trace;
+    struct capture_decode_stats stats;
+    capture_decode(capture, options, &trace, &stats);
+    *n_samples = stats.n_events;
+  }
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+int main(int argc, char **argv) {
+  std::vector<bbmap_edge> stream;
+  synth_edge_stream(SynthZipf, NUM_EDGES, NUM_EVENTS, 0x5eed, &stream);
+
+  struct synth_record_options record_options;
+  synth_default_options(&record_options);
+  std::vector<unsigned char> records;
+  synth_perf_records(stream, record_options, 0x5eed, &records);
+
+  double total = static_cast<double>(NUM_EVENTS) * NUM_ROUNDS;
+  double total_mb = static_cast<double>(records.size()) * NUM_ROUNDS / 1e6;
+
+  uint64_t n_records;
+  double t = run_ring_decode(records, &n_records);
+  printf("decode/ring_decode  %8.2f Mrecords/s (%.0f MB/s)\n",
+         n_records / t / 1e6, total_mb / t);
+
+  struct monitor_options options;
+  int n_samples;
+  t = run_monitor(records, options, &n_samples);
+  printf("decode/monitor      %8.2f Msamples/s (%.0f MB/s)\n",
+         total / t / 1e6, total_mb / t);
+  if (n_samples != NUM_EVENTS) {
+    fprintf(stderr, "Decoded %d samples out of %d\n", n_samples, NUM_EVENTS);
+    return 1;
+  }
+
+  // Hot loops, whose edges are mostly collapsed before reaching the tables
+  std::vector<bbmap_edge> loops;
+  synth_edge_stream(SynthLoops, NUM_EDGES, NUM_EVENTS, 0x5eed, &loops);
+  std::vector<unsigned char> loop_records;
+  synth_perf_records(loops, record_options, 0x5eed, &loop_records);
+  t = run_monitor(loop_records, options, &n_samples);
+  printf("decode/monitor/loops %7.2f Msamples/s (%.0f MB/s)\n",
+         total / t / 1e6, loop_records.size() * NUM_ROUNDS / t / 1e6);
+  if (n_samples != NUM_EVENTS) {
+    fprintf(stderr, "Decoded %d samples out of %d\n", n_samples, NUM_EVENTS);
+    return 1;
+  }
+
+  // Trace the synthetic text section only, out of several images
+  AddressFilter filter;
+  filter.AddRule(true, "synth");
+  for (int i = 0; i < 16; i++) {
+    filter.AddImage(0x7f0000000000ULL + i * 0x200000ULL, 0x100000,
+                    "/usr/lib/lib" + std::to_string(i) + ".so");
+  }
+  filter.AddImage(0x400000, 0x100000, "/usr/bin/synth");
+  filter.Checkpoint();
+  options.filter = &filter;
+  t = run_monitor(records, options, &n_samples);
+  printf("decode/monitor+filt %8.2f Msamples/s (%.0f MB/s, %d kept)\n",
+         total / t / 1e6, total_mb / t, n_samples);
+
+  const char *tmpdir = getenv("TMPDIR");
+  std::string filename = std::string(tmpdir != NULL ? tmpdir : "/tmp") +
+    "/bench_decode." + std::to_string(getpid());
+  t = run_capture_write(records, filename);
+  if (t < 0) {
+    fprintf(stderr, "Cannot write '%s'\n", filename.c_str());
+    return 1;
+  }
+  printf("decode/capture      %8.2f Msamples/s (%.0f MB/s)\n",
+         NUM_EVENTS / t / 1e6, records.size() / t / 1e6);
+
+  // Half of the synthetic text section
+  AddressFilter offline_filter;
+  offline_filter.AddRule(true, "0x400000-0x47ffff");
+  uint64_t n_offline;
+  static const char *labels[] = {
+    "decode/offline     ", "decode/offline+filt"
+  };
+  for (int i = 0; i < 2; i++) {
+    t = run_capture_decode(filename, i == 0 ? NULL : &offline_filter,
+                           &n_offline);
+    if (t < 0) {
+      fprintf(stderr, "Cannot read '%s'\n", filename.c_str());
+      return 1;
+    }
+    printf("%s %8.2f Msamples/s (%.0f MB/s, %" PRIu64 " kept, %u threads)\n",
+           labels[i], total / t / 1e6, total_mb / t, n_offline,
+           parallel_threads());
+    if (i == 0 && n_offline != static_cast<uint64_t>(NUM_EVENTS)) {
+      fprintf(stderr, "Decoded %" PRIu64 " samples out of %d\n", n_offline,
+              NUM_EVENTS);
+      return 1;
+    }
+  }
+
+  remove(filename.c_str());
+  return 0;
+}
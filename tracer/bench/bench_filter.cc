@@ -0,0 +1,107 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Microbenchmark: AddressFilter lookups vs. the former linear scan of the
+// active images (Images_IsInterestingAddress() in the PIN tracer).
+//
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "common/filter.h"
+
+static const int NUM_IMAGES = 64;
+static const int NUM_LOOKUPS = 1000000;
+static const int NUM_ROUNDS = 10;
+
+static const target_addr IMAGE_BASE = 0x7f0000000000;
+static const target_addr IMAGE_SIZE = 0x200000;
+static const target_addr IMAGE_STRIDE = 0x400000;
+
+// The original image list, kept here as a reference
+class LinearFilter {
+ public:
+  void AddImage(target_addr base, target_addr size, const std::string &name) {
+    active_.push_back(std::make_pair(base, base + size - 1));
+  }
+
+  bool IsInteresting(target_addr addr) const {
+    for (std::vector<std::pair<target_addr, target_addr> >::const_iterator it =
+           active_.begin(); it != active_.end(); it++) {
+      if (addr >= it->first && addr <= it->second) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  std::vector<std::pair<target_addr, target_addr> > active_;
+};
+
+// Generate lookups spread over the images and the gaps between them, with
+// most of them hitting the first images (the executable and libc)
+static std::vector<target_addr> generate_lookups() {
+  std::mt19937_64 rng(0x5eed);
+  std::vector<double> weights;
+  for (int i = 0; i < NUM_IMAGES; i++) {
+    weights.push_back(1.0 / (i + 1));
+  }
+  std::discrete_distribution<int> dist(weights.begin(), weights.end());
+
+  std::vector<target_addr> lookups;
+  lookups.reserve(NUM_LOOKUPS);
+  for (int i = 0; i < NUM_LOOKUPS; i++) {
+    lookups.push_back(IMAGE_BASE + dist(rng) * IMAGE_STRIDE +
+                      rng() % IMAGE_STRIDE);
+  }
+  return lookups;
+}
+
+template <class T>
+static double run(T *filter, const std::vector<target_addr> &lookups,
+                  int *nhits) {
+  for (int i = 0; i < NUM_IMAGES; i++) {
+    filter->AddImage(IMAGE_BASE + i * IMAGE_STRIDE, IMAGE_SIZE,
+                     "/lib/image" + std::to_string(i) + ".so");
+  }
+
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+
+  for (int round = 0; round < NUM_ROUNDS; round++) {
+    *nhits = 0;
+    for (std::vector<target_addr>::const_iterator it = lookups.begin();
+         it != lookups.end(); it++) {
+      *nhits += filter->IsInteresting(*it);
+    }
+  }
+
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+int main(int argc, char **argv) {
+  std::vector<target_addr> lookups = generate_lookups();
+  double total = static_cast<double>(NUM_LOOKUPS) * NUM_ROUNDS;
+  int nhits;
+
+  LinearFilter linear;
+  double t_linear = run(&linear, lookups, &nhits);
+  printf("filter/linear scan  %8.2f Mlookups/s (%d hits)\n",
+         total / t_linear / 1e6, nhits);
+
+  AddressFilter filter;
+  filter.IncludeAllImages();
+  double t_filter = run(&filter, lookups, &nhits);
+  printf("filter/intervals    %8.2f Mlookups/s (%d hits)\n",
+         total / t_filter / 1e6, nhits);
+
+  printf("filter/speedup      %8.2fx\n", t_linear / t_filter);
+  return 0;
+}
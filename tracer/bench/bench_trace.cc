@@ -0,0 +1,103 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Microbenchmark: serialization of an execution trace in each format, and
+// parsing it back, either whole (load_trace()) or as a sorted edge array
+// (load_trace_edges()). Traces are written to the temporary directory.
+//
+
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "common/load.h"
+#include "common/serialize.h"
+#include "./synth.h"
+
+static const int NUM_EDGES = 200000;
+static const int NUM_EVENTS = 2000000;
+static const int NUM_REGIONS = 64;
+static const int NUM_ROUNDS = 5;
+
+static double elapsed_since(std::chrono::steady_clock::time_point start) {
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+static long file_size(const std::string &filename) {
+  FILE *f = fopen(filename.c_str(), "rb");
+  if (f == NULL) {
+    return -1;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fclose(f);
+  return size;
+}
+
+int main(int argc, char **argv) {
+  // A large trace, from a program with many cold edges
+  std::vector<bbmap_edge> stream;
+  synth_edge_stream(SynthCold, NUM_EDGES, NUM_EVENTS, 0x5eed, &stream);
+
+  ExecutionTrace trace;
+  for (size_t i = 0; i < stream.size(); i++) {
+    trace.basic_blocks.AddEdge(stream[i].first, stream[i].second);
+  }
+  for (int i = 0; i < NUM_REGIONS; i++) {
+    MemoryRegion region;
+    region.base = 0x7f0000000000ULL + i * 0x200000ULL;
+    region.size = 0x100000;
+    region.filename = "/usr/lib/libsynth" + std::to_string(i) + ".so";
+    trace.memory_regions.push_back(region);
+  }
+
+  const char *tmpdir = getenv("TMPDIR");
+  std::string filename = std::string(tmpdir != NULL ? tmpdir : "/tmp") +
+    "/bench_trace." + std::to_string(getpid());
+  double total = static_cast<double>(trace.basic_blocks.size()) * NUM_ROUNDS;
+
+  static const char *formats[] = { "protobuf", "stream", "compact" };
+  for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+    TraceFormat format;
+    serialize_parse_format(formats[i], &format);
+
+    std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+    for (int round = 0; round < NUM_ROUNDS; round++) {
+      if (!serialize_trace_format(filename, trace, format)) {
+        fprintf(stderr, "Cannot write '%s'\n", filename.c_str());
+        return 1;
+      }
+    }
+    double t = elapsed_since(start);
+    printf("serialize/%-9s %8.2f Medges/s (%ld bytes)\n", formats[i],
+           total / t / 1e6, file_size(filename));
+
+    start = std::chrono::steady_clock::now();
+    for (int round = 0; round < NUM_ROUNDS; round++) {
+      bbtrace::Trace loaded;
+      if (!load_trace(filename, &loaded)) {
+        fprintf(stderr, "Cannot read '%s'\n", filename.c_str());
+        return 1;
+      }
+    }
+    t = elapsed_since(start);
+    printf("parse/%-13s %8.2f Medges/s\n", formats[i], total / t / 1e6);
+
+    start = std::chrono::steady_clock::now();
+    for (int round = 0; round < NUM_ROUNDS; round++) {
+      std::vector<compact_edge> edges;
+      load_trace_edges(filename, &edges);
+    }
+    t = elapsed_since(start);
+    printf("edges/%-13s %8.2f Medges/s\n", formats[i], total / t / 1e6);
+  }
+
+  remove(filename.c_str());
+  return 0;
+}
@@ -0,0 +1,227 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+
+#include "./synth.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+#include "bts/perf.h"
+
+static const uint32_t SYNTH_PID = 1000;
+
+const char *synth_distribution_name(SynthDistribution dist) {
+  switch (dist) {
+  case SynthUniform:
+    return "uniform";
+  case SynthZipf:
+    return "zipf";
+  case SynthLoops:
+    return "loops";
+  case SynthCold:
+    return "cold";
+  }
+  return "unknown";
+}
+
+// Distinct edges, within a 1 MiB text section: branch targets are close to
+// their sources
+static void synth_edge_pool(int n_edges, std::mt19937_64 *rng,
+                            std::vector<bbmap_edge> *pool) {
+  pool->clear();
+  for (int i = 0; i < n_edges; i++) {
+    target_addr prev = 0x400000 + ((*rng)() % 0x100000);
+    target_addr next = prev + ((*rng)() % 0x200) - 0x100;
+    pool->push_back(bbmap_edge(prev, next));
+  }
+}
+
+// Zipf-like distribution over n items
+static std::discrete_distribution<int> synth_zipf(int n) {
+  std::vector<double> weights;
+  for (int i = 0; i < n; i++) {
+    weights.push_back(1.0 / (i + 1));
+  }
+  return std::discrete_distribution<int>(weights.begin(), weights.end());
+}
+
+void synth_edge_stream(SynthDistribution dist, int n_edges, int n_events,
+                       uint64_t seed, std::vector<bbmap_edge> *stream) {
+  std::mt19937_64 rng(seed);
+  std::vector<bbmap_edge> pool;
+  synth_edge_pool(n_edges, &rng, &pool);
+
+  stream->clear();
+  stream->reserve(n_events);
+
+  switch (dist) {
+  case SynthUniform:
+    for (int i = 0; i < n_events; i++) {
+      stream->push_back(pool[rng() % n_edges]);
+    }
+    break;
+
+  case SynthZipf: {
+    std::discrete_distribution<int> zipf = synth_zipf(n_edges);
+    for (int i = 0; i < n_events; i++) {
+      stream->push_back(pool[zipf(rng)]);
+    }
+    break;
+  }
+
+  case SynthLoops: {
+    // Loop bodies of 2-16 consecutive edges of the pool, the hottest loops
+    // being entered most often, and iterated 20 times on average
+    int n_loops = std::max(1, n_edges / 8);
+    std::discrete_distribution<int> zipf = synth_zipf(n_loops);
+    std::geometric_distribution<int> iterations(1.0 / 20);
+    while (static_cast<int>(stream->size()) < n_events) {
+      int first = (zipf(rng) * 8) % n_edges;
+      int length = 2 + rng() % 15;
+      for (int n = iterations(rng) + 1; n > 0; n--) {
+        for (int i = 0; i < length; i++) {
+          stream->push_back(pool[(first + i) % n_edges]);
+        }
+      }
+    }
+    stream->resize(n_events);
+    break;
+  }
+
+  case SynthCold:
+    // Walk the pool, with occasional jumps back to recent edges
+    for (int i = 0, next = 0; i < n_events; i++) {
+      if (next > 64 && rng() % 5 == 0) {
+        stream->push_back(pool[(next - 1 - rng() % 64) % n_edges]);
+      } else {
+        stream->push_back(pool[next++ % n_edges]);
+      }
+    }
+    break;
+  }
+}
+
+void synth_default_options(struct synth_record_options *options) {
+  options->n_tasks = 4;
+  options->task_burst = 4096;
+  options->mmap_every = 50000;
+  options->lost_every = 200000;
+  options->fork_every = 500000;
+}
+
+template <typename T>
+static void synth_append(std::vector<unsigned char> *records,
+                         const T &record) {
+  const unsigned char *p = reinterpret_cast<const unsigned char *>(&record);
+  records->insert(records->end(), p, p + sizeof(record));
+}
+
+static void synth_append_mmap(std::vector<unsigned char> *records, int i) {
+  char filename[64];
+  int len = snprintf(filename, sizeof(filename), "/usr/lib/libsynth%d.so", i);
+
+  size_t size = (sizeof(struct perf_event_mmap) + len + 1 + 7) & ~7;
+  std::vector<unsigned char> record(size, 0);
+  struct perf_event_mmap *event =
+    reinterpret_cast<struct perf_event_mmap *>(record.data());
+  event->header.type = PERF_RECORD_MMAP;
+  event->header.size = size;
+  event->pid = event->tid = SYNTH_PID;
+  event->addr = 0x7f0000000000ULL + i * 0x200000ULL;
+  event->len = 0x100000;
+  memcpy(event->filename, filename, len + 1);
+
+  records->insert(records->end(), record.begin(), record.end());
+}
+
+void synth_perf_records(const std::vector<bbmap_edge> &stream,
+                        const struct synth_record_options &options,
+                        uint64_t seed, std::vector<unsigned char> *records) {
+  std::mt19937_64 rng(seed);
+  std::geometric_distribution<int> burst(
+    1.0 / std::max(1, options.task_burst));
+  uint32_t tid = SYNTH_PID;
+  int switch_in = 0, n_mmaps = 0;
+
+  records->reserve(records->size() +
+                   stream.size() * sizeof(struct perf_event_bts_sample));
+
+  for (size_t i = 0; i < stream.size(); i++) {
+    if (switch_in-- <= 0) {
+      tid = SYNTH_PID + rng() % std::max(1, options.n_tasks);
+      switch_in = burst(rng);
+    }
+
+    struct perf_event_bts_sample sample;
+    memset(&sample, 0, sizeof(sample));
+    sample.header.type = PERF_RECORD_SAMPLE;
+    sample.header.size = sizeof(sample);
+    sample.bts.from = stream[i].first;
+    sample.bts.to = stream[i].second;
+    sample.bts.pid = SYNTH_PID;
+    sample.bts.tid = tid;
+    synth_append(records, sample);
+
+    if (options.mmap_every > 0 && i % options.mmap_every == 0) {
+      synth_append_mmap(records, n_mmaps++);
+    }
+
+    if (options.lost_every > 0 && i % options.lost_every == 0) {
+      struct perf_record_lost lost;
+      memset(&lost, 0, sizeof(lost));
+      lost.header.type = PERF_RECORD_LOST;
+      lost.header.size = sizeof(lost);
+      lost.lost = 1 + rng() % 1000;
+      synth_append(records, lost);
+    }
+
+    if (options.fork_every > 0 && i % options.fork_every == 0) {
+      struct perf_event_fork fork;
+      memset(&fork, 0, sizeof(fork));
+      fork.header.type = PERF_RECORD_FORK;
+      fork.header.size = sizeof(fork);
+      fork.pid = fork.ppid = fork.ptid = SYNTH_PID;
+      fork.tid = SYNTH_PID + options.n_tasks + i;
+      synth_append(records, fork);
+
+      struct perf_event_exit exit;
+      memset(&exit, 0, sizeof(exit));
+      exit.header.type = PERF_RECORD_EXIT;
+      exit.header.size = sizeof(exit);
+      exit.pid = SYNTH_PID;
+      exit.tid = fork.tid;
+      synth_append(records, exit);
+    }
+  }
+}
+
+size_t synth_records_chunk(const std::vector<unsigned char> &records,
+                           size_t from, size_t max_size) {
+  size_t to = from;
+  while (to < records.size()) {
+    const struct perf_event_header *header =
+      reinterpret_cast<const struct perf_event_header *>(&records[to]);
+    if (to + header->size - from > max_size) {
+      break;
+    }
+    to += header->size;
+  }
+  return to;
+}
+
+uint64_t synth_ring_write(unsigned char *ring, uint64_t ring_size,
+                          uint64_t head,
+                          const std::vector<unsigned char> &records,
+                          size_t from, size_t to) {
+  while (from < to) {
+    uint64_t offset = head & (ring_size - 1);
+    size_t n = std::min<uint64_t>(to - from, ring_size - offset);
+    memcpy(ring + offset, &records[from], n);
+    from += n;
+    head += n;
+  }
+  return head;
+}
@@ -0,0 +1,64 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Synthetic workloads for the microbenchmarks: streams of CFG edges with the
+// distributions of real traces, and perf ring buffer images built from them,
+// so that the hot paths of the tracer can be measured without BTS hardware.
+//
+
+#ifndef _BENCH_SYNTH_H
+#define _BENCH_SYNTH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "common/bbmap.h"
+
+enum SynthDistribution {
+  SynthUniform,                 // All edges equally likely
+  SynthZipf,                    // Skewed: a few hot edges dominate
+  SynthLoops,                   // Short sequences of edges, repeated
+  SynthCold,                    // Mostly first executions, little reuse
+};
+
+const char *synth_distribution_name(SynthDistribution dist);
+
+// Generate n_events CFG edges, drawn from n_edges distinct ones
+void synth_edge_stream(SynthDistribution dist, int n_edges, int n_events,
+                       uint64_t seed, std::vector<bbmap_edge> *stream);
+
+// Mix of perf records around the BTS samples. Rates are in samples per
+// record (0: none)
+struct synth_record_options {
+  int n_tasks;                  // Threads samples are spread over
+  int task_burst;               // Average samples per task switch
+  int mmap_every;
+  int lost_every;
+  int fork_every;               // A FORK and an EXIT record
+};
+
+// Default mix: a few threads, rare side-band records
+void synth_default_options(struct synth_record_options *options);
+
+// Append a perf record for each edge of the stream (a BTS sample, as
+// decoded by the monitor), interleaved with MMAP, LOST, FORK and EXIT
+// records
+void synth_perf_records(const std::vector<bbmap_edge> &stream,
+                        const struct synth_record_options &options,
+                        uint64_t seed, std::vector<unsigned char> *records);
+
+// Return the largest to such that records[from, to) is a sequence of whole
+// records of at most max_size bytes
+size_t synth_records_chunk(const std::vector<unsigned char> &records,
+                           size_t from, size_t max_size);
+
+// Copy records[from, to) into the data area of a ring of ring_size bytes (a
+// power of two), at free-running offset head, wrapping around its end as
+// the kernel does. Return the new head
+uint64_t synth_ring_write(unsigned char *ring, uint64_t ring_size,
+                          uint64_t head,
+                          const std::vector<unsigned char> &records,
+                          size_t from, size_t to);
+
+#endif  // _BENCH_SYNTH_H
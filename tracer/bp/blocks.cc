@@ -0,0 +1,75 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+
+#include "./blocks.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+BlockList::BlockList() : n_blocks_(0) {
+}
+
+bool BlockList::Load(const std::string &filename) {
+  std::ifstream in(filename.c_str());
+  if (!in) {
+    return false;
+  }
+
+  std::vector<target_addr> *blocks = NULL;
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream tokens(line);
+    std::string token;
+    if (!(tokens >> token) || token[0] == '#') {
+      continue;
+    }
+
+    if (token[0] == '[') {
+      size_t end = line.rfind(']');
+      size_t start = line.find('[');
+      if (end == std::string::npos || end <= start + 1) {
+        return false;
+      }
+      blocks = &modules_[line.substr(start + 1, end - start - 1)];
+      continue;
+    }
+
+    if (token[token.size() - 1] == ':') {
+      token.resize(token.size() - 1);
+    }
+    char *end;
+    target_addr addr = strtoull(token.c_str(), &end, 16);
+    if (token.empty() || *end != '\0') {
+      continue;
+    }
+
+    // Blocks before any module header have nowhere to go
+    if (blocks == NULL) {
+      return false;
+    }
+    blocks->push_back(addr);
+  }
+
+  n_blocks_ = 0;
+  for (auto it = modules_.begin(); it != modules_.end(); it++) {
+    std::vector<target_addr> &blocks = it->second;
+    std::sort(blocks.begin(), blocks.end());
+    blocks.erase(std::unique(blocks.begin(), blocks.end()), blocks.end());
+    n_blocks_ += blocks.size();
+  }
+  return true;
+}
+
+const std::vector<target_addr> *BlockList::Find(
+  const std::string &path) const {
+  auto it = modules_.find(path);
+  if (it == modules_.end()) {
+    size_t slash = path.rfind('/');
+    it = modules_.find(slash == std::string::npos ? path :
+                       path.substr(slash + 1));
+  }
+  return it != modules_.end() ? &it->second : NULL;
+}
@@ -0,0 +1,44 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Basic-block lists: where breakpoints are planted, module by module.
+//
+// A block list is a text file. A line "[<module>]" starts the blocks of a
+// module, named by full path or base name (as in image filter rules). Any
+// other line starts with the address of a block: hexadecimal, with or
+// without "0x" and a trailing ':'; the rest of the line is ignored. Addresses
+// are ELF virtual addresses, so listings of disassemblers (e.g., the basic
+// blocks exported from IDA or radare2) and symbol files (nm output, for
+// function-level coverage) can be used as they are. Lines that do not start
+// with an address (e.g., undefined symbols) and '#' comments are skipped.
+//
+
+#ifndef _BLOCKS_H_
+#define _BLOCKS_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "common/common.h"
+
+class BlockList {
+ public:
+  explicit BlockList();
+
+  // Add the blocks of a list file. Return false on error
+  bool Load(const std::string &filename);
+
+  // Sorted, unique blocks of the module at path (matched by full path or
+  // base name), NULL if none
+  const std::vector<target_addr> *Find(const std::string &path) const;
+
+  size_t size() const { return n_blocks_; }
+  size_t n_modules() const { return modules_.size(); }
+
+ private:
+  std::map<std::string, std::vector<target_addr> > modules_;
+  size_t n_blocks_;
+};
+
+#endif  // _BLOCKS_H_
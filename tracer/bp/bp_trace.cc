@@ -0,0 +1,114 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Trace block coverage with one-shot software breakpoints, using ptrace():
+// no hardware support required, and the target runs natively once each of
+// its blocks has been reached.
+//
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+
+#include "common/logging.h"
+#include "common/tracee.h"
+#include "./blocks.h"
+#include "./monitor.h"
+
+static void show_help(char **argv) {
+  fprintf(stderr,
+          "Syntax: %s -b <blocks> [-f <filename>] [-O <format>] "
+          "[-s <stats>] [-r] [-I <input>] [-t <ms>] [-H <ms>] cmdline\n"
+          "\n"
+          "  -b <blocks>    plant breakpoints at the blocks listed in file\n"
+          "                 <blocks> (see bp/blocks.h); can be repeated\n"
+          "  -f <filename>  serialize the execution trace to <filename>\n"
+          "  -O <format>    format of the trace file: 'protobuf' (default),\n"
+          "                 'stream' or 'compact' (see bts_trace)\n"
+          "  -s <stats>     append the statistics of the run to file\n"
+          "                 <stats> (see bts_trace)\n"
+          "  -r             store blocks as module-relative addresses\n"
+          "  -I <input>     feed file <input> to the standard input of the\n"
+          "                 target\n"
+          "  -t <ms>        kill the target after <ms> milliseconds\n"
+          "  -H <ms>        kill the target when it reaches no new blocks\n"
+          "                 for <ms> milliseconds (see bts_trace)\n",
+          argv[0]);
+}
+
+int main(int argc, char **argv) {
+  struct monitor_options options;
+  BlockList blocks;
+  std::string s_input;
+  int fd_input = -1;
+  int opt;
+
+  options.format = TraceFormatProtobuf;
+  options.module_relative = false;
+  options.blocks = &blocks;
+  options.timeout_ms = 0;
+  options.idle_ms = 0;
+
+  while ((opt = getopt(argc, argv, "b:f:O:s:rI:t:H:h")) != -1) {
+    switch (opt) {
+    case 'b':
+      if (!blocks.Load(optarg)) {
+        LOG_FATAL("Error reading block list '%s'", optarg);
+      }
+      break;
+    case 'f':
+      options.outfile = optarg;
+      break;
+    case 'O':
+      if (!serialize_parse_format(optarg, &options.format)) {
+        LOG_FATAL("Unknown trace format '%s'", optarg);
+      }
+      break;
+    case 's':
+      options.statsfile = optarg;
+      break;
+    case 'r':
+      options.module_relative = true;
+      break;
+    case 'I':
+      s_input = optarg;
+      break;
+    case 't':
+      options.timeout_ms = strtoul(optarg, NULL, 0);
+      break;
+    case 'H':
+      options.idle_ms = strtoul(optarg, NULL, 0);
+      break;
+    default:
+    case 'h':
+      show_help(argv);
+      exit(1);
+    }
+  }
+
+  if (optind >= argc || blocks.size() == 0) {
+    show_help(argv);
+    exit(1);
+  }
+
+  if (s_input.length() > 0) {
+    fd_input = open(s_input.c_str(), O_RDONLY);
+    if (fd_input == -1) {
+      LOG_FATAL("Error opening input file '%s'", s_input.c_str());
+    }
+  }
+
+  LOG_DEBUG("Loaded %zu blocks of %zu modules", blocks.size(),
+            blocks.n_modules());
+
+  pid_t pid_child = tracee_start(argv+optind, fd_input);
+  if (pid_child == -1) {
+    return 1;
+  }
+  LOG_DEBUG("Started child with pid %d", pid_child);
+  monitor_loop(pid_child, options);
+  return 0;
+}
@@ -0,0 +1,336 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+
+#include "./breakpoints.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+#include "common/logging.h"
+
+static const uint8_t INT3 = 0xcc;
+
+// Bodies of the loader function: ret, and endbr64; ret
+static const uint8_t LOADER_RET[] = { 0xc3 };
+static const uint8_t LOADER_ENDBR_RET[] = { 0xf3, 0x0f, 0x1e, 0xfa, 0xc3 };
+
+// A line of /proc/<pid>/maps
+struct breakpoint_mapping {
+  target_addr start, end;
+  bool executable;
+  uint64_t offset;
+  std::string path;
+};
+
+static bool breakpoint_read_maps(pid_t pid,
+                                 std::vector<breakpoint_mapping> *mappings) {
+  std::ifstream in("/proc/" + std::to_string(pid) + "/maps");
+  if (!in) {
+    return false;
+  }
+
+  std::string line;
+  while (std::getline(in, line)) {
+    breakpoint_mapping mapping;
+    char perms[8], path[4096];
+    path[0] = '\0';
+    if (sscanf(line.c_str(), "%" SCNx64 "-%" SCNx64 " %7s %" SCNx64
+               " %*s %*s %4095s", &mapping.start, &mapping.end, perms,
+               &mapping.offset, path) < 4) {
+      continue;
+    }
+    // Anonymous and special ([vdso], [stack]) mappings have no blocks
+    if (path[0] != '/') {
+      continue;
+    }
+    mapping.executable = perms[2] == 'x';
+    mapping.path = path;
+    mappings->push_back(mapping);
+  }
+  return true;
+}
+
+// Read an entry of the auxiliary vector of process pid (0: none)
+static target_addr breakpoint_auxv(pid_t pid, unsigned long type) {
+  std::ifstream in("/proc/" + std::to_string(pid) + "/auxv",
+                   std::ios::binary);
+  ElfW(auxv_t) aux;
+  while (in.read(reinterpret_cast<char *>(&aux), sizeof(aux)) &&
+         aux.a_type != AT_NULL) {
+    if (aux.a_type == type) {
+      return aux.a_un.a_val;
+    }
+  }
+  return 0;
+}
+
+BreakpointSpace::BreakpointSpace(pid_t pid)
+  : pid_(pid), entry_(0), entry_orig_(0), loader_(0), r_debug_(0) {
+  fd_mem_ = open(("/proc/" + std::to_string(pid) + "/mem").c_str(), O_RDWR);
+  if (fd_mem_ == -1) {
+    LOG_WARN("Cannot access the memory of process %d", pid);
+  }
+}
+
+BreakpointSpace::BreakpointSpace(const BreakpointSpace &parent, pid_t pid)
+  : BreakpointSpace(pid) {
+  entry_ = parent.entry_;
+  entry_orig_ = parent.entry_orig_;
+  loader_ = parent.loader_;
+  r_debug_ = parent.r_debug_;
+  breakpoints_ = parent.breakpoints_;
+  modules_ = parent.modules_;
+}
+
+BreakpointSpace::~BreakpointSpace() {
+  if (fd_mem_ != -1) {
+    close(fd_mem_);
+  }
+}
+
+bool BreakpointSpace::Write(target_addr addr, const uint8_t *data,
+                            size_t size) {
+  return pwrite(fd_mem_, data, size, addr) == static_cast<ssize_t>(size);
+}
+
+bool BreakpointSpace::Read(target_addr addr, uint8_t *data, size_t size) {
+  return pread(fd_mem_, data, size, addr) == static_cast<ssize_t>(size);
+}
+
+bool BreakpointSpace::PlantEntry() {
+  // The entry point is in the auxiliary vector, already relocated
+  target_addr entry = breakpoint_auxv(pid_, AT_ENTRY);
+  if (entry == 0 || !Read(entry, &entry_orig_, 1) ||
+      !Write(entry, &INT3, 1)) {
+    return false;
+  }
+  entry_ = entry;
+  return true;
+}
+
+bool BreakpointSpace::PlantLoader() {
+  // The dynamic section of the program points to the loader state
+  // (DT_DEBUG), and the program headers (in the auxiliary vector) to the
+  // dynamic section
+  target_addr phdr = breakpoint_auxv(pid_, AT_PHDR);
+  size_t phnum = breakpoint_auxv(pid_, AT_PHNUM);
+  std::vector<ElfW(Phdr)> headers(phnum);
+  if (phdr == 0 || phnum == 0 ||
+      !Read(phdr, reinterpret_cast<uint8_t *>(headers.data()),
+            phnum * sizeof(ElfW(Phdr)))) {
+    return false;
+  }
+
+  target_addr bias = 0, dynamic = 0;
+  for (size_t i = 0; i < phnum; i++) {
+    if (headers[i].p_type == PT_PHDR) {
+      bias = phdr - headers[i].p_vaddr;
+    } else if (headers[i].p_type == PT_DYNAMIC) {
+      dynamic = headers[i].p_vaddr;
+    }
+  }
+  if (dynamic == 0) {
+    return false;
+  }
+
+  target_addr r_debug = 0;
+  ElfW(Dyn) dyn;
+  for (target_addr addr = bias + dynamic;
+       Read(addr, reinterpret_cast<uint8_t *>(&dyn), sizeof(dyn)) &&
+         dyn.d_tag != DT_NULL; addr += sizeof(dyn)) {
+    if (dyn.d_tag == DT_DEBUG) {
+      r_debug = dyn.d_un.d_ptr;
+      break;
+    }
+  }
+
+  struct r_debug state;
+  if (r_debug == 0 ||
+      !Read(r_debug, reinterpret_cast<uint8_t *>(&state), sizeof(state))) {
+    return false;
+  }
+
+  // The breakpoint stays, so the function is emulated: it must be a bare
+  // return
+  uint8_t code[sizeof(LOADER_ENDBR_RET)];
+  if (state.r_brk == 0 || !Read(state.r_brk, code, sizeof(code)) ||
+      (memcmp(code, LOADER_RET, sizeof(LOADER_RET)) != 0 &&
+       memcmp(code, LOADER_ENDBR_RET, sizeof(LOADER_ENDBR_RET)) != 0)) {
+    return false;
+  }
+
+  if (!Write(state.r_brk, &INT3, 1)) {
+    return false;
+  }
+  loader_ = state.r_brk;
+  r_debug_ = r_debug;
+  return true;
+}
+
+bool BreakpointSpace::LoaderReturn(struct user_regs_struct *regs) {
+  target_addr retaddr;
+  if (!Read(regs->rsp, reinterpret_cast<uint8_t *>(&retaddr),
+            sizeof(retaddr))) {
+    return false;
+  }
+  regs->rip = retaddr;
+  regs->rsp += sizeof(retaddr);
+  return true;
+}
+
+bool BreakpointSpace::LoaderConsistent() {
+  struct r_debug state;
+  return Read(r_debug_, reinterpret_cast<uint8_t *>(&state), sizeof(state)) &&
+    state.r_state == r_debug::RT_CONSISTENT;
+}
+
+size_t BreakpointSpace::PlantRange(const target_addr *first,
+                                   const target_addr *last) {
+  // Rewrite the whole span at once: a couple of system calls, rather than
+  // two per breakpoint
+  target_addr start = *first;
+  std::vector<uint8_t> span(*(last - 1) - start + 1);
+  if (!Read(start, span.data(), span.size())) {
+    return 0;
+  }
+
+  size_t n = 0;
+  for (const target_addr *addr = first; addr != last; addr++) {
+    uint8_t &byte = span[*addr - start];
+    if (breakpoints_.count(*addr) != 0) {
+      continue;
+    }
+    breakpoints_[*addr] = byte;
+    byte = INT3;
+    n++;
+  }
+
+  if (!Write(start, span.data(), span.size())) {
+    return 0;
+  }
+  return n;
+}
+
+size_t BreakpointSpace::PlantModules(const BlockList &blocks,
+                                     std::vector<MemoryRegion> *regions) {
+  std::vector<breakpoint_mapping> mappings;
+  if (!breakpoint_read_maps(pid_, &mappings)) {
+    return 0;
+  }
+
+  // Modules unloaded with dlclose() are planted again if they come back,
+  // maybe elsewhere: forget them, and the breakpoints that are not in any
+  // executable mapping of the remaining ones
+  std::vector<std::string> mapped;
+  for (size_t i = 0; i < mappings.size(); i++) {
+    mapped.push_back(mappings[i].path);
+  }
+  std::sort(mapped.begin(), mapped.end());
+  size_t n_modules = modules_.size();
+  modules_.erase(std::remove_if(modules_.begin(), modules_.end(),
+                                [&](const std::string &path) {
+                                  return !std::binary_search(mapped.begin(),
+                                                             mapped.end(),
+                                                             path);
+                                }), modules_.end());
+  if (modules_.size() < n_modules) {
+    for (auto it = breakpoints_.begin(); it != breakpoints_.end(); ) {
+      bool planted = false;
+      for (size_t i = 0; i < mappings.size() && !planted; i++) {
+        planted = mappings[i].executable && mappings[i].start <= it->first &&
+          it->first < mappings[i].end &&
+          std::find(modules_.begin(), modules_.end(), mappings[i].path) !=
+          modules_.end();
+      }
+      it = planted ? std::next(it) : breakpoints_.erase(it);
+    }
+  }
+
+  size_t n = 0;
+  for (size_t i = 0; i < mappings.size(); i++) {
+    const breakpoint_mapping &image = mappings[i];
+    if (image.executable) {
+      MemoryRegion region;
+      region.base = image.start;
+      region.size = image.end - image.start;
+      region.filename = image.path;
+      regions->push_back(region);
+    }
+
+    // Modules are relocated as a whole: start from the mapping of their
+    // first page, that holds the ELF header
+    const std::vector<target_addr> *list = blocks.Find(image.path);
+    if (list == NULL || image.offset != 0 ||
+        std::find(modules_.begin(), modules_.end(), image.path) !=
+        modules_.end()) {
+      continue;
+    }
+    modules_.push_back(image.path);
+
+    ElfW(Ehdr) header;
+    if (!Read(image.start, reinterpret_cast<uint8_t *>(&header),
+              sizeof(header)) ||
+        memcmp(header.e_ident, ELFMAG, SELFMAG) != 0) {
+      LOG_WARN("Module '%s' is not an ELF image", image.path.c_str());
+      continue;
+    }
+
+    // Shared libraries and PIEs are linked at 0
+    target_addr bias = header.e_type == ET_DYN ? image.start : 0;
+    size_t n_module = 0;
+    for (size_t j = 0; j < mappings.size(); j++) {
+      if (!mappings[j].executable || mappings[j].path != image.path) {
+        continue;
+      }
+
+      std::vector<target_addr> addrs;
+      for (auto it = std::lower_bound(list->begin(), list->end(),
+                                      mappings[j].start - bias);
+           it != list->end() && *it + bias < mappings[j].end; it++) {
+        addrs.push_back(*it + bias);
+      }
+      if (!addrs.empty()) {
+        n_module += PlantRange(addrs.data(), addrs.data() + addrs.size());
+      }
+    }
+
+    LOG_DEBUG("Planted %zu breakpoints in '%s' (bias 0x%" PRIx64 ")",
+              n_module, image.path.c_str(), bias);
+    if (n_module < list->size()) {
+      LOG_WARN("%zu blocks of '%s' are outside of its code",
+               list->size() - n_module, image.path.c_str());
+    }
+    n += n_module;
+  }
+  return n;
+}
+
+BreakpointKind BreakpointSpace::Hit(target_addr addr) {
+  if (addr == loader_ && loader_ != 0) {
+    return BreakpointLoader;
+  }
+
+  if (addr == entry_ && entry_ != 0) {
+    Write(entry_, &entry_orig_, 1);
+    entry_ = 0;
+    return BreakpointEntry;
+  }
+
+  auto it = breakpoints_.find(addr);
+  if (it == breakpoints_.end()) {
+    return BreakpointNone;
+  }
+
+  // Another task may have removed it already: restoring is idempotent
+  Write(addr, &it->second, 1);
+  return BreakpointBlock;
+}
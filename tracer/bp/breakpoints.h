@@ -0,0 +1,98 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// One-shot software breakpoints in the address space of a traced process.
+//
+// A breakpoint is an int3 instruction written over the first byte of a
+// block. When a task traps on it, the original byte is restored and the task
+// is rewound to the block, so that it runs natively from then on: coverage
+// costs one trap per new block. Original bytes are kept after removal, so
+// that tasks racing on the same breakpoint (and forked processes, whose
+// memory may still hold breakpoints removed from their parent) are handled
+// as well.
+//
+// The only permanent breakpoint is planted in the function the dynamic loader
+// calls around each change of the list of loaded libraries (r_debug.r_brk,
+// see <link.h>): that function is a bare return, so the tracer emulates it
+// rather than executing it, and planting breakpoints in the libraries loaded
+// with dlopen() costs two traps per call.
+//
+
+#ifndef _BREAKPOINTS_H_
+#define _BREAKPOINTS_H_
+
+#include <sys/user.h>
+#include <unistd.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common/serialize.h"
+#include "./blocks.h"
+
+enum BreakpointKind {
+  BreakpointNone,               // Not one of ours
+  BreakpointBlock,              // A block of the list
+  BreakpointEntry,              // The entry point of the program
+  BreakpointLoader,             // The dynamic loader breakpoint
+};
+
+class BreakpointSpace {
+ public:
+  // The address space of process pid, without breakpoints
+  explicit BreakpointSpace(pid_t pid);
+
+  // The address space of process pid, just forked from the one of parent:
+  // the child inherits the breakpoints planted in the parent
+  BreakpointSpace(const BreakpointSpace &parent, pid_t pid);
+  ~BreakpointSpace();
+
+  // Plant a breakpoint at the entry point of the program just executed:
+  // once it is reached, the dynamic loader has mapped all the libraries the
+  // program depends on
+  bool PlantEntry();
+
+  // Plant the dynamic loader breakpoint, once the loader has initialized
+  // (e.g., at the entry point). Return false if there is none: the program
+  // is static, or the loader function is not a bare return
+  bool PlantLoader();
+
+  // Plant a breakpoint at each block of the listed modules currently mapped,
+  // and forget the modules unmapped since the last call. Executable mappings
+  // are appended to regions. Return the number of new breakpoints
+  size_t PlantModules(const BlockList &blocks,
+                      std::vector<MemoryRegion> *regions);
+
+  // Remove the breakpoint a task trapped on, at addr. For BreakpointBlock
+  // and BreakpointEntry, the task must be resumed at addr; for
+  // BreakpointLoader, at the address LoaderReturn() sets
+  BreakpointKind Hit(target_addr addr);
+
+  // Emulate the return from the loader function, on the registers of a task
+  // that trapped on the loader breakpoint
+  bool LoaderReturn(struct user_regs_struct *regs);
+
+  // True if the loader is done changing the list of libraries, i.e., if the
+  // modules must be planted again
+  bool LoaderConsistent();
+
+ private:
+  bool Write(target_addr addr, const uint8_t *data, size_t size);
+  bool Read(target_addr addr, uint8_t *data, size_t size);
+
+  // Plant breakpoints at the sorted addresses [first, last), all within an
+  // executable mapping
+  size_t PlantRange(const target_addr *first, const target_addr *last);
+
+  pid_t pid_;
+  int fd_mem_;                  // /proc/<pid>/mem
+  target_addr entry_;           // Entry point breakpoint (0: none)
+  uint8_t entry_orig_;
+  target_addr loader_;          // Loader breakpoint (0: none)
+  target_addr r_debug_;         // Loader state, struct r_debug
+  std::unordered_map<target_addr, uint8_t> breakpoints_;  // Original bytes
+  std::vector<std::string> modules_;  // Modules planted so far
+};
+
+#endif  // _BREAKPOINTS_H_
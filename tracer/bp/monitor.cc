@@ -0,0 +1,332 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+
+#include "./monitor.h"
+
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+#include <cassert>
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+
+#include "common/crash.h"
+#include "common/regions.h"
+#include "common/stats.h"
+#include "common/tracee.h"
+#include "common/watchdog.h"
+#include "./breakpoints.h"
+
+// A task of the target, and the address space it runs in. Threads (and
+// vfork() children, until they exec) share the space of their parent, while
+// forked processes get a copy of it
+struct monitor_task {
+  pid_t tgid;
+  std::shared_ptr<BreakpointSpace> space;
+};
+
+static ExecutionTrace gbl_execution_trace;
+static const struct monitor_options *gbl_options = NULL;
+
+// Tasks of the target that have not terminated yet. A new task and the fork
+// event of its parent are reported in any order: pending tasks have been
+// reported by their parent only, early tasks by their first stop only. Early
+// tasks are not resumed until their address space is known
+static std::map<pid_t, monitor_task> gbl_tasks;
+static std::set<pid_t> gbl_tasks_pending;
+static std::set<pid_t> gbl_tasks_early;
+
+static uint64_t gbl_n_hits = 0;
+static size_t gbl_n_breakpoints = 0;
+
+// Statistics of the run, and resource usage of the child when it terminated
+static RunStats gbl_stats;
+static struct rusage gbl_usage_child;
+
+// Time budget of the run. Block hits are progress
+static Watchdog gbl_watchdog;
+
+static void monitor_add_regions(const std::vector<MemoryRegion> &regions) {
+  std::vector<MemoryRegion> &known = gbl_execution_trace.memory_regions;
+  for (size_t i = 0; i < regions.size(); i++) {
+    bool found = false;
+    for (size_t j = 0; j < known.size() && !found; j++) {
+      found = known[j].base == regions[i].base &&
+        known[j].size == regions[i].size &&
+        known[j].filename == regions[i].filename;
+    }
+    if (!found) {
+      known.push_back(regions[i]);
+    }
+  }
+}
+
+// A task stopped by SIGTRAP. Return false if the trap is not caused by one
+// of our breakpoints, and must be delivered
+static bool monitor_handle_trap(pid_t pid) {
+  siginfo_t si;
+  int ret = ptrace(PTRACE_GETSIGINFO, pid, NULL, &si);
+  assert(ret != -1);
+
+  // int3 traps are reported by the kernel, other SIGTRAPs are sent by tasks
+  if (si.si_code != SI_KERNEL) {
+    return false;
+  }
+
+  monitor_task &task = gbl_tasks[pid];
+  if (task.space == NULL) {
+    return false;
+  }
+
+  struct user_regs_struct regs;
+  ret = ptrace(PTRACE_GETREGS, pid, NULL, &regs);
+  assert(ret != -1);
+  target_addr addr = regs.rip - 1;
+
+  BreakpointKind kind = task.space->Hit(addr);
+  if (kind == BreakpointNone) {
+    return false;
+  }
+
+  if (kind == BreakpointLoader) {
+    // The loader breakpoint stays: return to the caller of the function
+    if (!task.space->LoaderReturn(&regs)) {
+      return false;
+    }
+  } else {
+    // Execute the original instruction
+    regs.rip = addr;
+  }
+  ret = ptrace(PTRACE_SETREGS, pid, NULL, &regs);
+  assert(ret != -1);
+
+  if (kind == BreakpointEntry ||
+      (kind == BreakpointLoader && task.space->LoaderConsistent())) {
+    std::vector<MemoryRegion> regions;
+    size_t n = task.space->PlantModules(*gbl_options->blocks, &regions);
+    monitor_add_regions(regions);
+    gbl_n_breakpoints += n;
+    LOG_DEBUG("Process %d %s, planted %zu breakpoints", task.tgid,
+              kind == BreakpointEntry ? "reached its entry point" :
+              "loaded or unloaded libraries", n);
+
+    // Libraries loaded later on, with dlopen(), are planted as well
+    if (kind == BreakpointEntry && !task.space->PlantLoader()) {
+      LOG_DEBUG("No dynamic loader breakpoint in process %d", task.tgid);
+    }
+  } else if (kind == BreakpointBlock) {
+    gbl_execution_trace.tasks[task_id(task.tgid, pid)].AddEdge(addr, addr);
+    gbl_n_hits++;
+    gbl_watchdog.Progress();
+  }
+  return true;
+}
+
+// A task has created a new one, pid_new
+static void monitor_add_task(pid_t pid, int event, pid_t pid_new) {
+  monitor_task task = gbl_tasks[pid];
+  if (event == PTRACE_EVENT_FORK) {
+    task.tgid = pid_new;
+    if (task.space != NULL) {
+      task.space.reset(new BreakpointSpace(*task.space, pid_new));
+    }
+  } else if (event == PTRACE_EVENT_VFORK) {
+    task.tgid = pid_new;
+  }
+  gbl_tasks[pid_new] = task;
+
+  // The new task may have already stopped, or even terminated
+  if (gbl_tasks_early.erase(pid_new) != 0) {
+    int ret = ptrace(PTRACE_CONT, pid_new, 0, 0);
+    assert(ret != -1);
+  } else {
+    gbl_tasks_pending.insert(pid_new);
+  }
+}
+
+static int monitor_run(pid_t pid_child) {
+  int ret, status, status_child = 0;
+  bool options_set = false;
+  pid_t pid;
+
+  monitor_task task_child = { pid_child, NULL };
+  gbl_tasks[pid_child] = task_child;
+  uint64_t n_stops = 0;
+  TraceHang hang = TraceHangNone;
+  if (!gbl_watchdog.Start(gbl_options->timeout_ms, gbl_options->idle_ms)) {
+    LOG_FATAL("Cannot enforce the time budget of the run");
+  }
+
+  // Wait until all the tasks terminate, one of them crashes, or the watchdog
+  // interrupts a hung run
+  while (!gbl_tasks.empty()) {
+    struct rusage usage;
+    pid = wait4(-1, &status, __WALL, &usage);
+    if (pid == -1) {
+      if (errno == EINTR) {
+        hang = gbl_watchdog.hang();
+        if (hang != TraceHangNone) {
+          break;
+        }
+        continue;
+      }
+      LOG_FATAL("Error waiting for the target: %s", strerror(errno));
+    }
+
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      if (pid == pid_child) {
+        gbl_usage_child = usage;
+      }
+      gbl_tasks.erase(pid);
+      gbl_tasks_pending.erase(pid);
+      gbl_tasks_early.erase(pid);
+      if (pid == pid_child) {
+        status_child = status;
+      }
+      continue;
+    }
+
+    assert(WIFSTOPPED(status));
+    int signum = WSTOPSIG(status);
+    int event = status >> 16;
+    n_stops++;
+
+    if (gbl_tasks.count(pid) == 0) {
+      // First stop of a task its parent has not reported yet
+      assert(signum == SIGSTOP);
+      gbl_tasks_early.insert(pid);
+      continue;
+    } else if (gbl_tasks_pending.erase(pid) != 0) {
+      // First stop of a new task
+      assert(signum == SIGSTOP);
+      signum = 0;
+    } else if (event == PTRACE_EVENT_FORK || event == PTRACE_EVENT_VFORK ||
+               event == PTRACE_EVENT_CLONE) {
+      unsigned long msg;
+      ret = ptrace(PTRACE_GETEVENTMSG, pid, NULL, &msg);
+      assert(ret != -1);
+      monitor_add_task(pid, event, msg);
+      signum = 0;
+    } else if (event == PTRACE_EVENT_EXEC) {
+      // A new program: wait for the loader before planting breakpoints
+      monitor_task &task = gbl_tasks[pid];
+      task.tgid = pid;
+      task.space.reset(new BreakpointSpace(pid));
+      if (!task.space->PlantEntry()) {
+        LOG_WARN("Cannot find the entry point of process %d", pid);
+      }
+      signum = 0;
+    } else if (signum == SIGTRAP && pid == pid_child && !options_set) {
+      // Stopped by tracee_start(), before exec
+      ret = ptrace(PTRACE_SETOPTIONS, pid, 0, MONITOR_PTRACE_OPTIONS);
+      assert(ret != -1);
+      options_set = true;
+      signum = 0;
+    } else if (signum == SIGTRAP && monitor_handle_trap(pid)) {
+      signum = 0;
+    } else if (tracee_is_fatal(signum) ||
+               (signum == SIGTRAP && !tracee_catches(pid, signum))) {
+      // A SIGTRAP of the target (e.g., a stray int3) is delivered, unless it
+      // would kill the target
+      LOG_DEBUG("Task %d stopped by signal #%d", pid, signum);
+      std::shared_ptr<Exception> exc = tracee_exception(pid);
+      if (exc != NULL) {
+        gbl_execution_trace.exceptions.push_back(exc);
+      }
+      status_child = status;
+      break;
+    }
+
+    // Resume the task, delivering any non-fatal signal (e.g., SIGCHLD)
+    ret = ptrace(PTRACE_CONT, pid, 0, signum);
+    assert(ret != -1);
+  }
+  gbl_watchdog.Stop();
+
+  if (hang != TraceHangNone) {
+    LOG_INFO("Run %s, stopping it", hang == TraceHangTimeout ?
+             "timed out" : "made no progress");
+    status_child = SIGKILL;
+  }
+  gbl_execution_trace.hang = hang;
+
+  // The other tasks are killed as well, when the tracer terminates
+  for (auto it = gbl_tasks.begin(); it != gbl_tasks.end(); it++) {
+    kill(it->first, SIGKILL);
+  }
+
+  gbl_stats.Set("ptrace_stops", n_stops);
+  gbl_stats.Set("hang", hang);
+  return status_child;
+}
+
+static void monitor_finish(void) {
+  for (auto it = gbl_execution_trace.tasks.begin();
+       it != gbl_execution_trace.tasks.end(); it++) {
+    gbl_execution_trace.basic_blocks.Merge(it->second);
+  }
+
+  if (gbl_options->module_relative) {
+    int dropped = regions_relocate_trace(&gbl_execution_trace);
+    if (dropped > 0) {
+      LOG_INFO("Dropped %d blocks outside of known modules", dropped);
+    }
+  }
+
+  // Bucketing tools read the signatures instead of resolving stack traces
+  crash_sign_trace(&gbl_execution_trace);
+
+  LOG_INFO("Planted %zu breakpoints, got %" PRIu64 " hits (%d blocks, %zu "
+           "tasks)", gbl_n_breakpoints, gbl_n_hits,
+           gbl_execution_trace.basic_blocks.size(),
+           gbl_execution_trace.tasks.size());
+  gbl_stats.Set("breakpoints", gbl_n_breakpoints);
+  gbl_stats.Set("hits", gbl_n_hits);
+  stats_add_trace(&gbl_stats, gbl_execution_trace);
+
+  if (gbl_options->outfile.length() > 0) {
+    LOG_INFO("Serializing to %s", gbl_options->outfile.c_str());
+    if (!stats_serialize_trace(&gbl_stats, gbl_options->outfile,
+                               gbl_execution_trace, gbl_options->format)) {
+      LOG_WARN("Error writing trace file %s", gbl_options->outfile.c_str());
+    }
+  }
+}
+
+int monitor_loop(pid_t pid_child, const struct monitor_options &options) {
+  gbl_options = &options;
+
+  struct rusage usage_start, usage;
+  getrusage(RUSAGE_SELF, &usage_start);
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+
+  gbl_stats.Set("run", 1);
+  int status = monitor_run(pid_child);
+  std::chrono::duration<double, std::milli> elapsed =
+    std::chrono::steady_clock::now() - start;
+  gbl_stats.SetDouble("wall_ms", elapsed.count());
+  stats_add_usage(&gbl_stats, "target", gbl_usage_child);
+  monitor_finish();
+
+  if (gbl_options->statsfile.length() > 0) {
+    getrusage(RUSAGE_SELF, &usage);
+    stats_add_usage(&gbl_stats, "tracer", usage, &usage_start);
+    if (!gbl_stats.Append(gbl_options->statsfile)) {
+      LOG_WARN("Error writing stats file %s",
+               gbl_options->statsfile.c_str());
+    }
+  }
+  return status;
+}
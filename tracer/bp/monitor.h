@@ -0,0 +1,41 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+
+#ifndef _MONITOR_H_
+#define _MONITOR_H_
+
+#include <sys/ptrace.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "common/serialize.h"
+#include "./blocks.h"
+
+// ptrace() options for the target: follow all the processes and threads it
+// creates, and the programs they execute
+#define MONITOR_PTRACE_OPTIONS                                          \
+  (PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACECLONE |     \
+   PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL)
+
+// Tracing options
+struct monitor_options {
+  std::string outfile;          // Output trace file (empty: no trace)
+  TraceFormat format;           // Format of the output trace file
+  bool module_relative;         // Store module-relative edges
+  const BlockList *blocks;      // Where to plant breakpoints
+  std::string statsfile;        // Statistics file (empty: none)
+  unsigned int timeout_ms;      // Time budget of the run (0: none)
+  unsigned int idle_ms;         // Hang after this long without new blocks
+};
+
+// Monitor child until all of its tasks terminate, one of them crashes, or
+// the run hangs (see common/watchdog.h), then output the execution trace. A
+// block hit is recorded as the edge (block, block), so that traces keep the
+// format of the other back-ends. Return the last wait status of the child,
+// or the status of the crashed task. Hung runs are killed, and reported as
+// killed by SIGKILL
+int monitor_loop(pid_t pid_child, const struct monitor_options &options);
+
+#endif  // _MONITOR_H_
@@ -0,0 +1,70 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+
+#include "./aggregate.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+EdgeAggregator::EdgeAggregator() {
+  memset(cache_, 0, sizeof(cache_));
+}
+
+#if defined(__SSE2__)
+// The two endpoints of a sample, in one vector: the 16 bytes at from are
+// {from, pid/tid}, the 16 bytes before the end of the record {pid/tid, to}
+static inline __m128i aggregate_endpoints(
+  const struct perf_event_bts_sample *sample) {
+  const struct perf_event_bts *bts = &sample->bts;
+  __m128d lo = _mm_loadu_pd(reinterpret_cast<const double *>(&bts->from));
+  __m128d hi = _mm_loadu_pd(reinterpret_cast<const double *>(&bts->pid));
+  return _mm_castpd_si128(_mm_shuffle_pd(lo, hi, 2));
+}
+#endif
+
+void EdgeAggregator::AddSamples(const struct perf_event_bts_sample *samples,
+                                size_t n) {
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  // Check the four endpoints of two samples at once: both samples are in
+  // user space if no endpoint has any bit set from bit 47 on
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 2 <= n; i += 2) {
+    __m128i addrs = _mm_or_si128(aggregate_endpoints(&samples[i]),
+                                 aggregate_endpoints(&samples[i + 1]));
+    __m128i high = _mm_srli_epi64(addrs, 47);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(high, zero)) == 0xffff) {
+      Add(&samples[i].bts);
+      Add(&samples[i + 1].bts);
+      continue;
+    }
+
+    // At least one of them is not
+    for (size_t j = i; j < i + 2; j++) {
+      if (!perf_is_kernel_addr(samples[j].bts.from) &&
+          !perf_is_kernel_addr(samples[j].bts.to)) {
+        Add(&samples[j].bts);
+      }
+    }
+  }
+#endif
+
+  for (; i < n; i++) {
+    if (!perf_is_kernel_addr(samples[i].bts.from) &&
+        !perf_is_kernel_addr(samples[i].bts.to)) {
+      Add(&samples[i].bts);
+    }
+  }
+}
+
+void EdgeAggregator::Flush() {
+  for (size_t i = 0; i < (1 << AGGREGATE_CACHE_BITS); i++) {
+    if (cache_[i].count != 0) {
+      spill_.push_back(cache_[i]);
+      cache_[i].count = 0;
+    }
+  }
+}
@@ -0,0 +1,76 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Batch decoding of BTS samples, with pre-aggregation of hot edges.
+//
+// Hot loops repeat the same few edges thousands of times in a row. Samples
+// are counted in a small direct-mapped cache of (task, edge) entries, and
+// each edge reaches the edge tables (and the address filter) only when its
+// entry is evicted or flushed, with the number of samples it collected.
+//
+
+#ifndef _AGGREGATE_H_
+#define _AGGREGATE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include "common/common.h"
+#include "./perf.h"
+
+#define AGGREGATE_CACHE_BITS 8
+
+struct aggregate_entry {
+  target_addr prev;
+  target_addr next;
+  uint64_t task;                // pid in the lower 32 bits, tid in the upper
+  uint64_t count;               // Samples (0: empty entry)
+};
+
+class EdgeAggregator {
+ public:
+  explicit EdgeAggregator();
+
+  // Count the samples of an array of n BTS sample records, skipping those
+  // with a kernel-space endpoint. Entries evicted from the cache are
+  // appended to the spill list
+  void AddSamples(const struct perf_event_bts_sample *samples, size_t n);
+
+  // Move all the cached entries to the spill list
+  void Flush();
+
+  // Entries evicted or flushed so far, to be consumed (and cleared) by the
+  // caller
+  std::vector<aggregate_entry> &spill() { return spill_; }
+
+ private:
+  inline void Add(const struct perf_event_bts *bts) {
+    uint64_t task;
+    memcpy(&task, &bts->pid, sizeof(task));
+
+    // Fibonacci hashing: consecutive addresses spread over the cache
+    uint64_t h = (bts->from ^ (bts->to << 1) ^ task) * 0x9e3779b97f4a7c15ULL;
+    aggregate_entry &entry = cache_[h >> (64 - AGGREGATE_CACHE_BITS)];
+    if (entry.prev == bts->from && entry.next == bts->to &&
+        entry.task == task && entry.count != 0) {
+      entry.count++;
+      return;
+    }
+
+    if (entry.count != 0) {
+      spill_.push_back(entry);
+    }
+    entry.prev = bts->from;
+    entry.next = bts->to;
+    entry.task = task;
+    entry.count = 1;
+  }
+
+  aggregate_entry cache_[1 << AGGREGATE_CACHE_BITS];
+  std::vector<aggregate_entry> spill_;
+};
+
+#endif  // _AGGREGATE_H_
@@ -0,0 +1,124 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Every input is executed by a new process, with its own perf event, but all
+// the long-lived state (bounce buffer, execution trace containers) is set up
+// once, by the tracer, and reused across runs.
+//
+
+#include "./batch.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <unordered_set>
+
+#include "common/load.h"
+#include "common/logging.h"
+
+static const char *INPUT_PLACEHOLDER = "@@";
+
+bool batch_collect_inputs(const std::string &path,
+                          std::vector<std::string> *inputs) {
+  struct stat st;
+  if (stat(path.c_str(), &st) == -1) {
+    return false;
+  }
+
+  // Directories are collected like those of traces
+  if (S_ISDIR(st.st_mode)) {
+    return load_collect_traces(path, inputs);
+  }
+
+  // List of input files
+  std::ifstream instream(path.c_str());
+  std::string line;
+  while (std::getline(instream, line)) {
+    if (line.length() > 0) {
+      inputs->push_back(line);
+    }
+  }
+  return true;
+}
+
+bool batch_loop(fuzztrace::Tracer *tracer, char **argv,
+                const std::vector<std::string> &inputs,
+                const std::string &outdir, struct monitor_options *options) {
+  // Inputs listed from different directories may share their base name
+  std::vector<std::string> names;
+  if (outdir.length() > 0 && !load_output_names(inputs, &names)) {
+    LOG_WARN("Input files have colliding trace names");
+    return false;
+  }
+
+  // Find placeholders in the command line template
+  std::vector<std::string> args;
+  std::vector<int> placeholders;
+  for (int i = 0; argv[i] != NULL; i++) {
+    args.push_back(argv[i]);
+    if (args.back() == INPUT_PLACEHOLDER) {
+      placeholders.push_back(i);
+    }
+  }
+
+  std::vector<char *> child_argv(args.size() + 1, NULL);
+
+  // Coverage hashes of the runs so far, to spot inputs that take new paths
+  std::unordered_set<uint64_t> paths;
+
+  for (size_t n = 0; n < inputs.size(); n++) {
+    const std::string &input = inputs[n];
+    std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+
+    // Instantiate the command line for this input
+    for (size_t i = 0; i < placeholders.size(); i++) {
+      args[placeholders[i]] = input;
+    }
+    for (size_t i = 0; i < args.size(); i++) {
+      child_argv[i] = const_cast<char *>(args[i].c_str());
+    }
+
+    int fd_input = -1;
+    if (placeholders.size() == 0) {
+      fd_input = open(input.c_str(), O_RDONLY);
+      if (fd_input == -1) {
+        LOG_WARN("Skipping unreadable input file '%s'", input.c_str());
+        continue;
+      }
+    }
+
+    if (outdir.length() > 0) {
+      options->outfile = outdir + "/" + names[n] + ".trace";
+    }
+
+    int status;
+    bool traced = tracer->Run(child_argv.data(), fd_input, *options, &status);
+
+    if (fd_input != -1) {
+      close(fd_input);
+    }
+
+    if (!traced) {
+      LOG_WARN("[%zu/%zu] %s: error tracing the target", n + 1, inputs.size(),
+               input.c_str());
+      continue;
+    }
+
+    std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+    const struct perf_status &perf = tracer->status();
+    bool new_path = paths.insert(perf.coverage_hash_buckets).second;
+    LOG_INFO("[%zu/%zu] %s: %d events, %.3f ms, status 0x%x%s%s", n + 1,
+             inputs.size(), input.c_str(), perf.n_events,
+             elapsed.count(), status,
+             perf.hang != TraceHangNone ? ", hang" : "",
+             new_path ? ", new path" : "");
+  }
+
+  LOG_INFO("%zu distinct paths", paths.size());
+  return true;
+}
@@ -0,0 +1,32 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Batch mode: trace a set of input files within a single session.
+//
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include <string>
+#include <vector>
+
+#include "./monitor.h"
+#include "./tracer.h"
+
+// Collect the input files found in a directory (see load_collect_traces()),
+// or listed in a file (one name per line). Return false on error
+bool batch_collect_inputs(const std::string &path,
+                          std::vector<std::string> *inputs);
+
+// Trace the command line argv once for each input file. Occurrences of "@@"
+// in argv are replaced with the name of the input file; when there are none,
+// the input file is fed to the standard input of the target. If outdir is not
+// empty, the trace of input file <name> is saved to <outdir>/<name>.trace,
+// where <name> is the base name of the input, prefixed with its index
+// ("<index>-<name>") when several inputs share it. Return false, before
+// tracing anything, if trace names still collide
+bool batch_loop(fuzztrace::Tracer *tracer, char **argv,
+                const std::vector<std::string> &inputs,
+                const std::string &outdir, struct monitor_options *options);
+
+#endif  // _BATCH_H_
@@ -0,0 +1,134 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Offline decoder of the capture files written by bts_trace -R: rebuild the
+// execution trace of the captured run, decoding records on several threads.
+// The same capture can be decoded again with different filters.
+//
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <string>
+
+#include "common/crash.h"
+#include "common/logging.h"
+#include "common/parallel.h"
+#include "common/regions.h"
+#include "common/serialize.h"
+#include "./capture.h"
+
+// Bytes of records per work item: enough to amortize the per-segment setup,
+// small enough to balance the load among threads
+#define DEFAULT_SEGMENT_SIZE (4 << 20)
+
+static void show_help(char **argv) {
+  fprintf(stderr,
+          "Syntax: %s [-f <filename>] [-O <format>] [-r] [-i <rule>] "
+          "[-x <rule>] [-j <threads>] [-S <size>] capture\n"
+          "\n"
+          "  -f <filename>  serialize the execution trace to <filename>\n"
+          "  -O <format>    format of the trace file: 'protobuf' (default),\n"
+          "                 'stream' or 'compact' (see bts_trace)\n"
+          "  -r             store edges as module-relative addresses\n"
+          "  -i <rule>      decode only edges within image or address range\n"
+          "                 <rule>; can be repeated\n"
+          "  -x <rule>      do not decode edges within image or address\n"
+          "                 range <rule>; can be repeated\n"
+          "  -j <threads>   number of decoding threads (default: one per\n"
+          "                 CPU)\n"
+          "  -S <size>      bytes of records per work item (default: %d)\n",
+          argv[0], DEFAULT_SEGMENT_SIZE);
+}
+
+int main(int argc, char **argv) {
+  std::string outfile;
+  TraceFormat format = TraceFormatProtobuf;
+  bool module_relative = false;
+  AddressFilter filter;
+  struct capture_decode_options options;
+  int opt;
+
+  options.n_threads = parallel_threads();
+  options.segment_size = DEFAULT_SEGMENT_SIZE;
+
+  while ((opt = getopt(argc, argv, "f:O:ri:x:j:S:h")) != -1) {
+    switch (opt) {
+    case 'f':
+      outfile = optarg;
+      break;
+    case 'O':
+      if (!serialize_parse_format(optarg, &format)) {
+        LOG_FATAL("Unknown trace format '%s'", optarg);
+      }
+      break;
+    case 'r':
+      module_relative = true;
+      break;
+    case 'i':
+    case 'x':
+      if (!filter.AddRule(opt == 'i', optarg)) {
+        LOG_FATAL("Invalid address range '%s'", optarg);
+      }
+      break;
+    case 'j':
+      options.n_threads = std::max(1UL, strtoul(optarg, NULL, 0));
+      break;
+    case 'S':
+      options.segment_size = std::max(1UL, strtoul(optarg, NULL, 0));
+      break;
+    default:
+    case 'h':
+      show_help(argv);
+      exit(1);
+    }
+  }
+
+  if (optind != argc - 1) {
+    show_help(argv);
+    exit(1);
+  }
+
+  CaptureReader capture;
+  if (!capture.Open(argv[optind])) {
+    LOG_FATAL("Error reading capture file '%s'", argv[optind]);
+  }
+
+  options.filter = filter.enabled() ? &filter : NULL;
+
+  ExecutionTrace execution_trace;
+  struct capture_decode_stats stats;
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  capture_decode(capture, options, &execution_trace, &stats);
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+
+  LOG_INFO("Decoded %" PRIu64 " records (%" PRIu64 " bytes, %zu segments) "
+           "in %.3f s on %u threads", stats.n_records, capture.size(),
+           stats.n_segments, elapsed.count(), options.n_threads);
+  LOG_INFO("Got %" PRIu64 " events out of %" PRIu64 " samples (%d CFG "
+           "edges, %zu tasks), %" PRIu64 " samples lost", stats.n_events,
+           stats.n_samples, execution_trace.basic_blocks.size(),
+           stats.n_tasks, stats.n_lost);
+
+  // Same post-processing as monitor_finish()
+  if (module_relative) {
+    int dropped = regions_relocate_trace(&execution_trace);
+    if (dropped > 0) {
+      LOG_INFO("Dropped %d CFG edges outside of known modules", dropped);
+    }
+  }
+  crash_sign_trace(&execution_trace);
+
+  if (outfile.length() > 0) {
+    LOG_INFO("Serializing to %s", outfile.c_str());
+    if (!serialize_trace_format(outfile, execution_trace, format)) {
+      LOG_FATAL("Error writing trace file %s", outfile.c_str());
+    }
+  }
+  return 0;
+}
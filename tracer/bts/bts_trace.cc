@@ -10,78 +10,164 @@
 
 #include "./bts_trace.h"
 
-#include <assert.h>
 #include <fcntl.h>
 #include <getopt.h>
-#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ioctl.h>
-#include <sys/mman.h>
-#include <sys/ptrace.h>
 
 #include "common/logging.h"
+#include "./batch.h"
+#include "./capture.h"
+#include "./forkserver.h"
 #include "./monitor.h"
-#include "./perf.h"
-
-struct perf_global_status gbl_status = {
-  NULL,                         // mmap
-  NULL,                         // data
-  0,                            // data_size
-  0,                            // fd_evt
-  0,                            // prev_head
-  0,                            // n_events
-  0,                            // pid_child
-  0                             // data_ready
-};
-
-static pid_t child_start(char **argv) {
-  pid_t pid;
-  int ret;
-
-  pid = fork();
-  assert(pid >= 0);
-  if (pid == 0) {
-    // Child
-    ret = ptrace(PTRACE_TRACEME, 0, 0, 0);
-    assert(ret != -1);
-
-    raise(SIGTRAP);
-    execvp(argv[0], argv);
-
-    // Unreachable
-    assert(0);
-  }
-
-  // Parent
-  return pid;
-}
+#include "./tracer.h"
 
 static void show_help(char **argv) {
-  fprintf(stderr, "Syntax: %s [-f <filename>] cmdline\n", argv[0]);
-}
-
-// Signal handler to process perf events.
-static void sig_handler(int signum, siginfo_t *siginfo, void *dummy) {
-  if (signum == SIGIO) {
-    kill(gbl_status.pid_child, SIGTRAP);
-    gbl_status.data_ready++;
-  }
+  fprintf(stderr,
+          "Syntax: %s [-f <filename>] [-O <format>] [-s <stats>] "
+          "[-m <shm> [-M <size>]] [-r] [-i <rule>] [-x <rule>] "
+          "[-R <capture>] [-I <input>] [-t <ms>] [-H <ms>] [-P] "
+          "[-p <pages>] [-W <bytes>] [-A] [-F | -B <inputs> [-o <outdir>]] "
+          "cmdline\n"
+          "\n"
+          "  -f <filename>  serialize the execution trace to <filename>\n"
+          "  -O <format>    format of the trace file: 'protobuf' (a single\n"
+          "                 message, default), 'stream' (a sequence of\n"
+          "                 chunks, without building the whole message) or\n"
+          "                 'compact' (mmap()'able, without per-task edges)\n"
+          "  -s <stats>     append the statistics of each run (times, ring\n"
+          "                 and decoder counters, edge table and trace\n"
+          "                 sizes) to file <stats>\n"
+          "  -r             store edges as module-relative addresses (module\n"
+          "                 id and offset), stable across runs\n"
+          "  -i <rule>      trace only edges within image <rule> (full path\n"
+          "                 or base name) or address range <rule>\n"
+          "                 (0xSTART-0xEND); can be repeated\n"
+          "  -x <rule>      do not trace edges within image or address range\n"
+          "                 <rule>; can be repeated\n"
+          "  -m <shm>       update an AFL-style coverage bitmap, stored in\n"
+          "                 the SysV (numeric id) or POSIX ('/name') shared\n"
+          "                 memory segment <shm>\n"
+          "  -M <size>      size of the coverage bitmap (default: %d)\n"
+          "  -R <capture>   capture mode: dump raw perf records to file\n"
+          "                 <capture>, to be decoded offline by bts_decode\n"
+          "                 (that takes the -f, -O, -r, -i and -x options)\n"
+          "  -P             open one inherited perf event (and ring buffer)\n"
+          "                 per CPU, to trace all the threads of the\n"
+          "                 target, and decode rings in parallel\n"
+          "  -p <pages>     data pages of each ring buffer, a power of two\n"
+          "                 (default: %d)\n"
+          "  -W <bytes>     wake up the drain threads every <bytes> of new\n"
+          "                 records (default: 1/128 of the ring)\n"
+          "  -A             fork server and batch modes: double the size of\n"
+          "                 the rings (up to %d pages) after a run that lost\n"
+          "                 records, or woke up the drain threads too often\n"
+          "  -I <input>     feed file <input> to the standard input of the\n"
+          "                 target\n"
+          "  -t <ms>        kill the target after <ms> milliseconds: the\n"
+          "                 partial trace is marked as a hang\n"
+          "  -H <ms>        kill the target (as -t) when it takes no new\n"
+          "                 edges for <ms> milliseconds\n"
+          "  -F             fork server mode, controlled through file\n"
+          "                 descriptors %d (commands) and %d (status)\n"
+          "  -B <inputs>    batch mode: trace cmdline once for each input\n"
+          "                 file in directory <inputs> (or listed in file\n"
+          "                 <inputs>). '@@' in cmdline is replaced with the\n"
+          "                 input file name, otherwise the input is fed to\n"
+          "                 the standard input of the target\n"
+          "  -o <outdir>    batch mode: save the trace of each input <name>\n"
+          "                 to <outdir>/<name>.trace (<name> is prefixed\n"
+          "                 with the index of the input when several\n"
+          "                 inputs share it)\n",
+          argv[0], DEFAULT_BITMAP_SIZE, DEFAULT_MMAP_PAGES, MAX_MMAP_PAGES,
+          FORKSRV_FD, FORKSRV_FD + 1);
 }
 
 int main(int argc, char **argv) {
-  struct perf_event_attr pe;
-  struct sigaction sa;
-  pid_t pid_child;
+  fuzztrace::TracerConfig config;
   int opt;
-  std::string s_outfile;
+  struct monitor_options options;
+  std::string s_shm;
+  unsigned int bitmap_size = DEFAULT_BITMAP_SIZE;
+  CoverageBitmap bitmap;
+  AddressFilter filter;
+  std::string s_input;
+  int fd_input = -1;
+  bool forkserver = false;
+  std::string s_batch, s_outdir;
+  std::string s_capture;
+  CaptureWriter capture;
 
-  while ((opt = getopt(argc, argv, "f:h")) != -1) {
+  while ((opt = getopt(argc, argv, "f:O:s:ri:x:R:m:M:I:t:H:Pp:W:AFB:o:h")) !=
+         -1) {
     switch (opt) {
     case 'f':
-      s_outfile = optarg;
+      options.outfile = optarg;
+      break;
+    case 'O':
+      if (!serialize_parse_format(optarg, &options.format)) {
+        LOG_FATAL("Unknown trace format '%s'", optarg);
+      }
+      break;
+    case 's':
+      options.statsfile = optarg;
+      break;
+    case 'r':
+      options.module_relative = true;
+      break;
+    case 'i':
+    case 'x':
+      if (!filter.AddRule(opt == 'i', optarg)) {
+        LOG_FATAL("Invalid address range '%s'", optarg);
+      }
+      break;
+    case 'R':
+      s_capture = optarg;
+      break;
+    case 'm':
+      s_shm = optarg;
+      break;
+    case 'M':
+      bitmap_size = strtoul(optarg, NULL, 0);
+      break;
+    case 'I':
+      s_input = optarg;
+      break;
+    case 't':
+      options.timeout_ms = strtoul(optarg, NULL, 0);
+      break;
+    case 'H':
+      options.idle_ms = strtoul(optarg, NULL, 0);
+      break;
+    case 'P':
+      config.percpu = true;
+      break;
+    case 'p':
+      config.mmap_pages = strtol(optarg, NULL, 0);
+      if (config.mmap_pages <= 0 || config.mmap_pages > MAX_MMAP_PAGES ||
+          (config.mmap_pages & (config.mmap_pages - 1)) != 0) {
+        LOG_FATAL("Invalid number of ring pages '%s'", optarg);
+      }
+      break;
+    case 'W':
+      config.watermark = strtol(optarg, NULL, 0);
+      if (config.watermark <= 0) {
+        LOG_FATAL("Invalid wakeup watermark '%s'", optarg);
+      }
+      break;
+    case 'A':
+      config.autotune = true;
+      break;
+    case 'F':
+      forkserver = true;
+      break;
+    case 'B':
+      s_batch = optarg;
+      break;
+    case 'o':
+      s_outdir = optarg;
       break;
     default:
     case 'h':
@@ -90,50 +176,100 @@ int main(int argc, char **argv) {
     }
   }
 
-  // Allocate work area for processing events
-  gbl_status.data_size = MMAP_PAGES*getpagesize();
-  gbl_status.data = (unsigned char*) malloc(gbl_status.data_size);
-  assert(gbl_status.data > 0);
+  if (forkserver && s_batch.length() > 0) {
+    LOG_FATAL("Fork server and batch modes are mutually exclusive");
+  }
+
+  if (config.autotune && !forkserver && s_batch.length() == 0) {
+    LOG_WARN("Option -A only applies to fork server and batch modes");
+  }
 
-  memset(gbl_status.data, 0, gbl_status.data_size);
+  // Records are decoded (and filtered) by bts_decode, after the run
+  if (s_capture.length() > 0) {
+    if (forkserver || s_batch.length() > 0) {
+      LOG_FATAL("Capture mode is not supported in fork server and batch "
+                "modes");
+    }
+    if (options.outfile.length() > 0 || options.module_relative ||
+        filter.enabled() || s_shm.length() > 0) {
+      LOG_FATAL("Options -f, -r, -i, -x and -m do not apply to capture "
+                "mode: pass them to bts_decode");
+    }
+  }
 
-  // Prepare the child process
-  pid_child = child_start(argv+optind);
-  LOG_DEBUG("Started child with pid %d", pid_child);
-  gbl_status.pid_child = pid_child;
+  options.filter = filter.enabled() ? &filter : NULL;
 
-  // Setup signals
-  memset(&sa, 0, sizeof(struct sigaction));
-  sa.sa_sigaction = sig_handler;
-  sa.sa_flags = SA_SIGINFO;
-  if (sigaction(SIGIO, &sa, NULL) < 0) {
-    LOG_FATAL("Error setting up signal handler");
+  // Attach to the shared coverage bitmap
+  if (s_shm.length() > 0) {
+    if (!bitmap.Attach(s_shm, bitmap_size)) {
+      LOG_FATAL("Error attaching coverage bitmap '%s'", s_shm.c_str());
+    }
+    options.bitmap = &bitmap;
   }
 
-  // Initialize perf structure
-  perf_init(&pe, MMAP_PAGES);
+  if (s_input.length() > 0) {
+    fd_input = open(s_input.c_str(), O_RDONLY);
+    if (fd_input == -1) {
+      LOG_FATAL("Error opening input file '%s'", s_input.c_str());
+    }
+  }
 
-  gbl_status.fd_evt = perf_event_open(&pe, pid_child, -1, -1, 0);
-  if (gbl_status.fd_evt == -1) {
-    perror("perf_event_open");
-    exit(EXIT_FAILURE);
+  // The control pipes of the fork server must not leak to the target
+  if (forkserver) {
+    if (fcntl(FORKSRV_FD, F_SETFD, FD_CLOEXEC) == -1 ||
+        fcntl(FORKSRV_FD + 1, F_SETFD, FD_CLOEXEC) == -1) {
+      LOG_FATAL("Fork server pipes %d and %d are not open", FORKSRV_FD,
+                FORKSRV_FD + 1);
+    }
   }
 
-  // Allocate mmap'ed area
-  gbl_status.mmap = mmap(NULL, (MMAP_PAGES+1)*getpagesize(),
-      PROT_READ | PROT_WRITE, MAP_SHARED, gbl_status.fd_evt, 0);
-  assert(gbl_status.mmap != reinterpret_cast<void*>(-1));
+  // Processes forked by the fork server must inherit the event too, and the
+  // kernel only allows to map the rings of inherited events when they are
+  // bound to a CPU
+  if (forkserver) {
+    config.percpu = true;
+  }
+  fuzztrace::Tracer tracer(config);
+  if (!tracer.valid()) {
+    return 1;
+  }
 
-  fcntl(gbl_status.fd_evt, F_SETFL, O_RDWR|O_NONBLOCK|O_ASYNC);
-  fcntl(gbl_status.fd_evt, F_SETSIG, SIGIO);
-  fcntl(gbl_status.fd_evt, F_SETOWN, getpid());
+  if (s_capture.length() > 0) {
+    if (!capture.Open(s_capture, tracer.status().mmap_pages,
+                      tracer.attr().wakeup_watermark)) {
+      LOG_FATAL("Error creating capture file '%s'", s_capture.c_str());
+    }
+    options.capture = &capture;
+  }
+
+  if (s_batch.length() > 0) {
+    std::vector<std::string> inputs;
+    if (!batch_collect_inputs(s_batch, &inputs)) {
+      LOG_FATAL("Error reading input files from '%s'", s_batch.c_str());
+    }
 
-  // Monitor child until it terminates
-  monitor_loop(pid_child, s_outfile);
+    // Trace every input, then terminate
+    if (!batch_loop(&tracer, argv+optind, inputs, s_outdir, &options)) {
+      LOG_FATAL("Cannot save the traces of '%s'", s_batch.c_str());
+    }
+    return 0;
+  }
 
-  ioctl(gbl_status.fd_evt, PERF_EVENT_IOC_DISABLE, 0);
-  close(gbl_status.fd_evt);
-  munmap(gbl_status.mmap, (MMAP_PAGES+1)*getpagesize());
+  if (forkserver) {
+    // Serve test cases until the driver asks to stop
+    if (!tracer.Serve(argv+optind, fd_input, options)) {
+      LOG_FATAL("Error running the fork server");
+    }
+  } else {
+    // Monitor child until it terminates
+    if (!tracer.Run(argv+optind, fd_input, options)) {
+      LOG_FATAL("Error tracing the target");
+    }
+  }
+
+  if (options.capture != NULL && !capture.Close()) {
+    LOG_FATAL("Error writing capture file '%s'", s_capture.c_str());
+  }
 
   return 0;
 }
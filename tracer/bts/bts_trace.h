@@ -9,22 +9,77 @@
 
 #include <linux/perf_event.h>
 #include <inttypes.h>
-#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
 
-#define MMAP_PAGES 512
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
-// Global status of perf_event monitor
-struct perf_global_status {
-  void *mmap;                   // Pointer to mmap'ed area
-  unsigned char *data;          // Backup copy of BTS data for processing
-  int data_size;                // Size of mmap'ed data area (without hdr)
+#include <map>
+
+#include "common/bbmap.h"
+#include "common/serialize.h"
+#include "./aggregate.h"
+
+// Data pages of each ring: a power of two
+#define DEFAULT_MMAP_PAGES 512
+#define MAX_MMAP_PAGES 16384
+
+// Rings attached to a run with per-task events, one for each task: tasks
+// beyond this limit are not traced
+#define MAX_TASK_RINGS 64
+#define DEFAULT_BITMAP_SIZE (1 << 16)
+
+// A perf event with its ring buffer, and the state of the thread that drains
+// it. Each ring is decoded into its own edge tables, one per task; lock
+// protects the ring and the decoder state
+struct perf_ring {
+  uint32_t id;                  // Index in the session
   int fd_evt;
+  void *mmap;                   // Pointer to mmap'ed area
+  size_t mmap_size;
+  unsigned char *data;          // Bounce buffer for wrapped records
   uint64_t prev_head;
   int n_events;
-  int pid_child;
-  volatile sig_atomic_t data_ready;
+  int n_wakeups;                // Ring wakeups served by the drain thread
+  uint64_t n_lost;              // Records lost by the kernel
+  uint64_t n_drains;            // Non-empty drains
+  uint64_t drained_bytes;
+  uint64_t max_drain;
+  uint64_t n_records;           // Records decoded
+  uint64_t drain_ns;            // Time spent decoding (or capturing) records
+  std::map<task_id, BBMap> tasks;  // Edges decoded from this ring, by task
+  task_id last_task;
+  BBMap *last_map;              // Edge table of last_task (NULL: none)
+  EdgeAggregator aggregator;    // Samples of this ring not added yet
+  std::mutex lock;
+  std::thread drain_thread;
+
+  ~perf_ring() { free(data); }
 };
 
-extern struct perf_global_status gbl_status;
+// Perf events of a tracing session, and counters of its last run. Each
+// session has its own, so that several tracers can live in the same process
+struct perf_status {
+  // Rings of the perf events currently attached: a single one, or one per
+  // CPU. Ring objects (and their buffers) are reused across attachments
+  std::vector<std::unique_ptr<struct perf_ring> > rings;
+  size_t n_rings = 0;
+  struct perf_event_attr attr;  // Attributes of the attached events
+  bool percpu = false;
+  int mmap_pages = 0;           // Data pages of the rings to be attached
+  int data_size = 0;            // Size of mmap'ed data area (without hdr)
+  int watermark = 0;            // Wakeup watermark (0: 1/128 of the ring)
+  bool autotune = false;        // Grow the rings between runs, on overflow
+  int n_events = 0;
+  int pid_child = 0;
+  int n_wakeups = 0;
+  uint64_t n_lost = 0;
+  double run_time = 0;          // Of the last run, in seconds
+  uint64_t coverage_hash_buckets = 0;  // Of the last finished run
+  TraceHang hang = TraceHangNone;  // Of the last run
+};
 
 #endif  // _BTS_TRACE_H_
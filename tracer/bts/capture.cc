@@ -0,0 +1,423 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+
+#include "./capture.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+
+#include <algorithm>
+#include <map>
+#include <set>
+
+#include "common/logging.h"
+#include "common/parallel.h"
+#include "./perf.h"
+
+CaptureWriter::CaptureWriter() : fd_(-1), size_(0) {
+}
+
+CaptureWriter::~CaptureWriter() {
+  Close();
+}
+
+bool CaptureWriter::Open(const std::string &filename, uint32_t ring_pages,
+                         uint32_t watermark) {
+  fd_ = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+             0644);
+  if (fd_ == -1) {
+    return false;
+  }
+
+  struct capture_header header;
+  header.magic = CAPTURE_MAGIC;
+  header.version = CAPTURE_VERSION;
+  header.ring_pages = ring_pages;
+  header.watermark = watermark;
+  struct iovec iov = { &header, sizeof(header) };
+  size_ = 0;
+  return Write(&iov, 1);
+}
+
+bool CaptureWriter::Close() {
+  if (fd_ == -1) {
+    return true;
+  }
+  int ret = close(fd_);
+  fd_ = -1;
+  return ret == 0;
+}
+
+// Write all the buffers, resuming short writes. The lock must be held
+bool CaptureWriter::Write(struct iovec *iov, int iovcnt) {
+  while (iovcnt > 0) {
+    ssize_t n = writev(fd_, iov, iovcnt);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    size_ += n;
+
+    while (iovcnt > 0 && static_cast<size_t>(n) >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = static_cast<char *>(iov->iov_base) + n;
+      iov->iov_len -= n;
+    }
+  }
+  return true;
+}
+
+bool CaptureWriter::AddRecords(uint32_t ring_id, const unsigned char *ring,
+                               uint64_t ring_size, uint64_t tail,
+                               uint64_t head) {
+  if (head == tail) {
+    return true;
+  }
+
+  struct capture_chunk chunk;
+  chunk.type = CaptureChunkRecords;
+  chunk.ring = ring_id;
+  chunk.size = head - tail;
+
+  // Records wrapping around the end of the ring are stored in two pieces
+  uint64_t offset = tail & (ring_size - 1);
+  uint64_t first = std::min(chunk.size, ring_size - offset);
+  struct iovec iov[3] = {
+    { &chunk, sizeof(chunk) },
+    { const_cast<unsigned char *>(ring + offset), first },
+    { const_cast<unsigned char *>(ring), chunk.size - first },
+  };
+
+  std::lock_guard<std::mutex> lock(lock_);
+  return Write(iov, first < chunk.size ? 3 : 2);
+}
+
+bool CaptureWriter::AddException(const Exception &exc) {
+  std::vector<uint64_t> frames(exc.stacktrace_begin(), exc.stacktrace_end());
+
+  struct capture_exception record;
+  record.tid = exc.tid();
+  record.type = exc.type();
+  record.faulty_type = exc.faulty_type();
+  record.n_frames = frames.size();
+  record.pc = exc.pc();
+  record.faulty_addr = exc.faulty_addr();
+
+  struct capture_chunk chunk;
+  chunk.type = CaptureChunkException;
+  chunk.ring = 0;
+  chunk.size = sizeof(record) + frames.size() * sizeof(uint64_t);
+
+  struct iovec iov[3] = {
+    { &chunk, sizeof(chunk) },
+    { &record, sizeof(record) },
+    { frames.data(), frames.size() * sizeof(uint64_t) },
+  };
+
+  std::lock_guard<std::mutex> lock(lock_);
+  return Write(iov, 3);
+}
+
+CaptureReader::CaptureReader() : data_(NULL), size_(0) {
+}
+
+CaptureReader::~CaptureReader() {
+  if (data_ != NULL) {
+    munmap(const_cast<unsigned char *>(data_), size_);
+  }
+}
+
+bool CaptureReader::Open(const std::string &filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 ||
+      st.st_size < static_cast<off_t>(sizeof(struct capture_header))) {
+    close(fd);
+    return false;
+  }
+
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  data_ = static_cast<const unsigned char *>(data);
+  size_ = st.st_size;
+
+  const struct capture_header *header =
+    reinterpret_cast<const struct capture_header *>(data_);
+  if (header->magic != CAPTURE_MAGIC || header->version != CAPTURE_VERSION) {
+    return false;
+  }
+
+  // Records are decoded sequentially anyway, so index the chunks in order
+  uint64_t offset = sizeof(*header);
+  while (offset < size_) {
+    const struct capture_chunk *chunk =
+      reinterpret_cast<const struct capture_chunk *>(data_ + offset);
+    if (size_ - offset < sizeof(*chunk) ||
+        size_ - offset - sizeof(*chunk) < chunk->size) {
+      LOG_WARN("Dropping truncated chunk at offset 0x%" PRIx64, offset);
+      break;
+    }
+    offset += sizeof(*chunk);
+
+    switch (chunk->type) {
+    case CaptureChunkRecords: {
+      capture_run run = { offset, chunk->size };
+      chunks_.push_back(run);
+      break;
+    }
+
+    case CaptureChunkException: {
+      const struct capture_exception *record =
+        reinterpret_cast<const struct capture_exception *>(data_ + offset);
+      if (chunk->size < sizeof(*record) ||
+          (chunk->size - sizeof(*record)) / sizeof(uint64_t) <
+          record->n_frames) {
+        return false;
+      }
+
+      std::shared_ptr<Exception>
+        exc(new Exception(record->tid,
+                          static_cast<ExceptionType>(record->type),
+                          record->pc, record->faulty_addr,
+                          record->faulty_type));
+      const uint64_t *frames = reinterpret_cast<const uint64_t *>(record + 1);
+      for (uint32_t i = 0; i < record->n_frames; i++) {
+        exc->stacktrace_push(frames[i]);
+      }
+      exceptions_.push_back(exc);
+      break;
+    }
+
+    default:
+      LOG_WARN("Skipping unknown chunk type %u", chunk->type);
+      break;
+    }
+
+    offset += chunk->size;
+  }
+  return true;
+}
+
+void CaptureReader::Split(uint64_t max_size,
+                          std::vector<capture_run> *runs) const {
+  runs->clear();
+  for (size_t i = 0; i < chunks_.size(); i++) {
+    capture_run run = chunks_[i];
+
+    // Chunks are as large as the data drained from a ring at once: only a
+    // ring drained late can exceed max_size
+    while (run.size > max_size) {
+      uint64_t size = 0;
+      while (size < run.size) {
+        const struct perf_event_header *header =
+          reinterpret_cast<const struct perf_event_header *>(
+            data_ + run.offset + size);
+        if (header->size < sizeof(*header) ||
+            (size > 0 && size + header->size > max_size)) {
+          break;
+        }
+        size += header->size;
+      }
+      if (size == 0 || size >= run.size) {
+        break;
+      }
+
+      capture_run head = { run.offset, size };
+      runs->push_back(head);
+      run.offset += size;
+      run.size -= size;
+    }
+    runs->push_back(run);
+  }
+}
+
+// Decoding state of a worker thread
+struct capture_worker {
+  std::map<task_id, BBMap> tasks;
+  task_id last_task;
+  BBMap *last_map = NULL;
+  uint64_t n_samples = 0;
+  uint64_t n_events = 0;
+};
+
+// Memory regions and side-band counters of a segment
+struct capture_segment {
+  size_t first_run, last_run;
+  std::vector<MemoryRegion> regions;
+  uint64_t n_records = 0;
+  uint64_t n_lost = 0;
+  bool malformed = false;
+};
+
+static void capture_scan_segment(const CaptureReader &capture,
+                                 const std::vector<capture_run> &runs,
+                                 capture_segment *segment) {
+  for (size_t i = segment->first_run; i < segment->last_run; i++) {
+    bool ok = capture.ForEachRecord(runs[i],
+      [&](const struct perf_event_header *header) {
+        segment->n_records++;
+        if (header->type == PERF_RECORD_MMAP) {
+          const struct perf_event_mmap *mmap_event =
+            reinterpret_cast<const struct perf_event_mmap *>(header);
+          MemoryRegion region;
+          region.base = mmap_event->addr;
+          region.size = mmap_event->len;
+          region.filename = mmap_event->filename;
+          segment->regions.push_back(region);
+        } else if (header->type == PERF_RECORD_LOST) {
+          segment->n_lost +=
+            reinterpret_cast<const struct perf_record_lost *>(header)->lost;
+        }
+      });
+    segment->malformed |= !ok;
+  }
+}
+
+static void capture_decode_segment(const CaptureReader &capture,
+                                   const std::vector<capture_run> &runs,
+                                   const AddressFilter *filter,
+                                   const capture_segment &segment,
+                                   capture_worker *worker) {
+  for (size_t i = segment.first_run; i < segment.last_run; i++) {
+    capture.ForEachRecord(runs[i],
+      [&](const struct perf_event_header *header) {
+        if (header->type != PERF_RECORD_SAMPLE ||
+            header->size != sizeof(struct perf_event_bts_sample)) {
+          return;
+        }
+        const struct perf_event_bts *bts =
+          &reinterpret_cast<const struct perf_event_bts_sample *>(header)->bts;
+        worker->n_samples++;
+
+        // Same rules as monitor_add_sample()
+        if (perf_is_kernel_addr(bts->from) || perf_is_kernel_addr(bts->to)) {
+          return;
+        }
+        if (filter != NULL &&
+            (!filter->IsInteresting(bts->from) ||
+             !filter->IsInteresting(bts->to))) {
+          return;
+        }
+
+        task_id task(bts->pid, bts->tid);
+        if (worker->last_map == NULL || worker->last_task != task) {
+          worker->last_task = task;
+          worker->last_map = &worker->tasks[task];
+        }
+        worker->last_map->AddEdge(bts->from, bts->to);
+        worker->n_events++;
+      });
+  }
+}
+
+void capture_decode(const CaptureReader &capture,
+                    const struct capture_decode_options &options,
+                    ExecutionTrace *execution_trace,
+                    struct capture_decode_stats *stats) {
+  std::vector<capture_run> runs;
+  capture.Split(options.segment_size, &runs);
+
+  // Group consecutive runs into segments of about segment_size bytes
+  std::vector<capture_segment> segments;
+  for (size_t i = 0; i < runs.size(); ) {
+    capture_segment segment;
+    segment.first_run = i;
+    uint64_t size = 0;
+    while (i < runs.size() && (size == 0 ||
+                               size + runs[i].size <= options.segment_size)) {
+      size += runs[i++].size;
+    }
+    segment.last_run = i;
+    segments.push_back(segment);
+  }
+
+  // First pass: memory regions, in file order, so that the filter knows all
+  // the images before any sample is decoded
+  parallel_for(segments.size(), options.n_threads, [&](size_t i) {
+      capture_scan_segment(capture, runs, &segments[i]);
+    });
+
+  memset(stats, 0, sizeof(*stats));
+  stats->n_segments = segments.size();
+  for (size_t i = 0; i < segments.size(); i++) {
+    if (segments[i].malformed) {
+      LOG_WARN("Skipping malformed perf records in segment %zu", i);
+    }
+    stats->n_records += segments[i].n_records;
+    stats->n_lost += segments[i].n_lost;
+    for (auto it = segments[i].regions.begin();
+         it != segments[i].regions.end(); it++) {
+      if (options.filter != NULL) {
+        options.filter->AddImage(it->base, it->size, it->filename);
+      }
+      execution_trace->memory_regions.push_back(*it);
+    }
+  }
+
+  // Second pass: samples, into per-thread edge tables
+  std::vector<capture_worker> workers(std::max(1U, options.n_threads));
+  parallel_for_workers(segments.size(), options.n_threads,
+                       [&](unsigned int worker, size_t i) {
+      capture_decode_segment(capture, runs, options.filter, segments[i],
+                             &workers[worker]);
+    });
+
+  // Tasks can be split among several threads, just like among several rings
+  // (see monitor_merge())
+  std::set<task_id> tasks;
+  for (size_t i = 0; i < workers.size(); i++) {
+    for (auto it = workers[i].tasks.begin(); it != workers[i].tasks.end();
+         it++) {
+      tasks.insert(it->first);
+    }
+  }
+  stats->n_tasks = tasks.size();
+
+  for (size_t i = 0; i < workers.size(); i++) {
+    for (auto it = workers[i].tasks.begin(); it != workers[i].tasks.end();
+         it++) {
+      execution_trace->basic_blocks.Merge(it->second);
+      if (tasks.size() > 1) {
+        execution_trace->tasks[it->first].Merge(it->second);
+      }
+    }
+    stats->n_samples += workers[i].n_samples;
+    stats->n_events += workers[i].n_events;
+  }
+
+  execution_trace->exceptions.insert(execution_trace->exceptions.end(),
+                                     capture.exceptions().begin(),
+                                     capture.exceptions().end());
+
+  // Each chunk of records is a drain of a ring (runs are split from chunks,
+  // and do not match drains)
+  const std::vector<capture_run> &chunks = capture.chunks();
+  RingStats &ring_stats = execution_trace->ring_stats;
+  ring_stats.pages = capture.header().ring_pages;
+  ring_stats.watermark = capture.header().watermark;
+  ring_stats.lost = stats->n_lost;
+  for (size_t i = 0; i < chunks.size(); i++) {
+    ring_stats.drains++;
+    ring_stats.drained_bytes += chunks[i].size;
+    ring_stats.max_drain = std::max(ring_stats.max_drain, chunks[i].size);
+  }
+}
@@ -0,0 +1,172 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Raw capture files: the perf records of a run, appended to a file as they
+// are drained from the rings, to be decoded offline by bts_decode.
+//
+// A capture file is a capture_header followed by chunks, each made of a
+// capture_chunk header and size bytes of payload (a multiple of 8):
+// - CaptureChunkRecords: whole perf records, drained from a ring at once;
+// - CaptureChunkException: a capture_exception, followed by its stack trace.
+// Chunks of different rings are interleaved in drain order, while records of
+// the same ring keep their order.
+//
+
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <linux/perf_event.h>
+#include <sys/uio.h>
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "common/exception.h"
+#include "common/filter.h"
+#include "common/serialize.h"
+
+#define CAPTURE_MAGIC 0x52544242      // "BBTR"
+#define CAPTURE_VERSION 2
+
+struct capture_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t ring_pages;          // Data pages of each ring (0: unknown)
+  uint32_t watermark;           // Wakeup watermark of the rings, in bytes
+};
+
+enum CaptureChunkType {
+  CaptureChunkRecords = 1,
+  CaptureChunkException = 2,
+};
+
+struct capture_chunk {
+  uint32_t type;
+  uint32_t ring;                // Index of the source ring (records only)
+  uint64_t size;
+};
+
+struct capture_exception {
+  int32_t tid;
+  uint32_t type;                // ExceptionType
+  uint32_t faulty_type;         // ExceptionFaultyType
+  uint32_t n_frames;            // Return addresses that follow
+  uint64_t pc;
+  uint64_t faulty_addr;
+};
+
+// Append chunks to a capture file. Each chunk is written by a single system
+// call, under a lock, so that all the drain threads can share a writer
+class CaptureWriter {
+ public:
+  explicit CaptureWriter();
+  ~CaptureWriter();
+
+  // Create a capture file, recording the size and wakeup watermark of the
+  // rings it is drained from
+  bool Open(const std::string &filename, uint32_t ring_pages = 0,
+            uint32_t watermark = 0);
+  bool Close();
+
+  // Append the records stored in the data area of a ring of ring_size bytes
+  // between free-running offsets tail and head, as found in the control page
+  bool AddRecords(uint32_t ring_id, const unsigned char *ring,
+                  uint64_t ring_size, uint64_t tail, uint64_t head);
+  bool AddException(const Exception &exc);
+
+  // Bytes written so far
+  uint64_t size() const { return size_; }
+
+ private:
+  bool Write(struct iovec *iov, int iovcnt);
+
+  int fd_;
+  uint64_t size_;
+  std::mutex lock_;
+};
+
+// A run of whole records, within the payload of a single chunk
+struct capture_run {
+  uint64_t offset;              // From the beginning of the file
+  uint64_t size;
+};
+
+// A capture file, mapped in memory
+class CaptureReader {
+ public:
+  explicit CaptureReader();
+  ~CaptureReader();
+
+  // Map a capture file and index its chunks. A truncated last chunk (e.g.,
+  // the tracer was killed) is dropped with a warning
+  bool Open(const std::string &filename);
+
+  const struct capture_header &header() const {
+    return *reinterpret_cast<const struct capture_header *>(data_);
+  }
+
+  // Record chunks, in file order
+  const std::vector<capture_run> &chunks() const { return chunks_; }
+  const std::vector<std::shared_ptr<Exception> > &exceptions() const {
+    return exceptions_;
+  }
+  uint64_t size() const { return size_; }
+
+  // Split the record chunks into runs of at most max_size bytes (unless a
+  // single record is larger), in file order
+  void Split(uint64_t max_size, std::vector<capture_run> *runs) const;
+
+  // Invoke f(header) on each record of a run. Return false if a malformed
+  // record stops the walk
+  template <typename F> bool ForEachRecord(const capture_run &run,
+                                           F f) const {
+    const unsigned char *p = data_ + run.offset;
+    const unsigned char *end = p + run.size;
+    while (p < end) {
+      const struct perf_event_header *header =
+        reinterpret_cast<const struct perf_event_header *>(p);
+      if (header->size < sizeof(*header) || p + header->size > end) {
+        return false;
+      }
+      f(header);
+      p += header->size;
+    }
+    return true;
+  }
+
+ private:
+  const unsigned char *data_;
+  uint64_t size_;
+  std::vector<capture_run> chunks_;
+  std::vector<std::shared_ptr<Exception> > exceptions_;
+};
+
+struct capture_decode_options {
+  AddressFilter *filter;        // Edges to decode (NULL: all user-space ones)
+  unsigned int n_threads;
+  uint64_t segment_size;        // Bytes of records decoded per work item
+};
+
+struct capture_decode_stats {
+  uint64_t n_records;
+  uint64_t n_samples;
+  uint64_t n_events;            // Samples kept by the filter
+  uint64_t n_lost;              // Samples dropped by the kernel
+  size_t n_segments;
+  size_t n_tasks;
+};
+
+// Rebuild the execution trace of a capture: CFG edges (also by task), memory
+// regions and exceptions. Record runs are grouped into segments, decoded in
+// parallel into per-thread edge tables, which are merged at the end. All the
+// memory regions are collected beforehand, so the filter knows every image
+// the capture maps, whatever the order samples and mmap records were drained
+void capture_decode(const CaptureReader &capture,
+                    const struct capture_decode_options &options,
+                    ExecutionTrace *execution_trace,
+                    struct capture_decode_stats *stats);
+
+#endif  // _CAPTURE_H_
@@ -0,0 +1,425 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// The target is stopped at its entry point, after the dynamic loader has
+// completed its job. From then on, every test case is executed by a fresh
+// process, forked by injecting a fork() system call into the stopped target.
+// Per-CPU perf events are inherited by forked processes, and the inherited
+// events write their records to the ring buffers of the original ones: rings
+// and bounce buffers are thus allocated only once.
+//
+
+#include "./forkserver.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "common/logging.h"
+#include "./bts_trace.h"
+#include "./perf.h"
+
+static const long INSN_SYSCALL = 0x050f;  // syscall
+static const long INSN_INT3 = 0xcc;       // int3
+
+// A request on the fork server, or on a process it has forked, has failed:
+// report it, and give up serving
+static bool forksrv_error(const char *what, pid_t pid) {
+  LOG_WARN("Fork server: %s failed for process %d: %s", what, pid,
+           strerror(errno));
+  return false;
+}
+
+// Wait for the next state change of a task
+static bool forksrv_wait(pid_t pid, int *status) {
+  pid_t ret;
+
+  do {
+    ret = waitpid(pid, status, __WALL);
+  } while (ret == -1 && errno == EINTR);
+
+  if (ret != pid) {
+    return forksrv_error("waitpid()", pid);
+  }
+  return true;
+}
+
+// Wait for a task to stop
+static bool forksrv_wait_stop(pid_t pid, int *status) {
+  if (!forksrv_wait(pid, status)) {
+    return false;
+  }
+  if (!WIFSTOPPED(*status)) {
+    LOG_WARN("Fork server: process %d terminated unexpectedly", pid);
+    return false;
+  }
+  return true;
+}
+
+static void forksrv_read(int fd, uint32_t *value) {
+  ssize_t n;
+  do {
+    n = read(fd, value, sizeof(*value));
+  } while (n == -1 && errno == EINTR);
+
+  if (n != sizeof(*value)) {
+    // The driver has gone away
+    *value = FORKSRV_CMD_STOP;
+  }
+}
+
+static bool forksrv_write(int fd, uint32_t value) {
+  ssize_t n;
+  do {
+    n = write(fd, &value, sizeof(value));
+  } while (n == -1 && errno == EINTR);
+
+  if (n != sizeof(value)) {
+    LOG_WARN("Error writing to the fork server status pipe");
+    return false;
+  }
+  return true;
+}
+
+// Read the entry point of the program executed by pid from its auxiliary
+// vector. Return 0 if it cannot be found
+static target_addr forksrv_entry_point(pid_t pid) {
+  char filename[64];
+  snprintf(filename, sizeof(filename), "/proc/%d/auxv", pid);
+
+  FILE *f = fopen(filename, "rb");
+  if (f == NULL) {
+    LOG_WARN("Cannot open %s", filename);
+    return 0;
+  }
+
+  target_addr entry = 0;
+  Elf64_auxv_t auxv;
+  while (fread(&auxv, sizeof(auxv), 1, f) == 1 && auxv.a_type != AT_NULL) {
+    if (auxv.a_type == AT_ENTRY) {
+      entry = auxv.a_un.a_val;
+      break;
+    }
+  }
+  fclose(f);
+
+  if (entry == 0) {
+    LOG_WARN("Cannot find the entry point of process %d", pid);
+  }
+  return entry;
+}
+
+// Execute a system call in the context of the stopped server, by temporarily
+// patching a syscall instruction at the current program counter, and store
+// its return value in result. When the system call creates a new process, it
+// is returned through pid_new, stopped and with the original code and
+// registers restored. Return false on errors
+static bool forksrv_syscall(pid_t pid, long nr, long arg0, long arg1,
+                            long arg2, long arg3, long *result,
+                            pid_t *pid_new) {
+  struct user_regs_struct regs_saved, regs;
+  int status;
+  long word;
+
+  if (ptrace(PTRACE_GETREGS, pid, NULL, &regs_saved) == -1) {
+    return forksrv_error("PTRACE_GETREGS", pid);
+  }
+
+  errno = 0;
+  word = ptrace(PTRACE_PEEKTEXT, pid, regs_saved.rip, 0);
+  if (errno != 0) {
+    return forksrv_error("PTRACE_PEEKTEXT", pid);
+  }
+
+  if (ptrace(PTRACE_POKETEXT, pid, regs_saved.rip,
+             (word & ~0xffffL) | INSN_SYSCALL) == -1) {
+    return forksrv_error("PTRACE_POKETEXT", pid);
+  }
+
+  regs = regs_saved;
+  regs.rax = nr;
+  regs.rdi = arg0;
+  regs.rsi = arg1;
+  regs.rdx = arg2;
+  regs.r10 = arg3;
+  if (ptrace(PTRACE_SETREGS, pid, NULL, &regs) == -1) {
+    return forksrv_error("PTRACE_SETREGS", pid);
+  }
+
+  pid_t child = -1;
+  while (1) {
+    if (ptrace(PTRACE_SINGLESTEP, pid, 0, 0) == -1) {
+      return forksrv_error("PTRACE_SINGLESTEP", pid);
+    }
+    if (!forksrv_wait_stop(pid, &status)) {
+      return false;
+    }
+
+    if (status >> 16 == PTRACE_EVENT_FORK) {
+      unsigned long msg;
+      if (ptrace(PTRACE_GETEVENTMSG, pid, NULL, &msg) == -1) {
+        return forksrv_error("PTRACE_GETEVENTMSG", pid);
+      }
+      child = msg;
+      continue;
+    }
+
+    if (WSTOPSIG(status) != SIGTRAP) {
+      // Signals for the server (e.g., SIGCHLD) are discarded
+      LOG_DEBUG("Discarding signal #%d for the fork server",
+                WSTOPSIG(status));
+      continue;
+    }
+
+    if (ptrace(PTRACE_GETREGS, pid, NULL, &regs) == -1) {
+      return forksrv_error("PTRACE_GETREGS", pid);
+    }
+    if (regs.rip == regs_saved.rip + 2) {
+      break;
+    }
+  }
+
+  // Restore the server
+  if (ptrace(PTRACE_POKETEXT, pid, regs_saved.rip, word) == -1) {
+    return forksrv_error("PTRACE_POKETEXT", pid);
+  }
+  if (ptrace(PTRACE_SETREGS, pid, NULL, &regs_saved) == -1) {
+    return forksrv_error("PTRACE_SETREGS", pid);
+  }
+
+  if (child != -1) {
+    // The new process inherited the patched code, restore it as well. The
+    // new process starts with a SIGSTOP. It is killed along with the server
+    // (PTRACE_O_EXITKILL) if anything goes wrong
+    if (!forksrv_wait_stop(child, &status)) {
+      return false;
+    }
+
+    if (ptrace(PTRACE_POKETEXT, child, regs_saved.rip, word) == -1) {
+      return forksrv_error("PTRACE_POKETEXT", child);
+    }
+    if (ptrace(PTRACE_SETREGS, child, NULL, &regs_saved) == -1) {
+      return forksrv_error("PTRACE_SETREGS", child);
+    }
+
+    // Follow the processes created by the test case, but not its exec
+    if (ptrace(PTRACE_SETOPTIONS, child, 0, MONITOR_PTRACE_OPTIONS) == -1) {
+      return forksrv_error("PTRACE_SETOPTIONS", child);
+    }
+  }
+
+  if (pid_new != NULL) {
+    *pid_new = child;
+  }
+  if (result != NULL) {
+    *result = regs.rax;
+  }
+  return true;
+}
+
+// Run the server until it reaches the entry point of the target program
+static bool forksrv_start(pid_t pid) {
+  int status;
+
+  // Stopped before exec
+  if (!forksrv_wait_stop(pid, &status)) {
+    return false;
+  }
+  if (ptrace(PTRACE_SETOPTIONS, pid, 0,
+             PTRACE_O_TRACEEXEC | PTRACE_O_TRACEFORK |
+             PTRACE_O_EXITKILL) == -1) {
+    return forksrv_error("PTRACE_SETOPTIONS", pid);
+  }
+
+  if (ptrace(PTRACE_CONT, pid, 0, 0) == -1) {
+    return forksrv_error("PTRACE_CONT", pid);
+  }
+
+  // Stopped after exec
+  if (!forksrv_wait(pid, &status)) {
+    return false;
+  }
+  if (!WIFSTOPPED(status) ||
+      status >> 8 != (SIGTRAP | PTRACE_EVENT_EXEC << 8)) {
+    LOG_WARN("Unable to execute the target program");
+    return false;
+  }
+
+  // Plant a breakpoint on the entry point
+  target_addr entry = forksrv_entry_point(pid);
+  if (entry == 0) {
+    return false;
+  }
+  errno = 0;
+  long word = ptrace(PTRACE_PEEKTEXT, pid, entry, 0);
+  if (errno != 0) {
+    return forksrv_error("PTRACE_PEEKTEXT", pid);
+  }
+  if (ptrace(PTRACE_POKETEXT, pid, entry,
+             (word & ~0xffL) | INSN_INT3) == -1) {
+    return forksrv_error("PTRACE_POKETEXT", pid);
+  }
+
+  LOG_DEBUG("Running fork server until entry point 0x%016" PRIx64, entry);
+
+  struct user_regs_struct regs;
+  int signum = 0;
+  while (1) {
+    if (ptrace(PTRACE_CONT, pid, 0, signum) == -1) {
+      return forksrv_error("PTRACE_CONT", pid);
+    }
+    if (!forksrv_wait(pid, &status)) {
+      return false;
+    }
+    signum = 0;
+
+    if (!WIFSTOPPED(status)) {
+      LOG_WARN("Target terminated before reaching its entry point");
+      return false;
+    }
+
+    if (WSTOPSIG(status) != SIGTRAP) {
+      // Deliver any other signal to the target
+      signum = WSTOPSIG(status);
+      continue;
+    }
+
+    if (ptrace(PTRACE_GETREGS, pid, NULL, &regs) == -1) {
+      return forksrv_error("PTRACE_GETREGS", pid);
+    }
+    if (regs.rip == entry + 1) {
+      break;
+    }
+  }
+
+  // Remove the breakpoint and rewind the program counter
+  if (ptrace(PTRACE_POKETEXT, pid, entry, word) == -1) {
+    return forksrv_error("PTRACE_POKETEXT", pid);
+  }
+  regs.rip = entry;
+  if (ptrace(PTRACE_SETREGS, pid, NULL, &regs) == -1) {
+    return forksrv_error("PTRACE_SETREGS", pid);
+  }
+  return true;
+}
+
+// Auto-tuning: replace the rings with larger ones, if needed. New events are
+// opened on the stopped server, already enabled, and inherited by the
+// processes it forks from then on. Return false if the server is left
+// untraced
+static bool forksrv_tune(struct monitor_session *session, pid_t pid_server) {
+  struct perf_event_attr attr = session->perf.attr;
+  if (!perf_tune(&session->perf, &attr)) {
+    return true;
+  }
+
+  monitor_drain_stop(session);
+  perf_detach(&session->perf);
+  attr.disabled = 0;
+  attr.enable_on_exec = 0;
+  if (!perf_attach(&session->perf, &attr, pid_server, true) ||
+      !monitor_drain_start(session)) {
+    LOG_WARN("Cannot trace the fork server with larger rings");
+    return false;
+  }
+  return true;
+}
+
+// Trace a test case: fork it from the server, and report its pid and wait
+// status to the driver
+static bool forksrv_run(struct monitor_session *session, pid_t pid_server,
+                        int fd_st) {
+  pid_t pid_child;
+  if (!forksrv_syscall(pid_server, SYS_fork, 0, 0, 0, 0, NULL, &pid_child)) {
+    return false;
+  }
+  if (pid_child == -1) {
+    LOG_WARN("Fork server failed to create a new process");
+    return false;
+  }
+
+  if (!forksrv_write(fd_st, pid_child)) {
+    return false;
+  }
+
+  if (ptrace(PTRACE_CONT, pid_child, 0, 0) == -1) {
+    int status;
+    forksrv_error("PTRACE_CONT", pid_child);
+    kill(pid_child, SIGKILL);
+    waitpid(pid_child, &status, __WALL);
+    return false;
+  }
+  int status = monitor_kill(session, pid_child,
+                            monitor_run(session, pid_child, true));
+  if (session->failed) {
+    return false;
+  }
+  monitor_finish(session);
+
+  // Reap the zombie process left in the server
+  if (!forksrv_syscall(pid_server, SYS_wait4, -1, 0, WNOHANG, 0, NULL,
+                       NULL)) {
+    return false;
+  }
+
+  if (session->perf.autotune && !forksrv_tune(session, pid_server)) {
+    return false;
+  }
+
+  return forksrv_write(fd_st, status);
+}
+
+bool forkserver_loop(struct monitor_session *session, pid_t pid_server,
+                     const struct monitor_options &options, int fd_input) {
+  const int fd_ctl = FORKSRV_FD, fd_st = FORKSRV_FD + 1;
+  uint32_t cmd;
+  int status;
+  bool ok;
+
+  monitor_init(session, options);
+  ok = forksrv_start(pid_server);
+
+  if (ok) {
+    // Discard the loader's events, but keep the memory regions it has
+    // mapped
+    monitor_process_events(session);
+    monitor_checkpoint(session);
+    monitor_reset(session);
+
+    LOG_DEBUG("Fork server ready (pid %d)", pid_server);
+    ok = forksrv_write(fd_st, 0);
+  }
+
+  while (ok) {
+    forksrv_read(fd_ctl, &cmd);
+    if (cmd != FORKSRV_CMD_RUN) {
+      break;
+    }
+
+    monitor_reset(session);
+    for (size_t i = 0; i < session->perf.n_rings; i++) {
+      ioctl(session->perf.rings[i]->fd_evt, PERF_EVENT_IOC_RESET, 0);
+    }
+
+    if (fd_input != -1) {
+      lseek(fd_input, 0, SEEK_SET);
+    }
+
+    ok = forksrv_run(session, pid_server, fd_st);
+  }
+
+  LOG_DEBUG("Stopping fork server");
+  kill(pid_server, SIGKILL);
+  waitpid(pid_server, &status, __WALL);
+  return ok;
+}
@@ -0,0 +1,42 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Fork server: keep a pre-initialized image of the target, and fork it for
+// every test case.
+//
+// The driver talks to the fork server through two pipes, inherited on file
+// descriptors FORKSRV_FD (control, read by the fork server) and FORKSRV_FD+1
+// (status, written by the fork server). All messages are 32-bit integers:
+//
+// 1. once the target is ready, the fork server writes a "hello" message;
+// 2. for each test case, the driver writes FORKSRV_CMD_RUN; the fork server
+//    replies with the pid of the new process and, when the execution is over
+//    and its trace has been written, with its wait status;
+// 3. the driver writes FORKSRV_CMD_STOP (or closes the control pipe) to
+//    terminate the fork server.
+//
+
+#ifndef _FORKSERVER_H_
+#define _FORKSERVER_H_
+
+#include <unistd.h>
+
+#include "./monitor.h"
+
+#define FORKSRV_FD 198
+
+enum forksrv_command {
+  FORKSRV_CMD_STOP = 0,
+  FORKSRV_CMD_RUN = 1,
+};
+
+// Serve test cases until the driver asks to stop. pid_server must be stopped
+// before exec, as done by tracee_start(), and traced by the per-CPU events of
+// session. If fd_input is not -1, it is the standard input of the target,
+// and it is rewound before every test case. The server is killed before
+// returning. Return false if the server fails, or a test case cannot be
+// traced (the driver sees its status pipe closed)
+bool forkserver_loop(struct monitor_session *session, pid_t pid_server,
+                     const struct monitor_options &options, int fd_input);
+
+#endif  // _FORKSERVER_H_
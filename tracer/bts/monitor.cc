@@ -5,71 +5,198 @@
 #include "./monitor.h"
 
 #include <linux/perf_event.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/eventfd.h>
 #include <sys/ptrace.h>
 #include <sys/types.h>
-#include <sys/user.h>
 #include <sys/wait.h>
-#include <cassert>
 #include <cerrno>
 #include <cstring>
 
+#include <algorithm>
+#include <chrono>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
 
 #include "common/common.h"
+#include "common/crash.h"
+#include "common/regions.h"
 #include "common/serialize.h"
+#include "common/stats.h"
+#include "common/tracee.h"
+#include "common/watchdog.h"
 #include "./bts_trace.h"
 #include "./perf.h"
+#include "./ring.h"
 
-static const int MAX_STACKTRACE_SIZE = 16;
+// What the decoder callbacks of a ring work on
+struct monitor_decoder {
+  struct monitor_session *session;
+  struct perf_ring *ring;
+};
 
-static ExecutionTrace gbl_execution_trace;
-
-static inline bool is_kernel_addr(target_addr addr) {
-  return (addr >> 47) != 0;
-}
+static void monitor_drain(struct monitor_session *session,
+                          struct perf_ring *ring);
 
 // Memory mapping of a new executable section. Extract details of the
-// mmap()'ped region and add to the global structure
-static void monitor_add_mmap(struct perf_event_mmap *mmap_event) {
+// mmap()'ped region and add to the execution trace
+static void monitor_add_mmap(struct monitor_session *session,
+                             struct perf_event_mmap *mmap_event) {
   MemoryRegion region;
   region.base = mmap_event->addr;
   region.size = mmap_event->len;
   region.filename = mmap_event->filename;
-  gbl_execution_trace.memory_regions.push_back(region);
+
+  if (session->options->filter != NULL) {
+    session->options->filter->AddImage(region.base, region.size,
+                                       region.filename);
+  }
+
+  std::lock_guard<std::mutex> lock(session->lock);
+  session->execution_trace.memory_regions.push_back(region);
 
   LOG_DEBUG("mmap()'ing image '%s' at range [0x%lx-0x%lx]",
   region.filename.c_str(), region.base, region.base+region.size-1);
 }
 
-// Add a new branch event
-static void monitor_add_sample(struct perf_event_bts_sample *bts_sample) {
-  const target_addr bb_previous = bts_sample->bts.from;
-  const target_addr bb_current = bts_sample->bts.to;
+// Add the edges collected by the aggregator of a ring, and clear them
+static void monitor_add_edges(struct monitor_session *session,
+                              struct perf_ring *ring) {
+  const struct monitor_options *options = session->options;
+  std::vector<aggregate_entry> &edges = ring->aggregator.spill();
+  size_t n_new = 0;
+
+  // Images may be added to the filter by other rings meanwhile
+  AddressFilter::Reader reader(options->filter);
+
+  for (size_t i = 0; i < edges.size(); i++) {
+    const aggregate_entry &edge = edges[i];
 
 #ifdef DEBUG_MODE
-  fprintf(stderr, "[tid %d] from: 0x%016" PRIx64 ", to: 0x%016" PRIx64 "\n",
-    bts_sample->bts.tid, bb_previous, bb_current);
+    fprintf(stderr, "[task 0x%016" PRIx64 "] from: 0x%016" PRIx64 ", to: 0x%016"
+            PRIx64 " (%" PRIu64 " times)\n", edge.task, edge.prev, edge.next,
+            edge.count);
 #endif
 
-  // Skip kernel addresses
-  if (is_kernel_addr(bb_previous) || is_kernel_addr(bb_current)) {
-    return;
+    // Skip edges with an endpoint the user is not interested in. With
+    // per-CPU rings, the first samples of an image may be decoded before its
+    // mmap record, and are filtered as if the image was not mapped yet
+    if (options->filter != NULL &&
+        (!options->filter->IsInteresting(edge.prev) ||
+         !options->filter->IsInteresting(edge.next))) {
+      continue;
+    }
+
+    // Consecutive edges usually come from the same task
+    task_id task(edge.task & 0xffffffff, edge.task >> 32);
+    if (ring->last_map == NULL || ring->last_task != task) {
+      ring->last_task = task;
+      ring->last_map = &ring->tasks[task];
+    }
+    int size = ring->last_map->size();
+    ring->last_map->AddEdge(edge.prev, edge.next, edge.count);
+    n_new += ring->last_map->size() - size;
+
+    // With several rings, concurrent updates of the same bitmap entry may be
+    // lost (just like hit counts of multi-threaded targets in AFL)
+    if (options->bitmap != NULL) {
+      options->bitmap->AddEdge(edge.prev, edge.next, edge.count);
+    }
+    ring->n_events += edge.count;
   }
+  edges.clear();
 
-  gbl_execution_trace.basic_blocks.AddEdge(bb_previous, bb_current);
-  gbl_status.n_events++;
+  if (n_new > 0) {
+    session->watchdog.Progress();
+  }
 }
 
-static void monitor_process_events(void) {
+// Add a run of n branch samples. Kernel-space samples are skipped
+static void monitor_add_samples(unsigned char *records, size_t n,
+                                void *opaque) {
+  struct monitor_decoder *decoder =
+    static_cast<struct monitor_decoder *>(opaque);
+  struct perf_ring *ring = decoder->ring;
+  ring->aggregator.AddSamples(
+    reinterpret_cast<const struct perf_event_bts_sample *>(records), n);
+  ring->n_records += n;
+  monitor_add_edges(decoder->session, ring);
+}
+
+// Process a single perf record
+static void monitor_process_record(struct perf_event_header *event,
+                                   void *opaque) {
+  struct monitor_decoder *decoder =
+    static_cast<struct monitor_decoder *>(opaque);
+
+  // Samples are counted in batches, by monitor_add_samples()
+  if (event->type != PERF_RECORD_SAMPLE) {
+    decoder->ring->n_records++;
+  }
+
+  switch (event->type) {
+  case PERF_RECORD_MMAP:
+    monitor_add_mmap(decoder->session,
+                     reinterpret_cast<struct perf_event_mmap *>(event));
+    break;
+
+  case PERF_RECORD_LOST:
+    LOG_DEBUG("Lost %lu events", ((struct perf_record_lost*) event)->lost);
+    decoder->ring->n_lost +=
+      reinterpret_cast<struct perf_record_lost *>(event)->lost;
+    break;
+
+  case PERF_RECORD_THROTTLE:
+  case PERF_RECORD_UNTHROTTLE:
+    LOG_DEBUG("Received a (un)throttle event, ignoring");
+    break;
+
+  case PERF_RECORD_SAMPLE:
+    if (event->size != sizeof(struct perf_event_bts_sample)) {
+      // Not a BTS sample: the trace cannot be trusted
+      if (!decoder->session->failed.exchange(true)) {
+        LOG_WARN("Unexpected sample record of %u bytes", event->size);
+      }
+      break;
+    }
+    monitor_add_samples(reinterpret_cast<unsigned char *>(event), 1,
+                        opaque);
+    break;
+
+  case PERF_RECORD_FORK: {
+    LOG_DEBUG("Process %d (thread %d) created",
+              reinterpret_cast<struct perf_event_fork *>(event)->pid,
+              reinterpret_cast<struct perf_event_fork *>(event)->tid);
+    break;
+  }
+
+  case PERF_RECORD_EXIT: {
+    LOG_DEBUG("Process %d (thread %d) has exited",
+              reinterpret_cast<struct perf_event_exit *>(event)->pid,
+              reinterpret_cast<struct perf_event_exit *>(event)->tid);
+    break;
+  }
+
+  default:
+    LOG_WARN("Skipping unsupported perf record %d", event->type);
+    break;
+  }
+}
+
+// Decode the new records of a ring. The ring lock must be held
+static void monitor_process_ring(struct monitor_session *session,
+                                 struct perf_ring *ring) {
   struct perf_event_mmap_page *control_page;
-  struct perf_event_header *event;
-  uint64_t head, prev_head_wrap;
-  void *data_mmap;
-  int size, offset;
+  uint64_t head, size;
+  unsigned char *data_mmap;
 
-  control_page = (struct perf_event_mmap_page*) gbl_status.mmap;
-  data_mmap = (unsigned char*) gbl_status.mmap + getpagesize();
+  control_page = (struct perf_event_mmap_page*) ring->mmap;
+  data_mmap = (unsigned char*) ring->mmap + getpagesize();
 
   if (control_page == NULL) {
     LOG_WARN("Skipping invalid control page");
@@ -79,177 +206,589 @@ static void monitor_process_events(void) {
   head = control_page->data_head;
   rmb();
 
-  size = head - gbl_status.prev_head;
+  LOG_DEBUG("Current head 0x%016" PRIx64 ", previous head 0x%016" PRIx64
+            ", size %" PRIu64 " data_size %d", head, ring->prev_head,
+            head - ring->prev_head, session->perf.data_size);
 
-  prev_head_wrap = gbl_status.prev_head % gbl_status.data_size;
+  if (head == ring->prev_head) {
+    return;
+  }
+  ring->n_drains++;
+  ring->drained_bytes += head - ring->prev_head;
+  ring->max_drain = std::max(ring->max_drain, head - ring->prev_head);
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+
+  if (session->options->capture != NULL) {
+    // Store new records as they are, to be decoded offline
+    if (!session->options->capture->AddRecords(ring->id, data_mmap,
+                                               session->perf.data_size,
+                                               ring->prev_head, head) &&
+        !session->failed.exchange(true)) {
+      LOG_WARN("Error writing capture file: %s", strerror(errno));
+    }
+  } else {
+    // Decode new records directly from the ring buffer: runs of samples are
+    // handled in batches, and edges still in the aggregator are flushed
+    // before the ring is released
+    struct monitor_decoder decoder = { session, ring };
+    size = ring_decode_runs(data_mmap, session->perf.data_size,
+                            ring->prev_head, head, ring->data,
+                            PERF_RECORD_SAMPLE,
+                            sizeof(struct perf_event_bts_sample),
+                            monitor_add_samples, monitor_process_record,
+                            &decoder);
+    if (size != head - ring->prev_head &&
+        !session->failed.exchange(true)) {
+      LOG_WARN("Malformed record in ring %" PRIu32 " after %" PRIu64
+               " bytes", ring->id, size);
+    }
+    ring->aggregator.Flush();
+    monitor_add_edges(session, ring);
+  }
 
-  LOG_DEBUG("Current head 0x%016" PRIx64 ", previous head 0x%016" PRIx64
-            ", size %d data_size %d prev_head_wrap 0x%016" PRIx64, head,
-            gbl_status.prev_head, size, gbl_status.data_size, prev_head_wrap);
+  mb();
+  control_page->data_tail = head;
+  ring->prev_head = head;
+
+  std::chrono::duration<uint64_t, std::nano> elapsed =
+    std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start);
+  ring->drain_ns += elapsed.count();
+}
+
+void monitor_process_events(struct monitor_session *session) {
+  for (size_t i = 0; i < session->perf.n_rings; i++) {
+    struct perf_ring *ring = session->perf.rings[i].get();
+    std::lock_guard<std::mutex> lock(ring->lock);
+    monitor_process_ring(session, ring);
+  }
+}
 
+// A new task has been created by the target, and it is stopped before
+// executing any code
+static void monitor_add_task(struct monitor_session *session, pid_t pid) {
+  LOG_DEBUG("Following new task %d", pid);
+  session->tasks.insert(pid);
+
+  // Per-CPU events are inherited, otherwise the new task needs its own
+  if (!session->perf.percpu) {
+    struct perf_ring *ring = perf_attach_task(&session->perf, pid);
+    if (ring == NULL) {
+      session->n_untraced++;
+      return;
+    }
+    ring->drain_thread = std::thread(monitor_drain, session, ring);
+  }
+}
 
-  // Copy (possibly wrapped) data to the work area
-  memcpy(gbl_status.data, (unsigned char*) data_mmap + prev_head_wrap,
-         gbl_status.data_size - prev_head_wrap);
-  memcpy(gbl_status.data + gbl_status.data_size - prev_head_wrap,
-         (unsigned char*) data_mmap, prev_head_wrap);
+// A ptrace() request on task pid has failed. A task killed meanwhile (e.g.,
+// by SIGKILL) is reaped later: any other error fails the run
+static void monitor_ptrace_error(struct monitor_session *session,
+                                 const char *request, pid_t pid) {
+  if (errno == ESRCH) {
+    LOG_DEBUG("Task %d is gone (%s)", pid, request);
+    return;
+  }
+  LOG_WARN("Error following task %d (%s): %s", pid, request,
+           strerror(errno));
+  session->failed = true;
+}
 
-  offset = 0;
-  while (offset < size) {
-    event = (struct perf_event_header *) &gbl_status.data[offset];
+int monitor_run(struct monitor_session *session, pid_t pid_child,
+                bool options_set) {
+  int status, status_child = 0;
+  pid_t pid;
 
-    switch (event->type) {
-    case PERF_RECORD_MMAP:
-      monitor_add_mmap(reinterpret_cast<struct perf_event_mmap *>(event));
-      break;
+  session->tasks.clear();
+  session->tasks_pending.clear();
+  session->tasks_early.clear();
+  session->tasks.insert(pid_child);
+  session->n_untraced = 0;
+
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  getrusage(RUSAGE_SELF, &session->usage_start);
+  memset(&session->usage_child, 0, sizeof(session->usage_child));
+  uint64_t n_stops = 0;
+  TraceHang hang = TraceHangNone;
+  if (!session->watchdog.Start(session->options->timeout_ms,
+                               session->options->idle_ms)) {
+    session->failed = true;
+  }
 
-    case PERF_RECORD_LOST:
-      LOG_DEBUG("Lost %lu events", ((struct perf_record_lost*) event)->lost);
+  // Wait until all the tasks terminate, one of them crashes, the watchdog
+  // interrupts a hung run, or an error stops it. Tasks are traced by this
+  // thread: other sessions may be tracing their own targets from other
+  // threads
+  while (!session->tasks.empty() && !session->failed) {
+    struct rusage usage;
+    pid = wait4(-1, &status, __WALL | __WNOTHREAD, &usage);
+    if (pid == -1) {
+      if (errno == EINTR) {
+        hang = session->watchdog.hang();
+        if (hang != TraceHangNone) {
+          break;
+        }
+        continue;
+      }
+      LOG_WARN("Error waiting for the target: %s", strerror(errno));
+      session->failed = true;
       break;
+    }
 
-    case PERF_RECORD_THROTTLE:
-    case PERF_RECORD_UNTHROTTLE:
-      LOG_DEBUG("Received a (un)throttle event, ignoring");
-      break;
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      if (pid == pid_child) {
+        session->usage_child = usage;
+      }
+      if (WIFEXITED(status)) {
+        LOG_DEBUG("Task %d terminated with status %d", pid,
+                  WEXITSTATUS(status));
+      } else {
+        LOG_DEBUG("Task %d terminated by signal #%d", pid, WTERMSIG(status));
+      }
+
+      session->tasks.erase(pid);
+      if (pid == pid_child) {
+        status_child = status;
+      }
+      continue;
+    }
 
-    case PERF_RECORD_SAMPLE:
-      assert(event->size == sizeof(struct perf_event_bts_sample));
-      monitor_add_sample(reinterpret_cast<
-       struct perf_event_bts_sample *>(event));
+    if (!WIFSTOPPED(status)) {
+      LOG_WARN("Unexpected wait status 0x%x for task %d", status, pid);
+      session->failed = true;
       break;
-
-    case PERF_RECORD_FORK: {
-      LOG_DEBUG("Process %d (thread %d) created",
-                reinterpret_cast<struct perf_event_fork *>(event)->pid,
-                reinterpret_cast<struct perf_event_fork *>(event)->tid);
+    }
+    int signum = WSTOPSIG(status);
+    int event = status >> 16;
+    n_stops++;
+
+    if (session->tasks.count(pid) == 0 ||
+        session->tasks_pending.count(pid) != 0) {
+      // First stop of a new task
+      if (signum != SIGSTOP) {
+        LOG_WARN("Task %d first stopped by signal #%d", pid, signum);
+        session->failed = true;
+        break;
+      }
+      if (session->tasks_pending.erase(pid) == 0) {
+        session->tasks_early.insert(pid);
+      }
+      monitor_add_task(session, pid);
+      signum = 0;
+    } else if (event == PTRACE_EVENT_FORK || event == PTRACE_EVENT_VFORK ||
+               event == PTRACE_EVENT_CLONE) {
+      unsigned long msg;
+      if (ptrace(PTRACE_GETEVENTMSG, pid, NULL, &msg) == -1) {
+        monitor_ptrace_error(session, "PTRACE_GETEVENTMSG", pid);
+        continue;
+      }
+
+      // The new task may have already stopped, or even terminated
+      pid_t pid_new = msg;
+      if (session->tasks_early.erase(pid_new) == 0) {
+        session->tasks.insert(pid_new);
+        session->tasks_pending.insert(pid_new);
+      }
+      signum = 0;
+    } else if (event == PTRACE_EVENT_EXEC) {
+      // The task that called exec() takes the pid of its thread group leader
+      unsigned long msg;
+      if (ptrace(PTRACE_GETEVENTMSG, pid, NULL, &msg) == -1) {
+        monitor_ptrace_error(session, "PTRACE_GETEVENTMSG", pid);
+        continue;
+      }
+      if (static_cast<pid_t>(msg) != pid) {
+        session->tasks.erase(msg);
+      }
+      signum = 0;
+    } else if (signum == SIGTRAP && pid == pid_child && !options_set) {
+      // Stopped by tracee_start(), before exec
+      if (ptrace(PTRACE_SETOPTIONS, pid, 0, MONITOR_PTRACE_OPTIONS) == -1) {
+        monitor_ptrace_error(session, "PTRACE_SETOPTIONS", pid);
+        continue;
+      }
+      options_set = true;
+      signum = 0;
+    } else if (tracee_is_fatal(signum) ||
+               (signum == SIGTRAP && !tracee_catches(pid, signum))) {
+      // A SIGTRAP of the target (e.g., a stray int3) is delivered, unless it
+      // would kill the target
+      LOG_DEBUG("Task %d stopped by signal #%d", pid, signum);
+      std::shared_ptr<Exception> exc = tracee_exception(pid);
+      if (exc != NULL) {
+        session->execution_trace.exceptions.push_back(exc);
+      }
+      status_child = status;
       break;
     }
 
-    case PERF_RECORD_EXIT: {
-      LOG_DEBUG("Process %d (thread %d) has exited",
-                reinterpret_cast<struct perf_event_exit *>(event)->pid,
-                reinterpret_cast<struct perf_event_exit *>(event)->tid);
+    // Resume the task, delivering any non-fatal signal (e.g., SIGCHLD)
+    if (ptrace(PTRACE_CONT, pid, 0, signum) == -1) {
+      monitor_ptrace_error(session, "PTRACE_CONT", pid);
+    }
+  }
+  session->watchdog.Stop();
+
+  if (session->n_untraced > 0) {
+    LOG_WARN("%d tasks of the target were not traced: use per-CPU rings",
+             session->n_untraced);
+  }
+
+  // Like AFL, report a hung child as killed by SIGKILL (monitor_kill() does
+  // the killing)
+  if (hang != TraceHangNone) {
+    LOG_INFO("Run %s after %.3f ms, stopping it", hang == TraceHangTimeout ?
+             "timed out" : "made no progress",
+             std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - start).count());
+    status_child = SIGKILL;
+  }
+  session->perf.hang = hang;
+  session->execution_trace.hang = hang;
+
+  // Process final events before terminating: a hung run keeps the edges
+  // drained so far
+  monitor_process_events(session);
+
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  session->perf.run_time = elapsed.count();
+
+  session->stats.Clear();
+  session->stats.Set("run", ++session->n_runs);
+  session->stats.SetDouble("wall_ms", elapsed.count() * 1e3);
+  session->stats.Set("ptrace_stops", n_stops);
+  session->stats.Set("hang", hang);
+  session->stats.Set("untraced_tasks", session->n_untraced);
+  return status_child;
+}
+
+int monitor_kill(struct monitor_session *session, pid_t pid_child,
+                 int status) {
+  for (auto it = session->tasks.begin(); it != session->tasks.end(); it++) {
+    kill(*it, SIGKILL);
+    ptrace(PTRACE_CONT, *it, 0, 0);
+  }
+
+  // Reap the killed tasks, and any other task they have just created
+  while (!session->tasks.empty()) {
+    int status_task;
+    struct rusage usage;
+    pid_t pid = wait4(-1, &status_task, __WALL | __WNOTHREAD, &usage);
+    if (pid == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
       break;
     }
 
-    default:
-      LOG_FATAL("Unsupported perf record %d", event->type);
+    if (WIFEXITED(status_task) || WIFSIGNALED(status_task)) {
+      if (pid == pid_child) {
+        session->usage_child = usage;
+      }
+      session->tasks.erase(pid);
+    } else if (session->tasks.insert(pid).second) {
+      kill(pid, SIGKILL);
+      ptrace(PTRACE_CONT, pid, 0, 0);
     }
+  }
+  session->tasks_pending.clear();
+  session->tasks_early.clear();
 
-    // Skip event
-    offset += event->size;
+  if (!WIFSTOPPED(status)) {
+    return status;
   }
 
-  assert(offset == size);
+  // Report the child as terminated by the signal it was stopped by
+  return WSTOPSIG(status);
+}
 
-  mb();
-  control_page->data_tail = head;
-  gbl_status.prev_head = head;
+void monitor_init(struct monitor_session *session,
+                  const struct monitor_options &options) {
+  session->options = &options;
 }
 
-static void monitor_handle_signal(pid_t pid, int status) {
-  LOG_DEBUG("Read signal info (pid %d)", pid);
-  siginfo_t si;
-  int ret = ptrace(PTRACE_GETSIGINFO, pid, NULL, &si);
-  assert(ret != -1);
+// Merge the edge tables of all the rings into the execution trace. Tasks can
+// be split among several rings, so per-task tables are merged as well, when
+// there are several tasks. Return the number of tasks
+static size_t monitor_merge(struct monitor_session *session) {
+  session->execution_trace.basic_blocks.Clear();
+  session->execution_trace.tasks.clear();
+  session->execution_trace.module_relative = false;
+  session->perf.n_events = 0;
+  session->perf.n_wakeups = 0;
+
+  RingStats &stats = session->execution_trace.ring_stats;
+  stats = RingStats();
+  stats.pages = session->perf.mmap_pages;
+  stats.watermark = session->perf.attr.wakeup_watermark;
+
+  // Per-task tables are only stored for runs with several tasks: do not
+  // build a copy of all the edges otherwise
+  std::set<task_id> tasks;
+  for (size_t i = 0; i < session->perf.rings.size(); i++) {
+    struct perf_ring *ring = session->perf.rings[i].get();
+    std::lock_guard<std::mutex> lock(ring->lock);
+    for (auto it = ring->tasks.begin(); it != ring->tasks.end(); it++) {
+      tasks.insert(it->first);
+    }
+  }
 
-  // Exception type
-  ExceptionType exc_type;
-  target_addr exc_faulty;
+  for (size_t i = 0; i < session->perf.rings.size(); i++) {
+    struct perf_ring *ring = session->perf.rings[i].get();
+    std::lock_guard<std::mutex> lock(ring->lock);
+    for (auto it = ring->tasks.begin(); it != ring->tasks.end(); it++) {
+      session->execution_trace.basic_blocks.Merge(it->second);
+      if (tasks.size() > 1) {
+        session->execution_trace.tasks[it->first].Merge(it->second);
+      }
+    }
+    session->perf.n_events += ring->n_events;
+    session->perf.n_wakeups += ring->n_wakeups;
+    stats.lost += ring->n_lost;
+    stats.wakeups += ring->n_wakeups;
+    stats.drains += ring->n_drains;
+    stats.drained_bytes += ring->drained_bytes;
+    stats.max_drain = std::max(stats.max_drain, ring->max_drain);
+  }
+  session->perf.n_lost = stats.lost;
+  return tasks.size();
+}
 
-  switch (si.si_signo) {
-  case SIGSEGV:
-    exc_type = ExceptionAccessViolation;
-    exc_faulty = reinterpret_cast<target_addr>(si.si_addr);
-    break;
-  default:
-    exc_type = ExceptionUnknown;
-    exc_faulty = 0;
-    break;
+// Capture mode: records are already in the capture file, add exceptions
+static void monitor_finish_capture(struct monitor_session *session) {
+  std::lock_guard<std::mutex> lock(session->lock);
+  for (exceptions_iterator it = session->execution_trace.exceptions.begin();
+       it != session->execution_trace.exceptions.end(); it++) {
+    if (!session->options->capture->AddException(**it)) {
+      LOG_WARN("Error writing capture file: %s", strerror(errno));
+    }
   }
+  LOG_INFO("Captured %" PRIu64 " bytes of perf records",
+           session->options->capture->size());
+  session->stats.Set("capture_bytes", session->options->capture->size());
+}
 
-  LOG_DEBUG("Reading child registers (pid %d)", pid);
-  struct user_regs_struct regs;
-  ret = ptrace(PTRACE_GETREGS, pid, NULL, &regs);
-  assert(ret != -1);
+// Add the counters of all the rings to the statistics of the run
+static void monitor_add_ring_stats(struct monitor_session *session) {
+  uint64_t n_wakeups = 0, n_drains = 0, drained_bytes = 0, n_lost = 0;
+  uint64_t n_records = 0, drain_ns = 0;
+  for (size_t i = 0; i < session->perf.rings.size(); i++) {
+    struct perf_ring *ring = session->perf.rings[i].get();
+    std::lock_guard<std::mutex> lock(ring->lock);
+    n_wakeups += ring->n_wakeups;
+    n_drains += ring->n_drains;
+    drained_bytes += ring->drained_bytes;
+    n_lost += ring->n_lost;
+    n_records += ring->n_records;
+    drain_ns += ring->drain_ns;
+  }
 
-  std::shared_ptr<Exception>
-    exc(new Exception(pid, exc_type, regs.rip, exc_faulty, 0));
+  session->stats.Set("ring_pages", session->perf.mmap_pages);
+  session->stats.Set("wakeups", n_wakeups);
+  session->stats.Set("drains", n_drains);
+  session->stats.Set("drained_bytes", drained_bytes);
+  session->stats.Set("lost_records", n_lost);
+  session->stats.Set("records", n_records);
+  session->stats.SetDouble("drain_ms", drain_ns / 1e6);
+  session->stats.SetDouble("decode_ns_per_record",
+                      n_records > 0 ? static_cast<double>(drain_ns) /
+                      n_records : 0);
+}
 
-  // Generate a stack trace for this process
-  target_addr fp = regs.rsp;
-  LOG_DEBUG("Starting stack walking at 0x%016lx", fp);
+// Append the statistics of the run to the stats file
+static void monitor_write_stats(struct monitor_session *session) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  stats_add_usage(&session->stats, "tracer", usage, &session->usage_start);
 
-  for (int i = 0; i < MAX_STACKTRACE_SIZE; i++) {
-    // Read the return address of current stack frame
-    target_addr retaddr = ptrace(PTRACE_PEEKTEXT, pid,
-         fp+sizeof(target_addr), 0);
-    if (retaddr == static_cast<target_addr>(-1)) {
-      LOG_DEBUG("Failed reading %d-th return address @0x%lx, giving up",
-                i, fp+sizeof(target_addr));
-      break;
+  if (!session->stats.Append(session->options->statsfile)) {
+    LOG_WARN("Error writing stats file %s",
+             session->options->statsfile.c_str());
+  }
+}
+
+// Decoding mode: merge the edges of all the rings, and output the trace
+static void monitor_finish_trace(struct monitor_session *session) {
+  size_t n_tasks = monitor_merge(session);
+
+  std::lock_guard<std::mutex> lock(session->lock);
+
+  // Edges are unique, so resolving them once here is much cheaper than
+  // resolving every sample while decoding. All the memory regions are known
+  // by now, whatever ring their records were decoded from
+  if (session->options->module_relative) {
+    int dropped = regions_relocate_trace(&session->execution_trace);
+    if (dropped > 0) {
+      LOG_INFO("Dropped %d CFG edges outside of known modules", dropped);
     }
+  }
 
-    // Save this return address
-    exc->stacktrace_push(retaddr);
-    LOG_DEBUG("ret%d @0x%lx -> 0x%lx", i, fp+sizeof(target_addr), retaddr);
+  // Bucketing tools read the signatures instead of resolving stack traces
+  crash_sign_trace(&session->execution_trace);
+  session->perf.coverage_hash_buckets =
+    session->execution_trace.basic_blocks.ComputeBucketHash();
+
+  LOG_INFO("Got %d events (%d CFG edges, %zu tasks)", session->perf.n_events,
+           session->execution_trace.basic_blocks.size(), n_tasks);
+  session->stats.Set("events", session->perf.n_events);
+  stats_add_trace(&session->stats, session->execution_trace);
+  session->stats.Set("tasks", n_tasks);
+  LOG_INFO("Drained %d ring wakeups without stopping the target",
+           session->perf.n_wakeups);
+  if (session->perf.n_lost > 0) {
+    LOG_WARN("Lost %" PRIu64 " perf records, the trace is incomplete: use "
+             "larger rings (-p or -A)", session->perf.n_lost);
+  }
 
-    // Read the address of the next stack frame
-    fp = ptrace(PTRACE_PEEKTEXT, pid, fp, 0);
-    if (fp == static_cast<target_addr>(-1)) {
-      LOG_DEBUG("Failed reading %d-th frame pointer @0x%lx, giving up", i, fp);
-      break;
+  if (session->options->bitmap != NULL) {
+    session->options->bitmap->Classify();
+  }
+
+  // Serialize to file
+  const struct monitor_options *options = session->options;
+  if (options->outfile.length() > 0) {
+    LOG_INFO("Serializing to %s", options->outfile.c_str());
+    if (!stats_serialize_trace(&session->stats, options->outfile,
+                               session->execution_trace, options->format)) {
+      LOG_WARN("Error writing trace file %s", options->outfile.c_str());
     }
   }
+}
+
+void monitor_finish(struct monitor_session *session) {
+  stats_add_usage(&session->stats, "target", session->usage_child);
+  monitor_add_ring_stats(session);
 
-  gbl_execution_trace.exceptions.push_back(exc);
+  if (session->options->capture != NULL) {
+    monitor_finish_capture(session);
+  } else {
+    monitor_finish_trace(session);
+  }
+
+  if (session->options->statsfile.length() > 0) {
+    monitor_write_stats(session);
+  }
 }
 
-void monitor_loop(pid_t pid_child, const std::string s_outfile) {
-  int ret, status;
-  pid_t pid;
+void monitor_checkpoint(struct monitor_session *session) {
+  std::lock_guard<std::mutex> lock(session->lock);
+  session->persistent_regions =
+    session->execution_trace.memory_regions.size();
+  if (session->options->filter != NULL) {
+    session->options->filter->Checkpoint();
+  }
+}
+
+void monitor_reset(struct monitor_session *session) {
+  // Hold all the ring locks, so that no drain thread is looking up the
+  // address filter while it is reset
+  std::vector<std::unique_lock<std::mutex> > ring_locks;
+  for (size_t i = 0; i < session->perf.rings.size(); i++) {
+    struct perf_ring *ring = session->perf.rings[i].get();
+    ring_locks.push_back(std::unique_lock<std::mutex>(ring->lock));
+    ring->tasks.clear();
+    ring->last_map = NULL;
+    ring->n_events = 0;
+    ring->n_wakeups = 0;
+    ring->n_lost = 0;
+    ring->n_drains = 0;
+    ring->drained_bytes = 0;
+    ring->max_drain = 0;
+    ring->n_records = 0;
+    ring->drain_ns = 0;
+  }
+
+  if (session->options->filter != NULL) {
+    session->options->filter->Reset();
+  }
+
+  std::lock_guard<std::mutex> lock(session->lock);
+  session->execution_trace.basic_blocks.Clear();
+  session->execution_trace.tasks.clear();
+  session->execution_trace.exceptions.clear();
+  session->execution_trace.memory_regions.resize(session->persistent_regions);
+  session->execution_trace.hang = TraceHangNone;
+  session->perf.n_events = 0;
+  session->perf.n_wakeups = 0;
+  session->perf.n_lost = 0;
+  session->perf.hang = TraceHangNone;
+  session->failed = false;
+}
+
+// Body of a drain thread: wait for the perf event to signal new data, and
+// consume it, until monitor_drain_stop() is invoked
+static void monitor_drain(struct monitor_session *session,
+                          struct perf_ring *ring) {
+  struct pollfd fds[2];
+  int nfds = 2;
+
+  fds[0].fd = session->drain_stop_fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = ring->fd_evt;
+  fds[1].events = POLLIN;
 
-  // Wait until child terminates
   while (1) {
-    pid = waitpid(pid_child, &status, 0);
-    if (pid == -1 && errno == EINTR) {
-      continue;
+    int ret = poll(fds, nfds, -1);
+    if (ret == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // The final monitor_process_events() drains the ring
+      LOG_WARN("Error polling the perf event: %s", strerror(errno));
+      return;
     }
 
-    assert(pid == pid_child);
+    if (fds[0].revents != 0) {
+      break;
+    }
 
-    // Process any pending event
-    if (gbl_status.data_ready > 0) {
-      gbl_status.data_ready--;
-      monitor_process_events();
+    if (fds[1].revents & POLLIN) {
+      std::lock_guard<std::mutex> lock(ring->lock);
+      monitor_process_ring(session, ring);
+      ring->n_wakeups++;
     }
 
-    if (WIFEXITED(status)) {
-      LOG_DEBUG("Child terminated with status %d", WEXITSTATUS(status));
-      break;
-    } else if (WIFSIGNALED(status)) {
-      LOG_DEBUG("Child terminated by signal #%d", WTERMSIG(status));
-      break;
-    } else if (WIFSTOPPED(status) && WSTOPSIG(status) != SIGTRAP) {
-      LOG_DEBUG("Child stopped by signal #%d", WSTOPSIG(status));
-      monitor_handle_signal(pid_child, status);
-      break;
+    if (fds[1].revents & (POLLHUP | POLLERR)) {
+      // The monitored task is gone, just wait to be stopped
+      nfds = 1;
     }
+  }
+}
 
-    // Resume child process
-    ret = ptrace(PTRACE_CONT, pid_child, 0, 0);
-    assert(ret != -1);
+bool monitor_drain_start(struct monitor_session *session) {
+  // All the threads are stopped by the same eventfd, which is never read.
+  // Targets of other sessions must not inherit it
+  session->drain_stop_fd = eventfd(0, EFD_CLOEXEC);
+  if (session->drain_stop_fd == -1) {
+    LOG_WARN("Error starting the drain threads: %s", strerror(errno));
+    return false;
   }
 
-  // Process final events before terminating
-  monitor_process_events();
+  for (size_t i = 0; i < session->perf.n_rings; i++) {
+    struct perf_ring *ring = session->perf.rings[i].get();
+    ring->drain_thread = std::thread(monitor_drain, session, ring);
+  }
+  return true;
+}
 
-  // Serialize to file
-  LOG_INFO("Got %d events (%d CFG edges)", gbl_status.n_events,
-           gbl_execution_trace.basic_blocks.size());
+void monitor_drain_stop(struct monitor_session *session) {
+  if (session->drain_stop_fd == -1) {
+    // Not running
+    return;
+  }
+
+  uint64_t value = 1;
+  if (write(session->drain_stop_fd, &value, sizeof(value)) !=
+      sizeof(value)) {
+    LOG_WARN("Error stopping the drain threads: %s", strerror(errno));
+  }
 
-  if (s_outfile.length() > 0) {
-    LOG_INFO("Serializing to %s", s_outfile.c_str());
-    serialize_trace(s_outfile, gbl_execution_trace);
+  for (size_t i = 0; i < session->perf.n_rings; i++) {
+    session->perf.rings[i]->drain_thread.join();
   }
+  close(session->drain_stop_fd);
+  session->drain_stop_fd = -1;
 }
@@ -5,11 +5,127 @@
 #ifndef _MONITOR_H_
 #define _MONITOR_H_
 
+#include <sys/ptrace.h>
+#include <sys/resource.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <mutex>
+#include <set>
 #include <string>
 #include <vector>
 
-void monitor_loop(pid_t pid_child, const std::string s_outfile);
+#include "common/covmap.h"
+#include "common/filter.h"
+#include "common/serialize.h"
+#include "common/stats.h"
+#include "common/watchdog.h"
+#include "./bts_trace.h"
+#include "./capture.h"
+
+// ptrace() options for the target: follow all the processes and threads it
+// creates
+#define MONITOR_PTRACE_OPTIONS                                          \
+  (PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACECLONE |     \
+   PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL)
+
+// Tracing options
+struct monitor_options {
+  std::string outfile;                  // Output trace file (empty: none)
+  TraceFormat format = TraceFormatProtobuf;  // Format of the output trace
+  bool module_relative = false;         // Store module-relative edges
+  CoverageBitmap *bitmap = NULL;        // Shared coverage bitmap (NULL: off)
+  AddressFilter *filter = NULL;         // Edges to trace (NULL: all user-space)
+  CaptureWriter *capture = NULL;        // Raw capture file (NULL: decode)
+  std::string statsfile;                // Per-run statistics file (empty: none)
+  unsigned int timeout_ms = 0;          // Time budget of each run (0: none)
+  unsigned int idle_ms = 0;             // Hang after this long without edges
+};
+
+// State of a tracing session: perf events and rings, drain threads, and the
+// execution trace of the current run. Sessions share nothing, and several of
+// them can trace different targets at the same time
+struct monitor_session {
+  struct perf_status perf;
+  const struct monitor_options *options = NULL;
+  ExecutionTrace execution_trace;
+
+  // Number of memory regions that survive monitor_reset()
+  size_t persistent_regions = 0;
+
+  // Drain threads consume ring buffers while the target keeps running. Each
+  // ring is protected by its own lock, while lock protects the memory
+  // regions of the execution trace. Lock rings first
+  std::mutex lock;
+  int drain_stop_fd = -1;
+
+  // An error has left the current run incomplete (e.g., the capture file
+  // cannot be written, or a task cannot be followed): the run is stopped, and
+  // its trace is not valid. Set by monitor_run() and by the drain threads,
+  // cleared by monitor_reset()
+  std::atomic<bool> failed{false};
+
+  // Tasks of the current run that have not terminated yet. A new task and
+  // the fork event of its parent are reported in any order: pending tasks
+  // have been reported by their parent only, early tasks by their first
+  // stop only
+  std::set<pid_t> tasks;
+  std::set<pid_t> tasks_pending;
+  std::set<pid_t> tasks_early;
+
+  // Tasks of the current run left untraced (see perf_attach_task())
+  int n_untraced = 0;
+
+  // Statistics of the current run, resource usage of the tracer when the run
+  // started, and of the child when it terminated
+  RunStats stats;
+  uint64_t n_runs = 0;
+  struct rusage usage_start;
+  struct rusage usage_child;
+
+  // Time budget of the current run. Drain threads report new edges as
+  // progress
+  Watchdog watchdog;
+};
+
+// Building blocks of a traced run (see fuzztrace::Tracer). The options passed
+// to monitor_init() must outlive the run. The child is either stopped by
+// tracee_start(), or already has MONITOR_PTRACE_OPTIONS (options_set, e.g.,
+// when forked by the fork server). monitor_run() follows the child and
+// all the tasks it creates, and returns when all of them have terminated,
+// when any of them is stopped by a fatal signal, or when the run hangs (see
+// common/watchdog.h). It returns the last wait status of the child, or the
+// status of the crashed task: in this case, the task is left in the
+// signal-delivery-stop. Hung runs are reported as killed by SIGKILL, and
+// their tasks are left running. On errors, it returns early with failed set.
+//
+// Tasks are waited for with wait4(-1) (__WNOTHREAD), which reaps any child of
+// the calling thread: a thread that traces a target must not have children
+// of its own
+void monitor_init(struct monitor_session *session,
+                  const struct monitor_options &options);
+int monitor_run(struct monitor_session *session, pid_t pid_child,
+                bool options_set = false);
+void monitor_process_events(struct monitor_session *session);
+void monitor_finish(struct monitor_session *session);
+
+// Start and stop the threads that drain the ring buffers of the perf events
+// currently attached (one thread per ring), while the target is running.
+// monitor_drain_start() returns false if the threads cannot be started, and
+// monitor_drain_stop() does nothing if they are not running
+bool monitor_drain_start(struct monitor_session *session);
+void monitor_drain_stop(struct monitor_session *session);
+
+// Kill all the tasks left by monitor_run(). If the run ended with a crash,
+// return a wait status that reports the child as terminated by the signal
+// the crashed task was stopped by
+int monitor_kill(struct monitor_session *session, pid_t pid_child,
+                 int status);
+
+// Mark the memory regions recorded so far (and the images known to the
+// address filter) as persistent, and discard any other per-run state (CFG
+// edges, exceptions, event counters)
+void monitor_checkpoint(struct monitor_session *session);
+void monitor_reset(struct monitor_session *session);
 
 #endif  // _MONITOR_H_
@@ -5,10 +5,25 @@
 #include "./perf.h"
 
 #include <asm/unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <vector>
 
 #include "common/logging.h"
 #include "./bts_trace.h"
+#include "./ring.h"
+
+// Auto-tuning: wakeup rates above this (over at least a few wakeups) cost
+// more than a larger ring
+static const double TUNE_WAKEUP_RATE = 1000;
+static const int TUNE_MIN_WAKEUPS = 64;
 
 /* There is no glibc wrapper for syscall perf_event_open(), so we provide a
    simple wrapper here */
@@ -17,7 +32,8 @@ int64_t perf_event_open(struct perf_event_attr *attr, pid_t pid,
   return syscall(__NR_perf_event_open, attr, pid, cpu, group_fd, flags);
 }
 
-void perf_init(struct perf_event_attr *attr, int mmap_pages) {
+void perf_init(struct perf_status *status, struct perf_event_attr *attr,
+               int mmap_pages) {
   memset(attr, 0, sizeof(struct perf_event_attr));
   attr->type = PERF_TYPE_HARDWARE;
   attr->size = sizeof(struct perf_event_attr);
@@ -31,10 +47,210 @@ void perf_init(struct perf_event_attr *attr, int mmap_pages) {
   attr->exclude_hv = 1;
   attr->exclude_idle = 1;
   attr->precise_ip = 2;
-  attr->wakeup_watermark = mmap_pages*getpagesize()/32/4;
   attr->watermark = 1;
   attr->mmap = 1;
 
   attr->sample_period = 1;
   attr->sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_ADDR;
+
+  perf_set_ring_size(status, attr, mmap_pages);
+}
+
+void perf_set_ring_size(struct perf_status *status,
+                        struct perf_event_attr *attr, int mmap_pages) {
+  status->mmap_pages = mmap_pages;
+  status->data_size = mmap_pages * getpagesize();
+  attr->wakeup_watermark = status->watermark > 0 ?
+    status->watermark : status->data_size / 128;
+}
+
+bool perf_tune(struct perf_status *status, struct perf_event_attr *attr) {
+  if (status->mmap_pages >= MAX_MMAP_PAGES) {
+    return false;
+  }
+
+  // With a fixed watermark, larger rings do not wake up less often
+  double rate = status->run_time > 0 ?
+    status->n_wakeups / status->run_time : 0;
+  bool busy = status->watermark == 0 &&
+    status->n_wakeups >= TUNE_MIN_WAKEUPS && rate > TUNE_WAKEUP_RATE;
+  if (status->n_lost == 0 && !busy) {
+    return false;
+  }
+
+  perf_set_ring_size(status, attr, status->mmap_pages * 2);
+  LOG_INFO("Growing rings to %d pages (%" PRIu64 " records lost, %.0f "
+           "wakeups/s)", status->mmap_pages, status->n_lost, rate);
+  return true;
+}
+
+// Make sure that at least n_rings ring objects are allocated
+static void perf_alloc_rings(struct perf_status *status, size_t n_rings) {
+  while (status->rings.size() < n_rings) {
+    std::unique_ptr<struct perf_ring> ring(new perf_ring());
+    ring->id = status->rings.size();
+    ring->data = (unsigned char*) malloc(RING_BOUNCE_SIZE);
+    assert(ring->data != NULL);
+    ring->last_map = NULL;
+    status->rings.push_back(std::move(ring));
+  }
+}
+
+// Open a perf event and map its ring buffer. Return false (with errno set)
+// if either fails
+static bool perf_open_ring(struct perf_status *status,
+                           struct perf_ring *ring,
+                           struct perf_event_attr *attr, pid_t pid, int cpu) {
+  ring->fd_evt = perf_event_open(attr, pid, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+  if (ring->fd_evt == -1) {
+    return false;
+  }
+
+  // Allocate mmap'ed area: the control page, and the data pages. Beyond
+  // kernel.perf_event_mlock_kb, mapping requires CAP_IPC_LOCK
+  ring->mmap_size = (status->mmap_pages + 1) * getpagesize();
+  ring->mmap = mmap(NULL, ring->mmap_size,
+      PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd_evt, 0);
+  if (ring->mmap == MAP_FAILED) {
+    int error = errno;
+    close(ring->fd_evt);
+    ring->fd_evt = -1;
+    ring->mmap = NULL;
+    errno = error;
+    return false;
+  }
+
+  ring->prev_head = 0;
+
+  fcntl(ring->fd_evt, F_SETFL, O_RDWR|O_NONBLOCK);
+  return true;
+}
+
+// Parse a kernel CPU list (e.g., "0-3,6,8-9"). Return false if malformed
+static bool perf_parse_cpus(const char *list, std::vector<int> *cpus) {
+  const char *p = list;
+  while (*p != '\0' && *p != '\n') {
+    char *end;
+    long first = strtol(p, &end, 10), last = first;
+    if (end == p || first < 0) {
+      return false;
+    }
+    if (*end == '-') {
+      p = end + 1;
+      last = strtol(p, &end, 10);
+      if (end == p || last < first) {
+        return false;
+      }
+    }
+    for (long cpu = first; cpu <= last; cpu++) {
+      cpus->push_back(cpu);
+    }
+
+    p = end;
+    if (*p == ',') {
+      p++;
+    }
+  }
+  return !cpus->empty();
+}
+
+// Find the ids of the online CPUs, which need not be contiguous (e.g., some
+// have been taken offline). Fall back to the CPUs this process may run on
+static void perf_online_cpus(std::vector<int> *cpus) {
+  char list[4096];
+  FILE *f = fopen("/sys/devices/system/cpu/online", "r");
+  if (f != NULL) {
+    bool ok = fgets(list, sizeof(list), f) != NULL &&
+      perf_parse_cpus(list, cpus);
+    fclose(f);
+    if (ok) {
+      return;
+    }
+    cpus->clear();
+  }
+
+  LOG_DEBUG("Cannot read the online CPUs, using the affinity mask");
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &set)) {
+        cpus->push_back(cpu);
+      }
+    }
+  }
+  if (cpus->empty()) {
+    cpus->push_back(0);
+  }
+}
+
+bool perf_attach(struct perf_status *status, struct perf_event_attr *attr,
+                 pid_t pid, bool percpu) {
+  std::vector<int> cpus;
+  if (percpu) {
+    perf_online_cpus(&cpus);
+  } else {
+    cpus.push_back(-1);
+  }
+  size_t n_rings = cpus.size();
+
+  perf_alloc_rings(status, n_rings);
+
+  for (size_t i = 0; i < n_rings; i++) {
+    if (!perf_open_ring(status, status->rings[i].get(), attr, pid,
+                        cpus[i])) {
+      int error = errno;
+      LOG_WARN("Error opening a perf event with a ring of %d pages: %s",
+               status->mmap_pages, strerror(error));
+
+      // Release the rings opened so far
+      status->n_rings = i;
+      perf_detach(status);
+      errno = error;
+      return false;
+    }
+  }
+
+  status->n_rings = n_rings;
+  status->attr = *attr;
+  status->percpu = percpu;
+  return true;
+}
+
+struct perf_ring *perf_attach_task(struct perf_status *status, pid_t pid) {
+  assert(!status->percpu);
+
+  // The new task is not going to exec (at least, not before running some
+  // code of its parent): trace it right away
+  struct perf_event_attr attr = status->attr;
+  attr.disabled = 0;
+  attr.enable_on_exec = 0;
+
+  if (status->n_rings >= MAX_TASK_RINGS) {
+    LOG_DEBUG("Not tracing task %d, too many rings", pid);
+    return NULL;
+  }
+
+  perf_alloc_rings(status, status->n_rings + 1);
+  struct perf_ring *ring = status->rings[status->n_rings].get();
+  if (!perf_open_ring(status, ring, &attr, pid, -1)) {
+    LOG_DEBUG("Not tracing task %d: %s", pid, strerror(errno));
+    return NULL;
+  }
+
+  status->n_rings++;
+  return ring;
+}
+
+void perf_detach(struct perf_status *status) {
+  for (size_t i = 0; i < status->n_rings; i++) {
+    struct perf_ring *ring = status->rings[i].get();
+
+    ioctl(ring->fd_evt, PERF_EVENT_IOC_DISABLE, 0);
+    close(ring->fd_evt);
+    munmap(ring->mmap, ring->mmap_size);
+    ring->mmap = NULL;
+  }
+
+  status->n_rings = 0;
 }
@@ -9,6 +9,8 @@
 #include <stdint.h>
 #include <unistd.h>
 
+struct perf_status;
+
 struct sample_id {
   uint64_t id;
 };
@@ -33,6 +35,11 @@ struct perf_event_bts_sample {
   struct perf_event_bts bts;
 };
 
+// Branches from and to kernel space are reported too, but never traced
+static inline bool perf_is_kernel_addr(uint64_t addr) {
+  return (addr >> 47) != 0;
+}
+
 // mmap()'ing of executable areas
 struct perf_event_mmap {
   struct perf_event_header header;
@@ -40,8 +47,7 @@ struct perf_event_mmap {
   uint64_t addr;
   uint64_t len;
   uint64_t pgoff;
-  char filename[];
-  struct sample_id sample_id;
+  char filename[];              // Followed by sample_id, if requested
 };
 
 // Process exit event
@@ -63,7 +69,35 @@ struct perf_event_fork {
 
 int64_t perf_event_open(struct perf_event_attr *attr, pid_t pid,
                         int cpu, int group_fd, uint64_t flags);
-void perf_init(struct perf_event_attr *attr, int mmap_pages);
+// Initialize the attributes of the perf events, and the size of their rings
+// (mmap_pages data pages, see perf_set_ring_size())
+void perf_init(struct perf_status *status, struct perf_event_attr *attr,
+               int mmap_pages);
+
+// Set the data pages of the rings attached from now on, and the wakeup
+// watermark of attr: status->watermark bytes, or 1/128 of the ring
+void perf_set_ring_size(struct perf_status *status,
+                        struct perf_event_attr *attr, int mmap_pages);
+
+// Auto-tuning: after a run, double the size of the rings attached from now
+// on if the last run lost records or, with the default watermark, woke up
+// the drain threads too often. Return true if the size has changed
+bool perf_tune(struct perf_status *status, struct perf_event_attr *attr);
+
+// Open the perf event for process pid and map its ring buffer, updating
+// status. With percpu, open one event (and ring) for each online CPU. Return
+// false (with errno set, and nothing attached) if any event cannot be
+// opened. perf_detach() releases events and rings
+bool perf_attach(struct perf_status *status, struct perf_event_attr *attr,
+                 pid_t pid, bool percpu);
+void perf_detach(struct perf_status *status);
+
+// Attach a new, enabled per-task event to a task created by the target,
+// using the attributes of the last perf_attach(). Only for per-task events:
+// per-CPU ones are inherited. Return NULL, leaving the task untraced, when
+// the event or its ring cannot be opened, or when MAX_TASK_RINGS rings are
+// attached already
+struct perf_ring *perf_attach_task(struct perf_status *status, pid_t pid);
 
 #if defined(__i386__)
 #define rmb() asm volatile("lock; addl $0,0(%%esp)" ::: "memory")
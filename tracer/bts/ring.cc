@@ -0,0 +1,72 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+
+#include "./ring.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "common/logging.h"
+
+uint64_t ring_decode(unsigned char *ring, uint64_t ring_size,
+                     uint64_t tail, uint64_t head, unsigned char *bounce,
+                     ring_record_handler handler, void *opaque) {
+  return ring_decode_runs(ring, ring_size, tail, head, bounce, 0, 0, NULL,
+                          handler, opaque);
+}
+
+uint64_t ring_decode_runs(unsigned char *ring, uint64_t ring_size,
+                          uint64_t tail, uint64_t head, unsigned char *bounce,
+                          uint32_t run_type, uint16_t run_size,
+                          ring_run_handler run_handler,
+                          ring_record_handler handler, void *opaque) {
+  uint64_t offset = tail;
+
+  while (offset < head) {
+    uint64_t offset_wrap = offset % ring_size;
+    struct perf_event_header *event =
+      (struct perf_event_header *) (ring + offset_wrap);
+
+    if (run_handler != NULL && event->size == run_size &&
+        event->type == run_type) {
+      // Extend the run up to the first other record, or to the end of the
+      // ring (or of the new data)
+      uint64_t limit = std::min(head - offset, ring_size - offset_wrap);
+      size_t n = 1;
+      while ((n + 1) * run_size <= limit) {
+        struct perf_event_header *next =
+          (struct perf_event_header *) (ring + offset_wrap + n * run_size);
+        if (next->size != run_size || next->type != run_type) {
+          break;
+        }
+        n++;
+      }
+
+      // A record wrapping around the end of the ring is left to handler
+      if (run_size <= limit) {
+        offset += n * run_size;
+        run_handler(ring + offset_wrap, n, opaque);
+        continue;
+      }
+    }
+
+    // Records are 8-byte aligned, so headers never wrap around
+    if (event->size < sizeof(*event) || offset + event->size > head) {
+      LOG_WARN("Malformed perf record at offset 0x%lx", (unsigned long) offset);
+      break;
+    }
+
+    if (offset_wrap + event->size > ring_size) {
+      uint64_t chunk = ring_size - offset_wrap;
+      memcpy(bounce, ring + offset_wrap, chunk);
+      memcpy(bounce + chunk, ring, event->size - chunk);
+      event = (struct perf_event_header *) bounce;
+    }
+
+    offset += event->size;
+    handler(event, opaque);
+  }
+
+  return offset - tail;
+}
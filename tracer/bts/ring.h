@@ -0,0 +1,41 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// In-place decoding of perf_event ring buffers.
+//
+
+#ifndef _RING_H_
+#define _RING_H_
+
+#include <linux/perf_event.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// perf records are at most 64 KiB long (the size field is 16 bits wide)
+#define RING_BOUNCE_SIZE (1 << 16)
+
+typedef void (*ring_record_handler)(struct perf_event_header *event,
+                                    void *opaque);
+typedef void (*ring_run_handler)(unsigned char *records, size_t n,
+                                 void *opaque);
+
+// Invoke handler on every record stored in the ring data area between
+// offsets tail and head (free-running counters, as found in the control page).
+// Records are decoded in place; only records that wrap around the end of the
+// ring are copied to the bounce buffer (at least RING_BOUNCE_SIZE bytes).
+// Return the number of bytes consumed
+uint64_t ring_decode(unsigned char *ring, uint64_t ring_size,
+                     uint64_t tail, uint64_t head, unsigned char *bounce,
+                     ring_record_handler handler, void *opaque);
+
+// Same as ring_decode(), but runs of consecutive records of type run_type and
+// size run_size are passed to run_handler at once, as an array of n records.
+// Runs stop at the end of the ring: a record that wraps around it goes to
+// handler, through the bounce buffer, as any other record
+uint64_t ring_decode_runs(unsigned char *ring, uint64_t ring_size,
+                          uint64_t tail, uint64_t head, unsigned char *bounce,
+                          uint32_t run_type, uint16_t run_size,
+                          ring_run_handler run_handler,
+                          ring_record_handler handler, void *opaque);
+
+#endif  // _RING_H_
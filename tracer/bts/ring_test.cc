@@ -0,0 +1,150 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Drive ring_decode() and ring_decode_runs() with synthetic, wrapped ring
+// buffer contents. No BTS hardware is required.
+//
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "./perf.h"
+#include "./ring.h"
+
+static const uint64_t RING_SIZE = 4096;
+
+struct decode_state {
+  std::vector<unsigned char> records;   // Decoded records, concatenated
+  int n_records;
+};
+
+static void record_handler(struct perf_event_header *event, void *opaque) {
+  struct decode_state *state = static_cast<struct decode_state *>(opaque);
+  const unsigned char *p = reinterpret_cast<unsigned char *>(event);
+  state->records.insert(state->records.end(), p, p + event->size);
+  state->n_records++;
+}
+
+static void run_handler(unsigned char *records, size_t n, void *opaque) {
+  struct decode_state *state = static_cast<struct decode_state *>(opaque);
+  size_t size = sizeof(struct perf_event_bts_sample);
+  for (size_t i = 0; i < n; i++) {
+    const struct perf_event_header *event =
+      reinterpret_cast<struct perf_event_header *>(records + i * size);
+    assert(event->type == PERF_RECORD_SAMPLE && event->size == size);
+  }
+  state->records.insert(state->records.end(), records, records + n * size);
+  state->n_records += n;
+}
+
+// Append a BTS sample record to the stream
+static void emit_sample(std::vector<unsigned char> *stream, int i) {
+  struct perf_event_bts_sample sample;
+  memset(&sample, 0, sizeof(sample));
+  sample.header.type = PERF_RECORD_SAMPLE;
+  sample.header.size = sizeof(sample);
+  sample.bts.from = 0x400000 + i;
+  sample.bts.to = 0x500000 + i;
+  sample.bts.pid = sample.bts.tid = 1234;
+
+  const unsigned char *p = reinterpret_cast<unsigned char *>(&sample);
+  stream->insert(stream->end(), p, p + sizeof(sample));
+}
+
+// Append a (variable-length) mmap record to the stream
+static void emit_mmap(std::vector<unsigned char> *stream, int i) {
+  char filename[64];
+  int len = snprintf(filename, sizeof(filename), "/lib/lib%0*d.so", i % 40, i);
+
+  size_t size = sizeof(struct perf_event_mmap) + len + 1;
+  size = (size + 7) & ~7;
+
+  std::vector<unsigned char> record(size, 0);
+  struct perf_event_mmap *event =
+    reinterpret_cast<struct perf_event_mmap *>(record.data());
+  event->header.type = PERF_RECORD_MMAP;
+  event->header.size = size;
+  event->addr = 0x7f0000000000ULL + i * 0x1000;
+  event->len = 0x1000;
+  memcpy(event->filename, filename, len + 1);
+
+  stream->insert(stream->end(), record.begin(), record.end());
+}
+
+// Copy stream[from, to) into the ring, at free-running offset base+from
+static void ring_write(unsigned char *ring, uint64_t base,
+                       const std::vector<unsigned char> &stream,
+                       uint64_t from, uint64_t to) {
+  for (uint64_t i = from; i < to; i++) {
+    ring[(base + i) % RING_SIZE] = stream[i];
+  }
+}
+
+// Decode a stream larger than the ring, at several starting offsets. With
+// a run handler, runs of samples are decoded in batches
+static void check_decode(ring_run_handler runs) {
+  std::vector<unsigned char> ring(RING_SIZE, 0xaa);
+  std::vector<unsigned char> bounce(RING_BOUNCE_SIZE);
+
+  for (uint64_t base = 0; base < 2 * RING_SIZE; base += 8 * 37) {
+    // Generate a stream of records, several times larger than the ring
+    std::vector<unsigned char> stream;
+    std::vector<uint64_t> boundaries;
+    for (int i = 0; stream.size() < 4 * RING_SIZE; i++) {
+      boundaries.push_back(stream.size());
+      if (i % 5 == 0) {
+        emit_mmap(&stream, i);
+      } else {
+        emit_sample(&stream, i);
+      }
+    }
+    boundaries.push_back(stream.size());
+
+    // Produce and consume the stream, a few records at a time, so that the
+    // ring wraps around several times
+    struct decode_state state;
+    state.n_records = 0;
+    uint64_t tail = 0;
+    for (size_t b = 0; b < boundaries.size() - 1; ) {
+      size_t next = b;
+      while (next < boundaries.size() - 1 &&
+             boundaries[next + 1] - boundaries[b] <= RING_SIZE / 3) {
+        next++;
+      }
+      assert(next > b);
+
+      ring_write(ring.data(), base, stream, boundaries[b], boundaries[next]);
+      uint64_t consumed = ring_decode_runs(
+        ring.data(), RING_SIZE, base + tail, base + boundaries[next],
+        bounce.data(), PERF_RECORD_SAMPLE,
+        sizeof(struct perf_event_bts_sample), runs,
+        record_handler, &state);
+      assert(consumed == boundaries[next] - tail);
+      tail = boundaries[next];
+      b = next;
+    }
+
+    assert(state.n_records == static_cast<int>(boundaries.size() - 1));
+    assert(state.records == stream);
+  }
+}
+
+int main(int argc, char **argv) {
+  check_decode(NULL);
+  check_decode(run_handler);
+
+  std::vector<unsigned char> ring(RING_SIZE, 0xaa);
+  std::vector<unsigned char> bounce(RING_BOUNCE_SIZE);
+
+  // An empty ring yields no records
+  struct decode_state state;
+  state.n_records = 0;
+  assert(ring_decode(ring.data(), RING_SIZE, 64, 64, bounce.data(),
+                     record_handler, &state) == 0);
+  assert(state.n_records == 0);
+
+  printf("ring_test: ok\n");
+  return 0;
+}
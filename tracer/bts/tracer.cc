@@ -0,0 +1,124 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+
+#include "./tracer.h"
+
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "common/logging.h"
+#include "common/tracee.h"
+#include "./forkserver.h"
+#include "./perf.h"
+
+namespace fuzztrace {
+
+// Kill a child that is not followed by monitor_run() yet
+static void tracer_abort(pid_t pid) {
+  int status;
+  kill(pid, SIGKILL);
+  waitpid(pid, &status, __WALL);
+}
+
+Tracer::Tracer(const TracerConfig &config)
+  : percpu_(config.percpu), valid_(true) {
+  session_.perf.watermark = config.watermark;
+  session_.perf.autotune = config.autotune;
+  perf_init(&session_.perf, &attr_, config.mmap_pages);
+  if (session_.perf.watermark >= session_.perf.data_size) {
+    LOG_WARN("The wakeup watermark must be smaller than the ring (%d bytes)",
+             session_.perf.data_size);
+    valid_ = false;
+  }
+
+  // Events are inherited by all the tasks of the target
+  if (percpu_) {
+    attr_.inherit = 1;
+  }
+}
+
+bool Tracer::Run(char **argv, int fd_input,
+                 const struct monitor_options &options, int *status) {
+  if (!valid_) {
+    return false;
+  }
+
+  monitor_init(&session_, options);
+  monitor_reset(&session_);
+
+  pid_t pid_child = tracee_start(argv, fd_input);
+  if (pid_child == -1) {
+    return false;
+  }
+  LOG_DEBUG("Started child with pid %d", pid_child);
+  session_.perf.pid_child = pid_child;
+  if (!perf_attach(&session_.perf, &attr_, pid_child, percpu_)) {
+    tracer_abort(pid_child);
+    return false;
+  }
+  if (!monitor_drain_start(&session_)) {
+    perf_detach(&session_.perf);
+    tracer_abort(pid_child);
+    return false;
+  }
+
+  int status_child = monitor_kill(&session_, pid_child,
+                                  monitor_run(&session_, pid_child));
+  monitor_drain_stop(&session_);
+  perf_detach(&session_.perf);
+  if (session_.failed) {
+    return false;
+  }
+  monitor_finish(&session_);
+
+  // The rings of the next run are mapped with the new size
+  if (session_.perf.autotune) {
+    perf_tune(&session_.perf, &attr_);
+  }
+
+  if (status != NULL) {
+    *status = status_child;
+  }
+  return true;
+}
+
+bool Tracer::Serve(char **argv, int fd_input,
+                   const struct monitor_options &options) {
+  if (!valid_) {
+    return false;
+  }
+
+  // Processes forked by the fork server inherit the events of the server,
+  // and the kernel only allows to map the rings of inherited events when
+  // they are bound to a CPU
+  if (!percpu_) {
+    LOG_WARN("Fork server mode requires per-CPU events");
+    return false;
+  }
+
+  pid_t pid_server = tracee_start(argv, fd_input);
+  if (pid_server == -1) {
+    return false;
+  }
+  LOG_DEBUG("Started fork server with pid %d", pid_server);
+  session_.perf.pid_child = pid_server;
+  if (!perf_attach(&session_.perf, &attr_, pid_server, true)) {
+    tracer_abort(pid_server);
+    return false;
+  }
+  if (!monitor_drain_start(&session_)) {
+    perf_detach(&session_.perf);
+    tracer_abort(pid_server);
+    return false;
+  }
+
+  bool ok = forkserver_loop(&session_, pid_server, options, fd_input);
+
+  monitor_drain_stop(&session_);
+  perf_detach(&session_.perf);
+  return ok;
+}
+
+}  // namespace fuzztrace
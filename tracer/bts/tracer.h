@@ -0,0 +1,83 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Embeddable BTS tracer: the engine of bts_trace, as a library object.
+//
+// A Tracer owns a tracing session (perf events, rings, bounce buffers, edge
+// tables and drain threads) and reuses it across runs: a fuzz driver linked
+// against libbtstrace.a gets the coverage of each run in memory, without
+// spawning bts_trace, writing a trace file and parsing it back. Tracers share
+// no state: several of them can run at the same time, each from its own
+// thread (tasks are traced by the thread that started them).
+//
+
+#ifndef _TRACER_H_
+#define _TRACER_H_
+
+#include <linux/perf_event.h>
+
+#include "common/serialize.h"
+#include "./bts_trace.h"
+#include "./monitor.h"
+
+namespace fuzztrace {
+
+// Perf ring settings, fixed for the lifetime of a tracer (see bts_trace
+// options -p, -W, -A and -P)
+struct TracerConfig {
+  int mmap_pages = DEFAULT_MMAP_PAGES;  // Data pages of each ring
+  int watermark = 0;            // Wakeup watermark (0: 1/128 of the ring)
+  bool autotune = false;        // Grow the rings after runs that overflow
+  bool percpu = false;          // One inherited event (and ring) per CPU
+};
+
+class Tracer {
+ public:
+  // Invalid settings (e.g., a watermark larger than the ring) are reported
+  // here, and make every run fail
+  explicit Tracer(const TracerConfig &config);
+
+  // Trace an execution of argv, feeding it fd_input (-1: none) as standard
+  // input. The trace is kept in memory (see trace()), and also written to
+  // options.outfile unless it is empty. In capture mode (options.capture),
+  // it only holds exceptions. If status is not NULL, it receives the wait
+  // status of the child (hung runs are reported as killed by SIGKILL).
+  // Return false if the run cannot be traced, or its trace is incomplete:
+  // errors are logged, and the child is killed.
+  //
+  // The calling thread waits for the tasks of the target with wait4(-1),
+  // and reaps any other child it has: it must not start processes of its
+  // own. While a run has a time budget, the tracer owns the handler of
+  // WATCHDOG_SIGNAL (see common/watchdog.h)
+  bool Run(char **argv, int fd_input, const struct monitor_options &options,
+           int *status = NULL);
+
+  // Fork server mode (see forkserver.h): start argv once, then trace a test
+  // case whenever the driver asks to. Requires a per-CPU tracer. Serve the
+  // driver until told to stop; return false if the server cannot be
+  // started, or fails while serving
+  bool Serve(char **argv, int fd_input,
+             const struct monitor_options &options);
+
+  // Trace of the last successful run, valid until the next run
+  const ExecutionTrace &trace() const { return session_.execution_trace; }
+
+  // Perf events, and counters of the last run
+  const struct perf_status &status() const { return session_.perf; }
+
+  // Attributes of the events of the next run
+  const struct perf_event_attr &attr() const { return attr_; }
+
+  // False if the settings of the tracer are invalid
+  bool valid() const { return valid_; }
+
+ private:
+  struct monitor_session session_;
+  struct perf_event_attr attr_;
+  bool percpu_;
+  bool valid_;
+};
+
+}  // namespace fuzztrace
+
+#endif  // _TRACER_H_
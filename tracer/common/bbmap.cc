@@ -4,23 +4,116 @@
 
 #include "./bbmap.h"
 
+#include <algorithm>
+#include <climits>
 #include <cstdint>
 
-void BBMap::AddEdge(target_addr prev, target_addr next) {
-  bbmap_edge edge(prev, next);
+BBMap::BBMap()
+  : table_(kInitialCapacity), mask_(kInitialCapacity - 1), size_(0),
+    coverage_hash_(0), sorted_valid_(false) {
+}
+
+void BBMap::AddEdge(target_addr prev, target_addr next, uint64_t hit) {
+  size_t i = hash_edge(prev, next) & mask_;
+
+  // Linear probing: stop at the matching edge or at the first empty slot
+  while (table_[i].hit != 0) {
+    if (table_[i].prev == prev && table_[i].next == next) {
+      if (hit >= UINT_MAX - table_[i].hit) {
+        table_[i].hit = UINT_MAX;
+      } else {
+        table_[i].hit += hit;
+      }
+      sorted_valid_ = false;
+      return;
+    }
+    i = (i + 1) & mask_;
+  }
 
-  if (bb_map_.find(edge) == bb_map_.end()) {
-    bb_map_[edge] = 1;
+  table_[i].prev = prev;
+  table_[i].next = next;
+  if (hit == 0) {
+    table_[i].hit = 1;
   } else {
-    bb_map_[edge]  += 1;
+    table_[i].hit = hit < UINT_MAX ? hit : UINT_MAX;
+  }
+  size_++;
+  sorted_valid_ = false;
+  coverage_hash_ += hash_element(prev, next, 0);
+
+  if (static_cast<size_t>(size_) * 2 > table_.size()) {
+    Grow();
   }
 }
 
-uint32_t BBMap::ComputeHash() const {
-  uint32_t hash = 0;
-  for (bbmap_iterator it = map_begin(); it != map_end(); it++) {
-    bbmap_edge edge = it->first;
-    hash ^= edge.first ^ edge.second;
+void BBMap::Merge(const BBMap &other) {
+  for (std::vector<bbmap_slot>::const_iterator it = other.table_.begin();
+       it != other.table_.end(); it++) {
+    if (it->hit != 0) {
+      AddEdge(it->prev, it->next, it->hit);
+    }
+  }
+}
+
+void BBMap::Clear() {
+  std::fill(table_.begin(), table_.end(), bbmap_slot());
+  size_ = 0;
+  coverage_hash_ = 0;
+  sorted_.clear();
+  sorted_valid_ = false;
+}
+
+void BBMap::Grow() {
+  std::vector<bbmap_slot> old_table(table_.size() * 2);
+  old_table.swap(table_);
+  mask_ = table_.size() - 1;
+
+  for (std::vector<bbmap_slot>::const_iterator it = old_table.begin();
+       it != old_table.end(); it++) {
+    if (it->hit == 0) {
+      continue;
+    }
+
+    size_t i = hash_edge(it->prev, it->next) & mask_;
+    while (table_[i].hit != 0) {
+      i = (i + 1) & mask_;
+    }
+    table_[i] = *it;
+  }
+}
+
+const std::vector<std::pair<bbmap_edge, unsigned int> > &
+BBMap::sorted_view() const {
+  if (sorted_valid_) {
+    return sorted_;
+  }
+
+  sorted_.clear();
+  sorted_.reserve(size_);
+  for (std::vector<bbmap_slot>::const_iterator it = table_.begin();
+       it != table_.end(); it++) {
+    if (it->hit != 0) {
+      sorted_.push_back(std::make_pair(bbmap_edge(it->prev, it->next),
+                                       it->hit));
+    }
+  }
+
+  std::sort(sorted_.begin(), sorted_.end());
+  sorted_valid_ = true;
+  return sorted_;
+}
+
+uint64_t BBMap::ComputeBucketHash() const {
+  uint64_t hash = 0;
+  for (std::vector<bbmap_slot>::const_iterator it = table_.begin();
+       it != table_.end(); it++) {
+    if (it->hit != 0) {
+      hash += hash_element(it->prev, it->next, bbmap_bucket(it->hit));
+    }
   }
   return hash;
 }
+
+uint32_t BBMap::ComputeHash() const {
+  return static_cast<uint32_t>(coverage_hash_ ^ (coverage_hash_ >> 32));
+}
@@ -7,32 +7,130 @@
 #ifndef _COMMON_BBMAP_H
 #define _COMMON_BBMAP_H
 
-#include <map>
 #include <utility>
+#include <vector>
 
 #include "./common.h"
 
 typedef std::pair<target_addr, target_addr> bbmap_edge;
-typedef std::map<bbmap_edge, unsigned int >::const_iterator bbmap_iterator;
+typedef std::vector<std::pair<bbmap_edge, unsigned int> >::const_iterator
+  bbmap_iterator;
+
+// A single slot of the open-addressing edge table. Empty slots have a zero
+// hit counter, as every recorded edge has been hit at least once.
+struct bbmap_slot {
+  target_addr prev;
+  target_addr next;
+  unsigned int hit;
+};
+
+// AFL hit-count bucket of a hit counter: 1, 2, 3, 4-7, 8-15, 16-31, 32-127,
+// 128+ (same classes as CoverageBitmap::Classify())
+static inline unsigned int bbmap_bucket(uint64_t hit) {
+  if (hit <= 3) {
+    return hit;
+  } else if (hit <= 7) {
+    return 4;
+  } else if (hit <= 15) {
+    return 5;
+  } else if (hit <= 31) {
+    return 6;
+  } else if (hit <= 127) {
+    return 7;
+  }
+  return 8;
+}
 
 class BBMap {
  public:
-  explicit BBMap() {}
+  explicit BBMap();
 
   // Record the execution of a CFG edge, identified by a pair of basic block
-  // addresses
-  void AddEdge(target_addr prev, target_addr next);
+  // addresses, hit times. Hit counters saturate at UINT_MAX, and a recorded
+  // edge counts as hit at least once (zero marks empty slots)
+  void AddEdge(target_addr prev, target_addr next, uint64_t hit = 1);
+
+  // Add all the edges (and hits) of another map to this one
+  void Merge(const BBMap &other);
 
-  // Return a 32-bit hash of this basic block map
+  // Remove all the edges, keeping the allocated table for later reuse
+  void Clear();
+
+  // Order-independent 64-bit hash of the set of edges: a sum of per-edge
+  // hashes, updated by AddEdge() when an edge is new only, so that it is
+  // available at any time without walking the table
+  uint64_t coverage_hash() const { return coverage_hash_; }
+
+  // Order-independent 64-bit hash of the set of (edge, hit-count bucket)
+  // pairs. Hit counts change all the time, so this one walks the table
+  uint64_t ComputeBucketHash() const;
+
+  // Return a 32-bit hash of this basic block map (coverage_hash(), folded)
   uint32_t ComputeHash() const;
 
-  // Iterate over the (edge, #hit) pairs
-  bbmap_iterator map_begin() const { return bb_map_.begin(); }
-  bbmap_iterator map_end() const { return bb_map_.end(); }
-  int size() const { return bb_map_.size(); }
+  // Iterate over the (edge, #hit) pairs, sorted by edge. The sorted view is
+  // built lazily and invalidated by AddEdge()
+  bbmap_iterator map_begin() const { return sorted_view().begin(); }
+  bbmap_iterator map_end() const { return sorted_view().end(); }
+  int size() const { return size_; }
+
+  // Invoke f(prev, next, hit) for each edge, in table order. Unlike
+  // map_begin(), this does not build the sorted view
+  template <typename F> void ForEach(F f) const {
+    for (std::vector<bbmap_slot>::const_iterator it = table_.begin();
+         it != table_.end(); it++) {
+      if (it->hit != 0) {
+        f(it->prev, it->next, it->hit);
+      }
+    }
+  }
+
+  // Number of slots currently allocated for the edge table
+  int capacity() const { return table_.size(); }
+
+  // Bytes allocated for the edge table and its sorted view
+  size_t memory() const {
+    return table_.capacity() * sizeof(bbmap_slot) +
+      sorted_.capacity() * sizeof(sorted_[0]);
+  }
 
  private:
-  std::map<bbmap_edge, unsigned int > bb_map_;
+  // Grow the table when the load factor exceeds 1/2
+  static const unsigned int kInitialCapacity = 1024;
+
+  static inline size_t hash_edge(target_addr prev, target_addr next) {
+    uint64_t h = static_cast<uint64_t>(prev) * 0x9e3779b97f4a7c15ULL;
+    h ^= static_cast<uint64_t>(next) + (h << 6) + (h >> 2);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return static_cast<size_t>(h);
+  }
+
+  // Hash of a set element: the edge direction and the bucket matter
+  static inline uint64_t hash_element(target_addr prev, target_addr next,
+                                      unsigned int bucket) {
+    uint64_t h = static_cast<uint64_t>(prev) * 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 31;
+    h += static_cast<uint64_t>(next) ^ (0x9e3779b97f4a7c15ULL * (bucket + 1));
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 32;
+    return h;
+  }
+
+  void Grow();
+  const std::vector<std::pair<bbmap_edge, unsigned int> > &sorted_view() const;
+
+  std::vector<bbmap_slot> table_;
+  size_t mask_;
+  int size_;
+  uint64_t coverage_hash_;
+
+  // Cached, edge-sorted copy of the table used for deterministic iteration
+  mutable std::vector<std::pair<bbmap_edge, unsigned int> > sorted_;
+  mutable bool sorted_valid_;
 };
 
 #endif  // _COMMON_BBMAP_H
@@ -0,0 +1,123 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+
+#include "./bucket.h"
+
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+
+CrashBucketIndex::CrashBucketIndex() {
+}
+
+bool CrashBucketIndex::Load(const std::string &filename) {
+  FILE *f = fopen(filename.c_str(), "rb");
+  if (f == NULL) {
+    return false;
+  }
+
+  bucket_header header;
+  std::vector<bucket_record> records;
+  std::string strings;
+  bool ok = fread(&header, sizeof(header), 1, f) == 1 &&
+    memcmp(header.magic, BUCKET_MAGIC, BUCKET_MAGIC_SIZE) == 0 &&
+    header.version == BUCKET_VERSION && header.strings_size < (1ULL << 32);
+
+  if (ok) {
+    records.resize(header.n_buckets);
+    strings.resize(header.strings_size);
+    ok = (records.empty() || fread(records.data(), sizeof(bucket_record),
+                                   records.size(), f) == records.size()) &&
+      (strings.empty() || fread(&strings[0], 1, strings.size(), f) ==
+       strings.size()) &&
+      fgetc(f) == EOF;
+  }
+  fclose(f);
+
+  // Names are terminated within the string table, groups refer to earlier
+  // buckets
+  for (uint32_t i = 0; ok && i < records.size(); i++) {
+    ok = records[i].name < strings.size() &&
+      memchr(&strings[records[i].name], '\0',
+             strings.size() - records[i].name) != NULL &&
+      records[i].group <= i;
+  }
+  if (!ok) {
+    return false;
+  }
+
+  buckets_.swap(records);
+  names_.clear();
+  by_signature_.clear();
+  by_fuzzy_signature_.clear();
+  for (uint32_t i = 0; i < buckets_.size(); i++) {
+    names_.push_back(&strings[buckets_[i].name]);
+    by_signature_[buckets_[i].signature] = i;
+    by_fuzzy_signature_.insert(
+      std::make_pair(buckets_[i].fuzzy_signature, buckets_[i].group));
+  }
+  return true;
+}
+
+bool CrashBucketIndex::Save(const std::string &filename) const {
+  bucket_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, BUCKET_MAGIC, BUCKET_MAGIC_SIZE);
+  header.version = BUCKET_VERSION;
+  header.n_buckets = buckets_.size();
+
+  std::vector<bucket_record> records(buckets_);
+  std::string strings;
+  for (size_t i = 0; i < records.size(); i++) {
+    records[i].name = strings.size();
+    strings.append(names_[i].c_str(), names_[i].length() + 1);
+  }
+  header.strings_size = strings.size();
+
+  std::string tmpname = filename + ".tmp";
+  FILE *f = fopen(tmpname.c_str(), "wb");
+  if (f == NULL) {
+    return false;
+  }
+
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+  if (records.size() > 0) {
+    ok = ok && fwrite(records.data(), sizeof(bucket_record), records.size(),
+                      f) == records.size();
+  }
+  ok = ok && fwrite(strings.data(), 1, strings.size(), f) == strings.size();
+
+  ok = (fclose(f) == 0) && ok;
+  if (!ok || rename(tmpname.c_str(), filename.c_str()) == -1) {
+    unlink(tmpname.c_str());
+    return false;
+  }
+  return true;
+}
+
+uint32_t CrashBucketIndex::Assign(uint64_t signature, uint64_t fuzzy_signature,
+                                  const std::string &trace, bool *created) {
+  std::unordered_map<uint64_t, uint32_t>::iterator it =
+    by_signature_.find(signature);
+  if (it != by_signature_.end()) {
+    buckets_[it->second].count++;
+    *created = false;
+    return it->second;
+  }
+
+  uint32_t id = buckets_.size();
+  bucket_record record;
+  record.signature = signature;
+  record.fuzzy_signature = fuzzy_signature;
+  record.count = 1;
+  record.group = by_fuzzy_signature_.insert(
+    std::make_pair(fuzzy_signature, id)).first->second;
+  record.name = 0;
+
+  buckets_.push_back(record);
+  names_.push_back(trace);
+  by_signature_[signature] = id;
+  *created = true;
+  return id;
+}
@@ -0,0 +1,69 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Persistent index of crash buckets. A bucket collects the crashes with the
+// same exact signature (see crash.h); buckets with the same fuzzy signature
+// form a group, identified by its first bucket.
+//
+// A bucket index file is made of a fixed header, followed by the bucket
+// table (bucket_record entries, by bucket id) and by the string table (the
+// NUL-terminated names of the first trace of each bucket). The index is
+// loaded in hash tables, so that assigning a crash to a bucket takes
+// constant time, and saved back at once.
+//
+
+#ifndef _COMMON_BUCKET_H
+#define _COMMON_BUCKET_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define BUCKET_MAGIC "BBTB"
+#define BUCKET_MAGIC_SIZE 4
+#define BUCKET_VERSION 1
+
+struct bucket_header {
+  char magic[BUCKET_MAGIC_SIZE];
+  uint32_t version;
+  uint32_t n_buckets;
+  uint32_t reserved;
+  uint64_t strings_size;
+};
+
+struct bucket_record {
+  uint64_t signature;
+  uint64_t fuzzy_signature;
+  uint64_t count;               // Number of crashes in the bucket
+  uint32_t group;               // First bucket with the same fuzzy signature
+  uint32_t name;                // Offset of the first trace name
+};
+
+class CrashBucketIndex {
+ public:
+  explicit CrashBucketIndex();
+
+  // Load an index file. Return false if it is unreadable or corrupted
+  bool Load(const std::string &filename);
+
+  // Write the index to a temporary file, then rename it to filename
+  bool Save(const std::string &filename) const;
+
+  // Assign a crash to its bucket, creating the bucket (named after trace)
+  // if needed. Return the bucket id
+  uint32_t Assign(uint64_t signature, uint64_t fuzzy_signature,
+                  const std::string &trace, bool *created);
+
+  uint32_t size() const { return buckets_.size(); }
+  const bucket_record &bucket(uint32_t id) const { return buckets_[id]; }
+  const std::string &bucket_trace(uint32_t id) const { return names_[id]; }
+
+ private:
+  std::vector<bucket_record> buckets_;
+  std::vector<std::string> names_;
+  std::unordered_map<uint64_t, uint32_t> by_signature_;
+  std::unordered_map<uint64_t, uint32_t> by_fuzzy_signature_;
+};
+
+#endif  // _COMMON_BUCKET_H
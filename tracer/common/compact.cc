@@ -0,0 +1,362 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+
+#include "./compact.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "./varint.h"
+
+// New fields take the place of reserved words: the layout never changes
+static_assert(sizeof(compact_header) == 224, "compact_header layout");
+static_assert(sizeof(compact_exception) == 48, "compact_exception layout");
+
+static inline void compact_put_raw(std::string *out, const void *data,
+                                   size_t size) {
+  out->append(reinterpret_cast<const char *>(data), size);
+}
+
+CompactTraceWriter::CompactTraceWriter() {
+  memset(&header_, 0, sizeof(header_));
+  memcpy(header_.magic, COMPACT_MAGIC, COMPACT_MAGIC_SIZE);
+  header_.version = COMPACT_VERSION;
+  header_.block_edges = COMPACT_BLOCK_EDGES;
+}
+
+void CompactTraceWriter::SetHeader(uint64_t timestamp, uint32_t hash,
+                                   uint32_t flags) {
+  header_.timestamp = timestamp;
+  header_.hash = hash;
+  header_.flags = flags;
+}
+
+void CompactTraceWriter::SetCoverageHash(uint64_t coverage_hash,
+                                         uint64_t coverage_hash_buckets) {
+  header_.coverage_hash = coverage_hash;
+  header_.coverage_hash_buckets = coverage_hash_buckets;
+  header_.flags |= COMPACT_FLAG_COVERAGE_HASH;
+}
+
+void CompactTraceWriter::SetRingStats(const compact_ring_stats &ring) {
+  header_.ring = ring;
+  header_.flags |= COMPACT_FLAG_RING_STATS;
+}
+
+void CompactTraceWriter::AddImage(uint64_t base, uint64_t size,
+                                  const std::string &name) {
+  compact_image image;
+  image.base = base;
+  image.size = std::min<uint64_t>(size, UINT32_MAX);
+  image.name = strings_.size();
+  images_.push_back(image);
+
+  strings_.append(name.c_str(), name.length() + 1);
+}
+
+void CompactTraceWriter::AddException(uint32_t tid, uint32_t type,
+                                      uint32_t access, uint64_t pc,
+                                      uint64_t faulty_addr,
+                                      const std::vector<uint64_t> &frames,
+                                      uint64_t signature,
+                                      uint64_t fuzzy_signature) {
+  compact_exception exc;
+  memset(&exc, 0, sizeof(exc));
+  exc.tid = tid;
+  exc.type = type;
+  exc.access = access;
+  exc.n_frames = frames.size();
+  exc.pc = pc;
+  exc.faulty_addr = faulty_addr;
+  exc.signature = signature;
+  exc.fuzzy_signature = fuzzy_signature;
+
+  compact_put_raw(&exceptions_, &exc, sizeof(exc));
+  if (frames.size() > 0) {
+    compact_put_raw(&exceptions_, frames.data(),
+                    frames.size() * sizeof(uint64_t));
+  }
+  header_.n_exceptions++;
+}
+
+void CompactTraceWriter::AddEdge(uint64_t prev, uint64_t next, uint64_t hit) {
+  compact_edge edge = { prev, next, hit };
+  block_.push_back(edge);
+  header_.n_edges++;
+
+  if (block_.size() == COMPACT_BLOCK_EDGES) {
+    FlushBlock();
+  }
+}
+
+void CompactTraceWriter::FlushBlock() {
+  if (block_.empty()) {
+    return;
+  }
+
+  compact_block entry;
+  entry.prev = block_[0].prev;
+  entry.next = block_[0].next;
+  entry.offset = data_.size();
+  index_.push_back(entry);
+
+  for (size_t i = 1; i < block_.size(); i++) {
+    varint_put(&data_, block_[i].prev - block_[i-1].prev);
+  }
+  for (size_t i = 1; i < block_.size(); i++) {
+    varint_put(&data_, varint_zigzag(block_[i].next - block_[i-1].next));
+  }
+  for (size_t i = 0; i < block_.size(); i++) {
+    varint_put(&data_, block_[i].hit);
+  }
+
+  block_.clear();
+}
+
+bool CompactTraceWriter::Write(const std::string &filename) {
+  FlushBlock();
+
+  // Keep the string table 8-byte aligned, for the block index that follows
+  while (strings_.size() % 8 != 0) {
+    strings_.push_back('\0');
+  }
+
+  header_.n_images = images_.size();
+  header_.n_blocks = index_.size();
+  header_.images_offset = sizeof(header_);
+  header_.exceptions_offset =
+    header_.images_offset + images_.size() * sizeof(compact_image);
+  header_.strings_offset = header_.exceptions_offset + exceptions_.size();
+  header_.index_offset = header_.strings_offset + strings_.size();
+  header_.data_offset =
+    header_.index_offset + index_.size() * sizeof(compact_block);
+  header_.file_size = header_.data_offset + data_.size();
+
+  FILE *f = fopen(filename.c_str(), "wb");
+  if (f == NULL) {
+    return false;
+  }
+
+  bool ok = fwrite(&header_, sizeof(header_), 1, f) == 1;
+  if (images_.size() > 0) {
+    ok = ok && fwrite(images_.data(), sizeof(compact_image), images_.size(),
+                      f) == images_.size();
+  }
+  ok = ok && fwrite(exceptions_.data(), 1, exceptions_.size(), f) ==
+    exceptions_.size();
+  ok = ok && fwrite(strings_.data(), 1, strings_.size(), f) == strings_.size();
+  if (index_.size() > 0) {
+    ok = ok && fwrite(index_.data(), sizeof(compact_block), index_.size(),
+                      f) == index_.size();
+  }
+  ok = ok && fwrite(data_.data(), 1, data_.size(), f) == data_.size();
+
+  return (fclose(f) == 0) && ok;
+}
+
+CompactTrace::CompactTrace()
+  : mmap_(NULL), mmap_size_(0), header_(NULL), images_(NULL),
+    exceptions_(NULL), strings_(NULL), index_(NULL), data_(NULL) {
+}
+
+CompactTrace::~CompactTrace() {
+  Close();
+}
+
+bool CompactTrace::Open(const std::string &filename) {
+  Close();
+
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 ||
+      static_cast<size_t>(st.st_size) < sizeof(compact_header)) {
+    close(fd);
+    return false;
+  }
+
+  void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    return false;
+  }
+
+  mmap_ = p;
+  mmap_size_ = st.st_size;
+
+  const unsigned char *base = static_cast<const unsigned char *>(p);
+  header_ = reinterpret_cast<const compact_header *>(base);
+  images_ = reinterpret_cast<const compact_image *>(
+    base + header_->images_offset);
+  exceptions_ = base + header_->exceptions_offset;
+  strings_ = reinterpret_cast<const char *>(base + header_->strings_offset);
+  index_ = reinterpret_cast<const compact_block *>(
+    base + header_->index_offset);
+  data_ = base + header_->data_offset;
+
+  if (!Validate(mmap_size_)) {
+    Close();
+    return false;
+  }
+  return true;
+}
+
+// Check that all the sections (and all the references among them) lie
+// within the file, so that accessors never read outside the mapping
+bool CompactTrace::Validate(size_t size) const {
+  const compact_header &h = *header_;
+
+  if (memcmp(h.magic, COMPACT_MAGIC, COMPACT_MAGIC_SIZE) != 0 ||
+      h.version != COMPACT_VERSION || (h.flags & ~COMPACT_FLAGS_ALL) != 0 ||
+      h.file_size != size ||
+      h.block_edges == 0 || h.block_edges > COMPACT_BLOCK_EDGES) {
+    return false;
+  }
+
+  // Sections are contiguous and in order
+  if (h.images_offset != sizeof(h) ||
+      h.exceptions_offset !=
+      h.images_offset + static_cast<uint64_t>(h.n_images) *
+      sizeof(compact_image) ||
+      h.strings_offset < h.exceptions_offset ||
+      h.index_offset < h.strings_offset ||
+      h.index_offset % 8 != 0 ||
+      h.data_offset != h.index_offset + static_cast<uint64_t>(h.n_blocks) *
+      sizeof(compact_block) ||
+      h.data_offset > size) {
+    return false;
+  }
+
+  if (h.n_edges > static_cast<uint64_t>(h.n_blocks) * h.block_edges ||
+      (h.n_blocks > 0 &&
+       h.n_edges <= static_cast<uint64_t>(h.n_blocks - 1) * h.block_edges)) {
+    return false;
+  }
+
+  // Exception records fill their section
+  uint64_t offset = h.exceptions_offset;
+  for (uint32_t i = 0; i < h.n_exceptions; i++) {
+    if (h.strings_offset - offset < sizeof(compact_exception)) {
+      return false;
+    }
+    const compact_exception *exc = reinterpret_cast<const compact_exception *>(
+      static_cast<const unsigned char *>(mmap_) + offset);
+    offset += sizeof(compact_exception);
+    if ((h.strings_offset - offset) / sizeof(uint64_t) < exc->n_frames) {
+      return false;
+    }
+    offset += exc->n_frames * sizeof(uint64_t);
+  }
+  if (offset != h.strings_offset) {
+    return false;
+  }
+
+  // Image names are terminated within the string table
+  uint64_t strings_size = h.index_offset - h.strings_offset;
+  for (uint32_t i = 0; i < h.n_images; i++) {
+    if (images_[i].name >= strings_size ||
+        memchr(strings_ + images_[i].name, '\0',
+               strings_size - images_[i].name) == NULL) {
+      return false;
+    }
+  }
+
+  // Block offsets are sorted
+  uint64_t data_size = size - h.data_offset;
+  for (uint32_t i = 0; i < h.n_blocks; i++) {
+    if (index_[i].offset > data_size ||
+        (i > 0 && index_[i].offset < index_[i-1].offset)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void CompactTrace::Close() {
+  if (mmap_ != NULL) {
+    munmap(mmap_, mmap_size_);
+  }
+
+  mmap_ = NULL;
+  mmap_size_ = 0;
+  header_ = NULL;
+}
+
+unsigned int CompactTrace::DecodeBlock(uint32_t i, compact_edge *edges) const {
+  const compact_header &h = *header_;
+  if (i >= h.n_blocks) {
+    return 0;
+  }
+
+  uint64_t first = static_cast<uint64_t>(i) * h.block_edges;
+  unsigned int n = std::min<uint64_t>(h.block_edges, h.n_edges - first);
+
+  const unsigned char *p = data_ + index_[i].offset;
+  const unsigned char *end = (i + 1 < h.n_blocks) ?
+    data_ + index_[i+1].offset : data_ + (h.file_size - h.data_offset);
+
+  edges[0].prev = index_[i].prev;
+  edges[0].next = index_[i].next;
+
+  uint64_t value;
+  for (unsigned int j = 1; j < n; j++) {
+    if ((p = varint_get(p, end, &value)) == NULL) {
+      return 0;
+    }
+    edges[j].prev = edges[j-1].prev + value;
+  }
+  for (unsigned int j = 1; j < n; j++) {
+    if ((p = varint_get(p, end, &value)) == NULL) {
+      return 0;
+    }
+    edges[j].next = edges[j-1].next + varint_unzigzag(value);
+  }
+  for (unsigned int j = 0; j < n; j++) {
+    if ((p = varint_get(p, end, &value)) == NULL) {
+      return 0;
+    }
+    edges[j].hit = value;
+  }
+
+  return n;
+}
+
+bool CompactTrace::Find(uint64_t prev, uint64_t next, uint64_t *hit) const {
+  // Find the last block starting at or before the edge
+  const compact_block *first = index_, *last = index_ + header_->n_blocks;
+  const compact_block *it = std::upper_bound(
+    first, last, std::make_pair(prev, next),
+    [](const std::pair<uint64_t, uint64_t> &key, const compact_block &b) {
+      return key < std::make_pair(b.prev, b.next);
+    });
+  if (it == first) {
+    return false;
+  }
+
+  compact_edge edges[COMPACT_BLOCK_EDGES];
+  unsigned int n = DecodeBlock(it - first - 1, edges);
+
+  const compact_edge *e = std::lower_bound(
+    edges, edges + n, std::make_pair(prev, next),
+    [](const compact_edge &e, const std::pair<uint64_t, uint64_t> &key) {
+      return std::make_pair(e.prev, e.next) < key;
+    });
+  if (e == edges + n || e->prev != prev || e->next != next) {
+    return false;
+  }
+
+  if (hit != NULL) {
+    *hit = e->hit;
+  }
+  return true;
+}
@@ -0,0 +1,222 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Compact trace files, meant to be mmap()'ed and queried in place.
+//
+// A compact trace is made of a fixed header followed by these sections:
+// - the image table (compact_image entries), with image names stored in the
+//   string table;
+// - exception records (compact_exception, each followed by its stack trace);
+// - the string table (NUL-terminated strings);
+// - the block index (compact_block entries);
+// - edge data.
+//
+// Edges are sorted by (prev, next) and split into blocks of block_edges
+// edges. The index holds the first edge of each block, and the offset of its
+// data. Block data is made of three varint columns: prev deltas, zigzag next
+// deltas (each with respect to the previous edge of the block, starting from
+// the second one) and hit counters (starting from the first one). All
+// integers are little-endian.
+//
+// Header and exception records end with reserved (zero) words. New fields
+// take their place, with a header flag when zero is a meaningful value, so
+// that the layout, and COMPACT_VERSION, stay the same: files written before
+// a field was added simply read it as unset.
+//
+
+#ifndef _COMMON_COMPACT_H
+#define _COMMON_COMPACT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define COMPACT_MAGIC "BBTC"
+#define COMPACT_MAGIC_SIZE 4
+#define COMPACT_VERSION 1
+
+// Header flags
+#define COMPACT_FLAG_MODULE_RELATIVE 0x1   // See TraceHeader.module_relative
+#define COMPACT_FLAG_COVERAGE_HASH 0x2     // The coverage hashes are set
+#define COMPACT_FLAG_RING_STATS 0x4        // The ring statistics are set
+#define COMPACT_FLAGS_ALL                                               \
+  (COMPACT_FLAG_MODULE_RELATIVE | COMPACT_FLAG_COVERAGE_HASH |          \
+   COMPACT_FLAG_RING_STATS)
+
+// Edges per block: a block is decoded at once, on the stack
+#define COMPACT_BLOCK_EDGES 128
+
+// Same as TraceHeader.ring
+struct compact_ring_stats {
+  uint32_t pages;
+  uint32_t watermark;
+  uint64_t lost;
+  uint64_t wakeups;
+  uint64_t drains;
+  uint64_t drained_bytes;
+  uint64_t max_drain;
+};
+
+struct compact_header {
+  char magic[COMPACT_MAGIC_SIZE];
+  uint32_t version;
+  uint32_t flags;               // COMPACT_FLAG_*
+  uint32_t hash;                // Same as TraceHeader.hash
+  uint64_t timestamp;
+  uint64_t n_edges;
+  uint32_t n_images;
+  uint32_t n_exceptions;
+  uint32_t n_blocks;
+  uint32_t block_edges;
+  uint64_t images_offset;
+  uint64_t exceptions_offset;
+  uint64_t strings_offset;
+  uint64_t index_offset;
+  uint64_t data_offset;
+  uint64_t file_size;
+  uint64_t coverage_hash;       // Same as TraceHeader.coverage_hash
+  uint64_t coverage_hash_buckets;
+  compact_ring_stats ring;
+  uint32_t hang;                // Same as TraceHeader.hang
+  uint32_t reserved32;
+  uint64_t reserved[7];
+};
+
+struct compact_image {
+  uint64_t base;
+  uint32_t size;
+  uint32_t name;                // Offset in the string table
+};
+
+struct compact_exception {
+  uint32_t tid;
+  uint32_t type;                // bbtrace::Exception::ExceptionType
+  uint32_t access;              // bbtrace::Exception::ExceptionAccess
+  uint32_t n_frames;
+  uint64_t pc;
+  uint64_t faulty_addr;
+  uint64_t signature;           // Same as Exception.signature (0: none)
+  uint64_t fuzzy_signature;
+  // Followed by n_frames 64-bit return addresses
+};
+
+struct compact_block {
+  uint64_t prev;                // First edge of the block
+  uint64_t next;
+  uint64_t offset;              // Offset of block data in the data section
+};
+
+struct compact_edge {
+  uint64_t prev;
+  uint64_t next;
+  uint64_t hit;
+};
+
+// Build a compact trace in memory, then write it out at once. Only edge data
+// is encoded as it is added, so memory usage is about the size of the file
+class CompactTraceWriter {
+ public:
+  explicit CompactTraceWriter();
+
+  void SetHeader(uint64_t timestamp, uint32_t hash, uint32_t flags = 0);
+  // Set after SetHeader(), that resets the flags
+  void SetCoverageHash(uint64_t coverage_hash, uint64_t coverage_hash_buckets);
+  void SetRingStats(const compact_ring_stats &ring);
+  void SetHang(uint32_t hang) { header_.hang = hang; }
+  // Images of 4 GiB or more are stored with size 0xffffffff
+  void AddImage(uint64_t base, uint64_t size, const std::string &name);
+  void AddException(uint32_t tid, uint32_t type, uint32_t access, uint64_t pc,
+                    uint64_t faulty_addr, const std::vector<uint64_t> &frames,
+                    uint64_t signature = 0, uint64_t fuzzy_signature = 0);
+
+  // Edges must be added in (prev, next) order, without duplicates
+  void AddEdge(uint64_t prev, uint64_t next, uint64_t hit);
+
+  bool Write(const std::string &filename);
+
+ private:
+  void FlushBlock();
+
+  compact_header header_;
+  std::vector<compact_image> images_;
+  std::string exceptions_;
+  std::string strings_;
+  std::vector<compact_block> index_;
+  std::string data_;
+
+  // Edges of the current block, not encoded yet
+  std::vector<compact_edge> block_;
+};
+
+// Read-only view of a compact trace. Open() only maps the file and validates
+// its header; edges are decoded on demand, one block at a time
+class CompactTrace {
+ public:
+  explicit CompactTrace();
+  ~CompactTrace();
+
+  bool Open(const std::string &filename);
+  void Close();
+
+  const compact_header &header() const { return *header_; }
+  uint64_t size() const { return header_->n_edges; }
+
+  uint32_t n_images() const { return header_->n_images; }
+  const compact_image &image(uint32_t i) const { return images_[i]; }
+  const char *image_name(uint32_t i) const {
+    return strings_ + images_[i].name;
+  }
+
+  // Invoke f(exception, frames) for each exception record
+  template <typename F> void ForEachException(F f) const {
+    const unsigned char *p = exceptions_;
+    for (uint32_t i = 0; i < header_->n_exceptions; i++) {
+      const compact_exception *exc =
+        reinterpret_cast<const compact_exception *>(p);
+      p += sizeof(*exc);
+      f(*exc, reinterpret_cast<const uint64_t *>(p));
+      p += exc->n_frames * sizeof(uint64_t);
+    }
+  }
+
+  // Decode block i into edges (COMPACT_BLOCK_EDGES entries at most). Return
+  // the number of decoded edges, or 0 if the block is corrupt (blocks are
+  // never empty)
+  unsigned int DecodeBlock(uint32_t i, compact_edge *edges) const;
+
+  // Invoke f(edge) for each edge, in (prev, next) order. Return false, after
+  // the edges of the previous blocks, if a block is corrupt
+  template <typename F> bool ForEach(F f) const {
+    compact_edge edges[COMPACT_BLOCK_EDGES];
+    for (uint32_t i = 0; i < header_->n_blocks; i++) {
+      unsigned int n = DecodeBlock(i, edges);
+      if (n == 0) {
+        return false;
+      }
+      for (unsigned int j = 0; j < n; j++) {
+        f(edges[j]);
+      }
+    }
+    return true;
+  }
+
+  // Look up an edge through the block index, decoding a single block. Return
+  // false if the edge is not in the trace, or its block is corrupt
+  bool Find(uint64_t prev, uint64_t next, uint64_t *hit) const;
+
+ private:
+  bool Validate(size_t size) const;
+
+  void *mmap_;
+  size_t mmap_size_;
+
+  const compact_header *header_;
+  const compact_image *images_;
+  const unsigned char *exceptions_;
+  const char *strings_;
+  const compact_block *index_;
+  const unsigned char *data_;
+};
+
+#endif  // _COMMON_COMPACT_H
@@ -0,0 +1,143 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+
+#include "./covmap.h"
+
+#include <fcntl.h>
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+
+// Map a saturated 8-bit hit counter to its AFL bucket
+static unsigned char count_class_lookup[256];
+
+static void init_count_class_lookup() {
+  for (int i = 0; i < 256; i++) {
+    unsigned char bucket;
+    if (i <= 3) {
+      bucket = (i == 3) ? 4 : i;
+    } else if (i <= 7) {
+      bucket = 8;
+    } else if (i <= 15) {
+      bucket = 16;
+    } else if (i <= 31) {
+      bucket = 32;
+    } else if (i <= 127) {
+      bucket = 64;
+    } else {
+      bucket = 128;
+    }
+    count_class_lookup[i] = bucket;
+  }
+}
+
+CoverageBitmap::CoverageBitmap()
+  : map_(NULL), size_(0), mask_(0), sysv_(false) {
+}
+
+CoverageBitmap::~CoverageBitmap() {
+  Detach();
+}
+
+bool CoverageBitmap::Attach(const std::string &name, unsigned int size) {
+  if (size == 0 || (size & (size - 1)) != 0) {
+    LOG_WARN("Coverage bitmap size %u is not a power of two", size);
+    return false;
+  }
+
+  void *map;
+  if (name.length() > 0 && name[0] == '/') {
+    // POSIX shared memory object
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+    if (fd == -1) {
+      LOG_WARN("Cannot open shared memory object '%s'", name.c_str());
+      return false;
+    }
+
+    if (ftruncate(fd, size) == -1) {
+      LOG_WARN("Cannot resize shared memory object '%s'", name.c_str());
+      close(fd);
+      return false;
+    }
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+      LOG_WARN("Cannot map shared memory object '%s'", name.c_str());
+      return false;
+    }
+    sysv_ = false;
+  } else {
+    // SysV shared memory segment
+    char *end;
+    int shmid = strtol(name.c_str(), &end, 10);
+    if (name.length() == 0 || *end != '\0') {
+      LOG_WARN("Invalid shared memory identifier '%s'", name.c_str());
+      return false;
+    }
+
+    struct shmid_ds ds;
+    if (shmctl(shmid, IPC_STAT, &ds) == -1 || ds.shm_segsz < size) {
+      LOG_WARN("Shared memory segment %d is missing or too small", shmid);
+      return false;
+    }
+
+    map = shmat(shmid, NULL, 0);
+    if (map == reinterpret_cast<void*>(-1)) {
+      LOG_WARN("Cannot attach shared memory segment %d", shmid);
+      return false;
+    }
+    sysv_ = true;
+  }
+
+  if (count_class_lookup[4] == 0) {
+    init_count_class_lookup();
+  }
+
+  map_ = static_cast<unsigned char*>(map);
+  size_ = size;
+  mask_ = size - 1;
+  return true;
+}
+
+void CoverageBitmap::Detach() {
+  if (map_ == NULL) {
+    return;
+  }
+
+  if (sysv_) {
+    shmdt(map_);
+  } else {
+    munmap(map_, size_);
+  }
+  map_ = NULL;
+}
+
+void CoverageBitmap::Clear() {
+  memset(map_, 0, size_);
+}
+
+void CoverageBitmap::Classify() {
+  // Most of the bitmap is zero: skip 8 bytes at a time
+  const uint64_t *words = reinterpret_cast<const uint64_t*>(map_);
+  for (unsigned int i = 0; i < size_ / sizeof(uint64_t); i++) {
+    if (words[i] == 0) {
+      continue;
+    }
+
+    unsigned char *bytes = map_ + i * sizeof(uint64_t);
+    for (unsigned int j = 0; j < sizeof(uint64_t); j++) {
+      bytes[j] = count_class_lookup[bytes[j]];
+    }
+  }
+
+  // Tail, for bitmaps smaller than a word
+  for (unsigned int i = size_ & ~(sizeof(uint64_t) - 1); i < size_; i++) {
+    map_[i] = count_class_lookup[map_[i]];
+  }
+}
@@ -0,0 +1,56 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// AFL-compatible coverage bitmap, living in a shared memory segment.
+//
+
+#ifndef _COMMON_COVMAP_H
+#define _COMMON_COVMAP_H
+
+#include <string>
+
+#include "./common.h"
+
+class CoverageBitmap {
+ public:
+  explicit CoverageBitmap();
+  ~CoverageBitmap();
+
+  // Attach to the shared memory segment named by the caller. A numeric name
+  // is interpreted as a SysV shared memory identifier (e.g., the value of
+  // AFL's __AFL_SHM_ID), while names starting with '/' identify a POSIX
+  // shared memory object (created if it does not exist). The size must be a
+  // power of two. Return false on failure.
+  bool Attach(const std::string &name, unsigned int size);
+  void Detach();
+
+  bool attached() const { return map_ != NULL; }
+  unsigned int size() const { return size_; }
+
+  // Record the execution of a CFG edge, using saturating 8-bit counters
+  inline void AddEdge(target_addr prev, target_addr next,
+                      unsigned int hit = 1) {
+    unsigned int idx = ((hash_addr(prev) >> 1) ^ hash_addr(next)) & mask_;
+    map_[idx] = hit < 0xffu - map_[idx] ? map_[idx] + hit : 0xff;
+  }
+
+  // Zero the whole bitmap
+  void Clear();
+
+  // Replace raw hit counters with AFL-style hit-count buckets (1, 2, 3, 4-7,
+  // 8-15, 16-31, 32-127, 128+). To be invoked once, at the end of a run
+  void Classify();
+
+ private:
+  static inline unsigned int hash_addr(target_addr addr) {
+    uint64_t h = static_cast<uint64_t>(addr) * 0x9e3779b97f4a7c15ULL;
+    return static_cast<unsigned int>(h >> 32);
+  }
+
+  unsigned char *map_;
+  unsigned int size_;
+  unsigned int mask_;
+  bool sysv_;
+};
+
+#endif  // _COMMON_COVMAP_H
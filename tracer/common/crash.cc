@@ -0,0 +1,79 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+
+#include "./crash.h"
+
+// 64-bit FNV-1a
+static const uint64_t CRASH_HASH_INIT = 0xcbf29ce484222325ULL;
+
+static inline uint64_t crash_hash(uint64_t h, const void *data, size_t size) {
+  const unsigned char *p = static_cast<const unsigned char *>(data);
+  for (size_t i = 0; i < size; i++) {
+    h = (h ^ p[i]) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static inline uint64_t crash_hash_u64(uint64_t h, uint64_t value) {
+  return crash_hash(h, &value, sizeof(value));
+}
+
+CrashNormalizer::CrashNormalizer(const std::vector<MemoryRegion> &regions) {
+  index_.Build(regions);
+  for (size_t i = 0; i < index_.n_modules(); i++) {
+    const std::string &name = index_.module(i);
+    size_t slash = name.rfind('/');
+    names_.push_back(slash == std::string::npos ?
+                     name : name.substr(slash + 1));
+  }
+}
+
+uint64_t CrashNormalizer::HashLocation(uint64_t h, target_addr addr) const {
+  size_t module;
+  uint32_t offset;
+  if (!index_.LookupModule(addr, &module, &offset)) {
+    return crash_hash(h, "?", 1);
+  }
+
+  // Include the terminator, so that name and offset cannot be confused
+  h = crash_hash(h, names_[module].c_str(), names_[module].length() + 1);
+  return crash_hash_u64(h, offset);
+}
+
+void CrashNormalizer::Sign(uint32_t type, uint32_t access, target_addr pc,
+                           const std::vector<target_addr> &frames,
+                           uint64_t *signature,
+                           uint64_t *fuzzy_signature) const {
+  uint64_t fuzzy = crash_hash_u64(CRASH_HASH_INIT, type);
+  fuzzy = HashLocation(fuzzy, pc);
+  for (size_t i = 0; i + 1 < CRASH_FUZZY_FRAMES && i < frames.size(); i++) {
+    fuzzy = HashLocation(fuzzy, frames[i]);
+  }
+
+  uint64_t exact = crash_hash_u64(crash_hash_u64(CRASH_HASH_INIT, type),
+                                  access);
+  exact = HashLocation(exact, pc);
+  for (size_t i = 0; i < frames.size(); i++) {
+    exact = HashLocation(exact, frames[i]);
+  }
+
+  // Zero stands for "no signature"
+  *signature = exact ? exact : 1;
+  *fuzzy_signature = fuzzy ? fuzzy : 1;
+}
+
+void crash_sign_trace(ExecutionTrace *execution_trace) {
+  if (execution_trace->exceptions.empty()) {
+    return;
+  }
+
+  CrashNormalizer normalizer(execution_trace->memory_regions);
+  for (exceptions_iterator it = execution_trace->exceptions.begin();
+       it != execution_trace->exceptions.end(); it++) {
+    uint64_t signature, fuzzy_signature;
+    normalizer.Sign((*it)->type(), (*it)->faulty_type(), (*it)->pc(),
+                    (*it)->stacktrace(), &signature, &fuzzy_signature);
+    (*it)->set_signatures(signature, fuzzy_signature);
+  }
+}
@@ -0,0 +1,50 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Crash signatures, to group crashes with the same root cause.
+//
+// Signatures are 64-bit hashes of the exception type and of the locations of
+// its stack frames (the faulting pc first, then the return addresses). Each
+// location is normalized to the base name of the module it belongs to, and
+// an offset within it, so that signatures do not depend on where modules are
+// loaded; addresses outside of any module only contribute a placeholder.
+// The exact signature also covers the access type and the whole stack trace,
+// the fuzzy one only the top CRASH_FUZZY_FRAMES frames, so that crashes that
+// reach the same faulting code through different paths share it.
+//
+
+#ifndef _COMMON_CRASH_H
+#define _COMMON_CRASH_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "./common.h"
+#include "./regions.h"
+#include "./serialize.h"
+
+#define CRASH_FUZZY_FRAMES 3
+
+class CrashNormalizer {
+ public:
+  explicit CrashNormalizer(const std::vector<MemoryRegion> &regions);
+
+  // Compute the signatures of an exception. Types and access types are
+  // those of Exception (equal to their protobuf values)
+  void Sign(uint32_t type, uint32_t access, target_addr pc,
+            const std::vector<target_addr> &frames, uint64_t *signature,
+            uint64_t *fuzzy_signature) const;
+
+ private:
+  uint64_t HashLocation(uint64_t h, target_addr addr) const;
+
+  RegionIndex index_;
+  std::vector<std::string> names_;
+};
+
+// Compute the signatures of all the exceptions of an execution trace,
+// against its memory regions
+void crash_sign_trace(ExecutionTrace *execution_trace);
+
+#endif  // _COMMON_CRASH_H
@@ -38,6 +38,14 @@ class Exception {
   target_addr faulty_addr() const { return faulty_addr_; }
   int faulty_type() const { return faulty_type_; }
 
+  // Crash signatures (see crash.h), zero until computed
+  uint64_t signature() const { return signature_; }
+  uint64_t fuzzy_signature() const { return fuzzy_signature_; }
+  void set_signatures(uint64_t signature, uint64_t fuzzy_signature) {
+    signature_ = signature;
+    fuzzy_signature_ = fuzzy_signature;
+  }
+
   // Push a new entry to the stack trace
   void stacktrace_push(target_addr addr) {
     stacktrace_.push_back(addr);
@@ -45,6 +53,7 @@ class Exception {
 
   stacktrace_iterator stacktrace_begin() const { return stacktrace_.begin(); }
   stacktrace_iterator stacktrace_end() const { return stacktrace_.end(); }
+  const std::vector<target_addr> &stacktrace() const { return stacktrace_; }
 
  private:
   int tid_;                       // Thread ID
@@ -53,6 +62,8 @@ class Exception {
   target_addr faulty_addr_;       // Faulty address
   int faulty_type_;               // Type of faulty access
   std::vector<target_addr> stacktrace_;  // Stack trace (list of retaddr)
+  uint64_t signature_;            // Exact crash signature
+  uint64_t fuzzy_signature_;      // Signature of the top stack frames
 };
 
 typedef std::vector<std::shared_ptr<Exception> > exceptions_list;
@@ -0,0 +1,218 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+
+#include "./filter.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+
+// Sort ranges and merge the overlapping (or adjacent) ones
+static void filter_normalize(std::vector<filter_range> *ranges) {
+  std::sort(ranges->begin(), ranges->end(),
+            [](const filter_range &a, const filter_range &b) {
+              return a.start < b.start;
+            });
+
+  size_t n = 0;
+  for (size_t i = 0; i < ranges->size(); i++) {
+    const filter_range &r = (*ranges)[i];
+    if (n > 0 && (*ranges)[n-1].end != std::numeric_limits<target_addr>::max()
+        && r.start <= (*ranges)[n-1].end + 1) {
+      (*ranges)[n-1].end = std::max((*ranges)[n-1].end, r.end);
+    } else {
+      (*ranges)[n++] = r;
+    }
+  }
+  ranges->resize(n);
+}
+
+// Remove normalized ranges excluded from normalized ranges included
+static std::vector<filter_range>
+filter_subtract(const std::vector<filter_range> &included,
+                const std::vector<filter_range> &excluded) {
+  std::vector<filter_range> result;
+  size_t j = 0;
+
+  for (size_t i = 0; i < included.size(); i++) {
+    filter_range r = included[i];
+
+    // Skip exclusions entirely before r
+    while (j < excluded.size() && excluded[j].end < r.start) {
+      j++;
+    }
+
+    bool consumed = false;
+    for (size_t k = j; k < excluded.size() && excluded[k].start <= r.end;
+         k++) {
+      if (excluded[k].start > r.start) {
+        filter_range head = { r.start, excluded[k].start - 1 };
+        result.push_back(head);
+      }
+      if (excluded[k].end >= r.end) {
+        consumed = true;
+        break;
+      }
+      r.start = excluded[k].end + 1;
+    }
+
+    if (!consumed) {
+      result.push_back(r);
+    }
+  }
+
+  return result;
+}
+
+AddressFilter::AddressFilter()
+  : include_all_images_(false), enabled_(false), persistent_images_(0),
+    table_(NULL), retired_pending_(false), readers_(0) {
+}
+
+AddressFilter::~AddressFilter() {
+}
+
+bool AddressFilter::AddRule(bool include, const std::string &rule) {
+  size_t dash = rule.find('-');
+  if (dash == std::string::npos || rule.compare(0, 2, "0x") != 0) {
+    AddImageRule(include, rule);
+    return true;
+  }
+
+  char *end;
+  const char *s = rule.c_str();
+  target_addr start = strtoull(s, &end, 16);
+  if (end != s + dash) {
+    return false;
+  }
+  target_addr last = strtoull(s + dash + 1, &end, 16);
+  if (*end != '\0' || last < start) {
+    return false;
+  }
+
+  AddRangeRule(include, start, last);
+  return true;
+}
+
+void AddressFilter::AddImageRule(bool include, const std::string &name) {
+  std::lock_guard<std::mutex> lock(lock_);
+  (include ? include_images_ : exclude_images_).push_back(name);
+  enabled_ = true;
+  Rebuild();
+}
+
+void AddressFilter::AddRangeRule(bool include, target_addr start,
+                                 target_addr end) {
+  std::lock_guard<std::mutex> lock(lock_);
+  filter_range range = { start, end };
+  (include ? include_ranges_ : exclude_ranges_).push_back(range);
+  enabled_ = true;
+  Rebuild();
+}
+
+void AddressFilter::IncludeAllImages() {
+  std::lock_guard<std::mutex> lock(lock_);
+  include_all_images_ = true;
+  enabled_ = true;
+  Rebuild();
+}
+
+void AddressFilter::AddImage(target_addr base, target_addr size,
+                             const std::string &name) {
+  if (!enabled_ || size == 0) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(lock_);
+  filter_image image = { base, size, name };
+  images_.push_back(image);
+
+  // Images that no rule is about cannot change the table
+  if (include_all_images_ || MatchImage(include_images_, name) ||
+      MatchImage(exclude_images_, name)) {
+    Rebuild();
+  }
+}
+
+void AddressFilter::Checkpoint() {
+  std::lock_guard<std::mutex> lock(lock_);
+  persistent_images_ = images_.size();
+}
+
+void AddressFilter::Reset() {
+  std::lock_guard<std::mutex> lock(lock_);
+  images_.resize(persistent_images_);
+
+  if (enabled_) {
+    Rebuild();
+  }
+}
+
+void AddressFilter::Reclaim() const {
+  std::lock_guard<std::mutex> lock(lock_);
+  ReclaimLocked();
+}
+
+void AddressFilter::ReclaimLocked() const {
+  // Readers started from now on load the current table: if none is active,
+  // no one holds a retired one
+  if (retired_.empty() || readers_.load() != 0) {
+    return;
+  }
+  retired_.clear();
+  retired_pending_ = false;
+}
+
+bool AddressFilter::MatchImage(const std::vector<std::string> &names,
+                               const std::string &name) const {
+  size_t slash = name.rfind('/');
+  std::string basename =
+    (slash == std::string::npos) ? name : name.substr(slash + 1);
+
+  for (size_t i = 0; i < names.size(); i++) {
+    if (names[i] == name || names[i] == basename) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Compute the table of interesting ranges and publish it. lock_ must be held
+void AddressFilter::Rebuild() {
+  std::vector<filter_range> included(include_ranges_), excluded(
+    exclude_ranges_);
+
+  for (size_t i = 0; i < images_.size(); i++) {
+    filter_range range = { images_[i].base,
+                           images_[i].base + images_[i].size - 1 };
+    if (MatchImage(include_images_, images_[i].name) ||
+        (include_all_images_ && include_images_.empty() &&
+         include_ranges_.empty())) {
+      included.push_back(range);
+    }
+    if (MatchImage(exclude_images_, images_[i].name)) {
+      excluded.push_back(range);
+    }
+  }
+
+  // Without include rules, everything is included
+  if (include_images_.empty() && include_ranges_.empty() &&
+      !include_all_images_) {
+    filter_range all = { 0, std::numeric_limits<target_addr>::max() };
+    included.push_back(all);
+  }
+
+  filter_normalize(&included);
+  filter_normalize(&excluded);
+
+  std::unique_ptr<std::vector<filter_range> > table(
+    new std::vector<filter_range>(filter_subtract(included, excluded)));
+  table_.store(table.get());
+  if (current_ != NULL) {
+    retired_.push_back(std::move(current_));
+    retired_pending_ = true;
+  }
+  current_ = std::move(table);
+  ReclaimLocked();
+}
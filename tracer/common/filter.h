@@ -0,0 +1,142 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Address filter: decide which code addresses are worth tracing, according to
+// include/exclude rules on image names and address ranges.
+//
+
+#ifndef _COMMON_FILTER_H
+#define _COMMON_FILTER_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "./common.h"
+
+// An inclusive address range
+struct filter_range {
+  target_addr start;
+  target_addr end;
+};
+
+// Addresses are interesting if they belong to an included range (or to any
+// range, if there are no include rules) and do not belong to an excluded one.
+// Image rules match either the full path or the base name of an image, and
+// apply to the images reported through AddImage().
+//
+// Interesting addresses are kept in a sorted array of disjoint ranges, that
+// is rebuilt whenever rules or images change. Lookups are lock-free and can
+// run concurrently with AddImage(), that publishes a new array and retires
+// the old one, as long as they are made within a Reader. Retired arrays are
+// released as soon as no Reader is active
+class AddressFilter {
+ public:
+  explicit AddressFilter();
+  ~AddressFilter();
+
+  // Read-side section, around a batch of lookups (filter can be NULL)
+  class Reader {
+   public:
+    explicit Reader(const AddressFilter *filter) : filter_(filter) {
+      if (filter_ != NULL) {
+        filter_->readers_.fetch_add(1);
+      }
+    }
+    ~Reader() {
+      if (filter_ != NULL && filter_->readers_.fetch_sub(1) == 1 &&
+          filter_->retired_pending_.load()) {
+        filter_->Reclaim();
+      }
+    }
+
+   private:
+    const AddressFilter *filter_;
+  };
+
+  // Add a rule: "START-END" (hexadecimal, inclusive) is an address range,
+  // anything else is an image name. Return false for a malformed range
+  bool AddRule(bool include, const std::string &rule);
+  void AddImageRule(bool include, const std::string &name);
+  void AddRangeRule(bool include, target_addr start, target_addr end);
+
+  // Without include rules, include all the images rather than all the
+  // addresses
+  void IncludeAllImages();
+
+  // Notify a newly mapped image
+  void AddImage(target_addr base, target_addr size, const std::string &name);
+
+  // Mark the images reported so far as persistent, and forget any other
+  // image (see monitor_checkpoint() and monitor_reset())
+  void Checkpoint();
+  void Reset();
+
+  // True if the filter has any rule, i.e., if it can drop any address
+  bool enabled() const { return enabled_.load(); }
+
+  bool IsInteresting(target_addr addr) const {
+    // Sequentially consistent, like the updates of readers_ (a plain load on
+    // x86): a Reader started after a table is retired cannot see it
+    const std::vector<filter_range> *table = table_.load();
+    if (table == NULL) {
+      return true;
+    }
+
+    if (table->empty()) {
+      return false;
+    }
+
+    // Find the last range starting at or before addr (if any). The loop
+    // compiles to conditional moves, as lookups are hard to predict
+    const filter_range *base = table->data();
+    size_t n = table->size();
+    while (n > 1) {
+      size_t half = n / 2;
+      base = (base[half].start <= addr) ? base + half : base;
+      n -= half;
+    }
+    return base->start <= addr && addr <= base->end;
+  }
+
+ private:
+  struct filter_image {
+    target_addr base;
+    target_addr size;
+    std::string name;
+  };
+
+  bool MatchImage(const std::vector<std::string> &names,
+                  const std::string &name) const;
+  void Rebuild();
+
+  // Release the retired tables, unless a Reader is active. lock_ must be
+  // held by ReclaimLocked()
+  void Reclaim() const;
+  void ReclaimLocked() const;
+
+  std::vector<std::string> include_images_, exclude_images_;
+  std::vector<filter_range> include_ranges_, exclude_ranges_;
+  bool include_all_images_;
+  std::atomic<bool> enabled_;
+
+  std::vector<filter_image> images_;
+  size_t persistent_images_;
+
+  // Current table of interesting ranges (NULL: everything is interesting),
+  // and the tables that have been replaced but may still be in use
+  std::atomic<const std::vector<filter_range> *> table_;
+  std::unique_ptr<std::vector<filter_range> > current_;
+  mutable std::vector<std::unique_ptr<std::vector<filter_range> > > retired_;
+  mutable std::atomic<bool> retired_pending_;
+
+  // Active Readers
+  mutable std::atomic<int> readers_;
+
+  // Serializes updates
+  mutable std::mutex lock_;
+};
+
+#endif  // _COMMON_FILTER_H
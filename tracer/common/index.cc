@@ -0,0 +1,260 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+
+#include "./index.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+InvertedIndexWriter::InvertedIndexWriter() {
+}
+
+bool InvertedIndexWriter::AddIndex(const InvertedIndex &index) {
+  for (uint32_t id = 0; id < index.n_traces(); id++) {
+    names_.push_back(index.trace_name(id));
+    trace_edges_.push_back(index.trace(id).n_edges);
+  }
+
+  for (uint64_t i = 0; i < index.n_edges(); i++) {
+    const index_edge &edge = index.edge(i);
+    bool ok = index.ForEachPosting(edge, [&](uint32_t id) {
+        AddPosting(edge.prev, edge.next, id);
+      });
+    if (!ok) {
+      return false;
+    }
+  }
+  return true;
+}
+
+uint32_t InvertedIndexWriter::AddTrace(const std::string &name,
+                                       const std::vector<compact_edge> &edges) {
+  uint32_t id = names_.size();
+  names_.push_back(name);
+  trace_edges_.push_back(edges.size());
+
+  for (size_t i = 0; i < edges.size(); i++) {
+    AddPosting(edges[i].prev, edges[i].next, id);
+  }
+  return id;
+}
+
+void InvertedIndexWriter::AddPosting(uint64_t prev, uint64_t next,
+                                     uint32_t id) {
+  posting &p = postings_[std::make_pair(prev, next)];
+  varint_put(&p.data, id - (p.count > 0 ? p.last : 0));
+  p.last = id;
+  p.count++;
+}
+
+bool InvertedIndexWriter::Write(const std::string &filename) const {
+  index_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, INDEX_MAGIC, INDEX_MAGIC_SIZE);
+  header.version = INDEX_VERSION;
+  header.n_traces = names_.size();
+  header.n_edges = postings_.size();
+
+  std::vector<index_trace> traces(names_.size());
+  std::string strings;
+  for (size_t i = 0; i < names_.size(); i++) {
+    traces[i].name = strings.size();
+    traces[i].n_edges = trace_edges_[i];
+    strings.append(names_[i].c_str(), names_[i].length() + 1);
+  }
+
+  // Keep the string table 8-byte aligned, for the edge table that follows
+  while (strings.size() % 8 != 0) {
+    strings.push_back('\0');
+  }
+
+  typedef std::unordered_map<std::pair<uint64_t, uint64_t>, posting,
+                             edge_hash>::const_iterator posting_iterator;
+  std::vector<posting_iterator> sorted;
+  sorted.reserve(postings_.size());
+  for (posting_iterator it = postings_.begin(); it != postings_.end(); it++) {
+    sorted.push_back(it);
+  }
+  std::sort(sorted.begin(), sorted.end(),
+            [](const posting_iterator &a, const posting_iterator &b) {
+              return a->first < b->first;
+            });
+
+  std::vector<index_edge> edges(sorted.size());
+  uint64_t offset = 0;
+  for (size_t i = 0; i < sorted.size(); i++) {
+    edges[i].prev = sorted[i]->first.first;
+    edges[i].next = sorted[i]->first.second;
+    edges[i].offset = offset;
+    edges[i].count = sorted[i]->second.count;
+    edges[i].reserved = 0;
+    offset += sorted[i]->second.data.size();
+  }
+
+  header.traces_offset = sizeof(header);
+  header.strings_offset =
+    header.traces_offset + traces.size() * sizeof(index_trace);
+  header.edges_offset = header.strings_offset + strings.size();
+  header.postings_offset =
+    header.edges_offset + edges.size() * sizeof(index_edge);
+  header.file_size = header.postings_offset + offset;
+
+  std::string tmpname = filename + ".tmp";
+  FILE *f = fopen(tmpname.c_str(), "wb");
+  if (f == NULL) {
+    return false;
+  }
+
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+  if (traces.size() > 0) {
+    ok = ok && fwrite(traces.data(), sizeof(index_trace), traces.size(), f) ==
+      traces.size();
+  }
+  ok = ok && fwrite(strings.data(), 1, strings.size(), f) == strings.size();
+  if (edges.size() > 0) {
+    ok = ok && fwrite(edges.data(), sizeof(index_edge), edges.size(), f) ==
+      edges.size();
+  }
+  for (size_t i = 0; ok && i < sorted.size(); i++) {
+    const std::string &data = sorted[i]->second.data;
+    ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+  }
+
+  ok = (fclose(f) == 0) && ok;
+  if (!ok || rename(tmpname.c_str(), filename.c_str()) == -1) {
+    unlink(tmpname.c_str());
+    return false;
+  }
+  return true;
+}
+
+InvertedIndex::InvertedIndex()
+  : mmap_(NULL), mmap_size_(0), header_(NULL), traces_(NULL), strings_(NULL),
+    edges_(NULL), postings_(NULL) {
+}
+
+InvertedIndex::~InvertedIndex() {
+  Close();
+}
+
+bool InvertedIndex::Open(const std::string &filename) {
+  Close();
+
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 ||
+      static_cast<size_t>(st.st_size) < sizeof(index_header)) {
+    close(fd);
+    return false;
+  }
+
+  void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    return false;
+  }
+
+  mmap_ = p;
+  mmap_size_ = st.st_size;
+
+  const unsigned char *base = static_cast<const unsigned char *>(p);
+  header_ = reinterpret_cast<const index_header *>(base);
+  traces_ =
+    reinterpret_cast<const index_trace *>(base + header_->traces_offset);
+  strings_ = reinterpret_cast<const char *>(base + header_->strings_offset);
+  edges_ = reinterpret_cast<const index_edge *>(base + header_->edges_offset);
+  postings_ = base + header_->postings_offset;
+
+  if (!Validate(mmap_size_)) {
+    Close();
+    return false;
+  }
+  return true;
+}
+
+// Check that all the sections (and all the references among them) lie
+// within the file. Posting lists are checked as they are decoded
+bool InvertedIndex::Validate(size_t size) const {
+  const index_header &h = *header_;
+
+  if (memcmp(h.magic, INDEX_MAGIC, INDEX_MAGIC_SIZE) != 0 ||
+      h.version != INDEX_VERSION || h.file_size != size) {
+    return false;
+  }
+
+  // Sections are contiguous and in order
+  if (h.traces_offset != sizeof(h) ||
+      h.strings_offset !=
+      h.traces_offset + static_cast<uint64_t>(h.n_traces) *
+      sizeof(index_trace) ||
+      h.edges_offset < h.strings_offset ||
+      h.edges_offset % 8 != 0 ||
+      h.n_edges > size / sizeof(index_edge) ||
+      h.postings_offset != h.edges_offset + h.n_edges * sizeof(index_edge) ||
+      h.postings_offset > size) {
+    return false;
+  }
+
+  // Trace names are terminated within the string table
+  uint64_t strings_size = h.edges_offset - h.strings_offset;
+  for (uint32_t i = 0; i < h.n_traces; i++) {
+    if (traces_[i].name >= strings_size ||
+        memchr(strings_ + traces_[i].name, '\0',
+               strings_size - traces_[i].name) == NULL) {
+      return false;
+    }
+  }
+
+  // Posting offsets are sorted
+  uint64_t postings_size = size - h.postings_offset;
+  for (uint64_t i = 0; i < h.n_edges; i++) {
+    if (edges_[i].offset > postings_size ||
+        (i > 0 && edges_[i].offset < edges_[i-1].offset)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void InvertedIndex::Close() {
+  if (mmap_ != NULL) {
+    munmap(mmap_, mmap_size_);
+  }
+
+  mmap_ = NULL;
+  mmap_size_ = 0;
+  header_ = NULL;
+}
+
+const unsigned char *InvertedIndex::PostingsEnd(const index_edge &edge) const {
+  uint64_t i = &edge - edges_;
+  if (i + 1 < header_->n_edges) {
+    return postings_ + edges_[i+1].offset;
+  }
+  return postings_ + (header_->file_size - header_->postings_offset);
+}
+
+const index_edge *InvertedIndex::Find(uint64_t prev, uint64_t next) const {
+  const index_edge *first = edges_, *last = edges_ + header_->n_edges;
+  const index_edge *it = std::lower_bound(
+    first, last, std::make_pair(prev, next),
+    [](const index_edge &e, const std::pair<uint64_t, uint64_t> &key) {
+      return std::make_pair(e.prev, e.next) < key;
+    });
+
+  if (it == last || it->prev != prev || it->next != next) {
+    return NULL;
+  }
+  return it;
+}
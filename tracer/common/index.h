@@ -0,0 +1,162 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Inverted coverage index: for each CFG edge, the traces that hit it. Index
+// files are meant to be mmap()'ed and queried in place.
+//
+// An index file is made of a fixed header followed by these sections:
+// - the trace table (index_trace entries, one per trace id), with trace names
+//   stored in the string table;
+// - the string table (NUL-terminated strings);
+// - the edge table (index_edge entries), sorted by (prev, next);
+// - posting lists, in the same order as the edge table. The posting list of
+//   an edge holds the increasing ids of the traces that hit it, as varint
+//   deltas (the first one with respect to zero).
+// All integers are little-endian.
+//
+
+#ifndef _COMMON_INDEX_H
+#define _COMMON_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "./compact.h"
+#include "./varint.h"
+
+#define INDEX_MAGIC "BBTI"
+#define INDEX_MAGIC_SIZE 4
+#define INDEX_VERSION 1
+
+struct index_header {
+  char magic[INDEX_MAGIC_SIZE];
+  uint32_t version;
+  uint32_t n_traces;
+  uint32_t reserved;
+  uint64_t n_edges;
+  uint64_t traces_offset;
+  uint64_t strings_offset;
+  uint64_t edges_offset;
+  uint64_t postings_offset;
+  uint64_t file_size;
+};
+
+struct index_trace {
+  uint32_t name;                // Offset in the string table
+  uint32_t n_edges;
+};
+
+struct index_edge {
+  uint64_t prev;
+  uint64_t next;
+  uint64_t offset;              // Offset of the posting list
+  uint32_t count;               // Number of traces that hit the edge
+  uint32_t reserved;
+};
+
+class InvertedIndex;
+
+// Build an index in memory, then write it out at once. Posting lists are
+// kept compressed while they are built
+class InvertedIndexWriter {
+ public:
+  explicit InvertedIndexWriter();
+
+  // Add all the traces of an existing index. Must be invoked before adding
+  // any other trace. Return false if the index is corrupted
+  bool AddIndex(const InvertedIndex &index);
+
+  // Add a trace, given its unique edges, and return its id
+  uint32_t AddTrace(const std::string &name,
+                    const std::vector<compact_edge> &edges);
+
+  uint32_t n_traces() const { return names_.size(); }
+
+  // Write the index to a temporary file, then rename it to filename
+  bool Write(const std::string &filename) const;
+
+ private:
+  struct posting {
+    std::string data;
+    uint32_t last;
+    uint32_t count;
+  };
+
+  struct edge_hash {
+    size_t operator()(const std::pair<uint64_t, uint64_t> &e) const {
+      uint64_t h = e.first * 0x9e3779b97f4a7c15ULL;
+      h ^= e.second + (h << 6) + (h >> 2);
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdULL;
+      h ^= h >> 33;
+      return static_cast<size_t>(h);
+    }
+  };
+
+  void AddPosting(uint64_t prev, uint64_t next, uint32_t id);
+
+  std::vector<std::string> names_;
+  std::vector<uint32_t> trace_edges_;
+  std::unordered_map<std::pair<uint64_t, uint64_t>, posting, edge_hash>
+    postings_;
+};
+
+// Read-only view of an index file
+class InvertedIndex {
+ public:
+  explicit InvertedIndex();
+  ~InvertedIndex();
+
+  bool Open(const std::string &filename);
+  void Close();
+
+  const index_header &header() const { return *header_; }
+
+  uint32_t n_traces() const { return header_->n_traces; }
+  const index_trace &trace(uint32_t id) const { return traces_[id]; }
+  const char *trace_name(uint32_t id) const {
+    return strings_ + traces_[id].name;
+  }
+
+  uint64_t n_edges() const { return header_->n_edges; }
+  const index_edge &edge(uint64_t i) const { return edges_[i]; }
+
+  // Look up an edge. Return NULL if no trace hit it
+  const index_edge *Find(uint64_t prev, uint64_t next) const;
+
+  // Invoke f(id) for each trace that hit edge, in increasing id order.
+  // Return false if the posting list is corrupted
+  template <typename F> bool ForEachPosting(const index_edge &edge,
+                                            F f) const {
+    const unsigned char *p = postings_ + edge.offset;
+    const unsigned char *end = PostingsEnd(edge);
+    uint64_t id = 0, delta;
+
+    for (uint32_t i = 0; i < edge.count; i++) {
+      if ((p = varint_get(p, end, &delta)) == NULL ||
+          (id += delta) >= header_->n_traces) {
+        return false;
+      }
+      f(static_cast<uint32_t>(id));
+    }
+    return true;
+  }
+
+ private:
+  bool Validate(size_t size) const;
+  const unsigned char *PostingsEnd(const index_edge &edge) const;
+
+  void *mmap_;
+  size_t mmap_size_;
+
+  const index_header *header_;
+  const index_trace *traces_;
+  const char *strings_;
+  const index_edge *edges_;
+  const unsigned char *postings_;
+};
+
+#endif  // _COMMON_INDEX_H
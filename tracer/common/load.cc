@@ -0,0 +1,333 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+
+#include "./load.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <set>
+
+#include "./stream.h"
+
+static bool load_trace_stream(const std::string &filename,
+                              bbtrace::Trace *trace, bool edges = true) {
+  TraceStreamReader reader;
+  bbtrace::TraceChunk chunk;
+
+  if (!reader.Open(filename)) {
+    return false;
+  }
+
+  while (reader.Next(&chunk)) {
+    if (chunk.has_header()) {
+      *trace->mutable_header() = chunk.header();
+    }
+    if (edges) {
+      trace->mutable_edge()->MergeFrom(chunk.edge());
+      trace->mutable_task()->MergeFrom(chunk.task());
+    }
+    trace->mutable_exception()->MergeFrom(chunk.exception());
+    trace->mutable_region()->MergeFrom(chunk.region());
+  }
+
+  // A truncated stream lacks coverage: it is not a valid trace
+  return !reader.error() && trace->has_header();
+}
+
+static bool load_trace_compact(const CompactTrace &compact,
+                               bbtrace::Trace *trace, bool edges = true) {
+  bbtrace::TraceHeader *header = trace->mutable_header();
+  header->set_magic(bbtrace::TraceHeader::TRACE_MAGIC);
+  header->set_timestamp(compact.header().timestamp);
+  header->set_hash(compact.header().hash);
+  if (compact.header().flags & COMPACT_FLAG_MODULE_RELATIVE) {
+    header->set_module_relative(true);
+  }
+  if (compact.header().flags & COMPACT_FLAG_COVERAGE_HASH) {
+    header->set_coverage_hash(compact.header().coverage_hash);
+    header->set_coverage_hash_buckets(compact.header().coverage_hash_buckets);
+  }
+  if (compact.header().flags & COMPACT_FLAG_RING_STATS) {
+    const compact_ring_stats &stats = compact.header().ring;
+    bbtrace::RingStats *ring = header->mutable_ring();
+    ring->set_pages(stats.pages);
+    ring->set_watermark(stats.watermark);
+    ring->set_lost(stats.lost);
+    ring->set_wakeups(stats.wakeups);
+    ring->set_drains(stats.drains);
+    ring->set_drained_bytes(stats.drained_bytes);
+    ring->set_max_drain(stats.max_drain);
+  }
+  if (compact.header().hang != bbtrace::TraceHeader::HANG_NONE) {
+    header->set_hang(static_cast<bbtrace::TraceHeader::HangType>(
+                       compact.header().hang));
+  }
+
+  if (edges) {
+    bool ok = compact.ForEach([&](const compact_edge &e) {
+        bbtrace::Edge *edge = trace->add_edge();
+        edge->set_prev(e.prev);
+        edge->set_next(e.next);
+        edge->set_hit(e.hit);
+      });
+    if (!ok) {
+      return false;
+    }
+  }
+
+  compact.ForEachException([&](const compact_exception &e,
+                               const uint64_t *frames) {
+      bbtrace::Exception *exc = trace->add_exception();
+      exc->set_tid(e.tid);
+      exc->set_type(static_cast<bbtrace::Exception::ExceptionType>(e.type));
+      exc->set_pc(e.pc);
+      exc->set_faultyaddr(e.faulty_addr);
+      exc->set_access(
+        static_cast<bbtrace::Exception::ExceptionAccess>(e.access));
+      for (uint32_t i = 0; i < e.n_frames; i++) {
+        exc->add_stacktrace(frames[i]);
+      }
+      if (e.signature != 0) {
+        exc->set_signature(e.signature);
+        exc->set_fuzzy_signature(e.fuzzy_signature);
+      }
+    });
+
+  for (uint32_t i = 0; i < compact.n_images(); i++) {
+    bbtrace::MemoryRegion *region = trace->add_region();
+    region->set_base(compact.image(i).base);
+    region->set_size(compact.image(i).size);
+    region->set_name(compact.image_name(i));
+  }
+
+  return true;
+}
+
+// Read the magic of a trace file. Return false if the file is unreadable
+static bool load_magic(const std::string &filename, std::ifstream *in,
+                       char *magic) {
+  in->open(filename.c_str(), std::ios::in | std::ios::binary);
+  return static_cast<bool>(in->read(magic, 4));
+}
+
+bool load_trace(const std::string &filename, bbtrace::Trace *trace) {
+  std::ifstream in;
+  char magic[4];
+  if (!load_magic(filename, &in, magic)) {
+    return false;
+  }
+
+  if (memcmp(magic, TRACE_STREAM_MAGIC, TRACE_STREAM_MAGIC_SIZE) == 0) {
+    return load_trace_stream(filename, trace);
+  } else if (memcmp(magic, COMPACT_MAGIC, COMPACT_MAGIC_SIZE) == 0) {
+    CompactTrace compact;
+    return compact.Open(filename) && load_trace_compact(compact, trace);
+  }
+
+  in.seekg(0);
+  return trace->ParseFromIstream(&in);
+}
+
+// Fill an execution trace from a trace message
+static void load_execution_populate(const bbtrace::Trace &trace,
+                                    ExecutionTrace *execution_trace) {
+  const bbtrace::TraceHeader &header = trace.header();
+  execution_trace->timestamp = header.timestamp();
+  execution_trace->module_relative = header.module_relative();
+  execution_trace->hang = static_cast<TraceHang>(header.hang());
+  if (header.has_ring()) {
+    RingStats &stats = execution_trace->ring_stats;
+    stats.pages = header.ring().pages();
+    stats.watermark = header.ring().watermark();
+    stats.lost = header.ring().lost();
+    stats.wakeups = header.ring().wakeups();
+    stats.drains = header.ring().drains();
+    stats.drained_bytes = header.ring().drained_bytes();
+    stats.max_drain = header.ring().max_drain();
+  }
+
+  for (int i = 0; i < trace.edge_size(); i++) {
+    const bbtrace::Edge &edge = trace.edge(i);
+    execution_trace->basic_blocks.AddEdge(edge.prev(), edge.next(),
+                                          edge.hit());
+  }
+
+  for (int i = 0; i < trace.task_size(); i++) {
+    const bbtrace::Task &task = trace.task(i);
+    BBMap &edges = execution_trace->tasks[task_id(task.pid(), task.tid())];
+    for (int j = 0; j < task.edge_size(); j++) {
+      edges.AddEdge(task.edge(j).prev(), task.edge(j).next(),
+                    task.edge(j).hit());
+    }
+  }
+
+  // Exception types and accesses have the same values in both
+  for (int i = 0; i < trace.exception_size(); i++) {
+    const bbtrace::Exception &exc = trace.exception(i);
+    std::shared_ptr<Exception> exception =
+      std::make_shared<Exception>(exc.tid(),
+                                  static_cast<ExceptionType>(exc.type()),
+                                  exc.pc(), exc.faultyaddr(), exc.access());
+    for (int j = 0; j < exc.stacktrace_size(); j++) {
+      exception->stacktrace_push(exc.stacktrace(j));
+    }
+    exception->set_signatures(exc.signature(), exc.fuzzy_signature());
+    execution_trace->exceptions.push_back(exception);
+  }
+
+  for (int i = 0; i < trace.region_size(); i++) {
+    MemoryRegion region;
+    region.base = trace.region(i).base();
+    region.size = trace.region(i).size();
+    region.filename = trace.region(i).name();
+    execution_trace->memory_regions.push_back(region);
+  }
+}
+
+bool load_execution_trace(const std::string &filename,
+                          ExecutionTrace *execution_trace) {
+  bbtrace::Trace trace;
+  if (!load_trace(filename, &trace)) {
+    return false;
+  }
+  load_execution_populate(trace, execution_trace);
+  return true;
+}
+
+bool load_trace_exceptions(const std::string &filename,
+                           bbtrace::Trace *trace) {
+  std::ifstream in;
+  char magic[4];
+  if (!load_magic(filename, &in, magic)) {
+    return false;
+  }
+
+  if (memcmp(magic, TRACE_STREAM_MAGIC, TRACE_STREAM_MAGIC_SIZE) == 0) {
+    return load_trace_stream(filename, trace, false);
+  } else if (memcmp(magic, COMPACT_MAGIC, COMPACT_MAGIC_SIZE) == 0) {
+    CompactTrace compact;
+    return compact.Open(filename) && load_trace_compact(compact, trace, false);
+  }
+
+  in.seekg(0);
+  if (!trace->ParseFromIstream(&in)) {
+    return false;
+  }
+  trace->clear_edge();
+  trace->clear_task();
+  return true;
+}
+
+bool load_trace_edges(const std::string &filename,
+                      std::vector<compact_edge> *edges) {
+  std::ifstream in;
+  char magic[4];
+  if (!load_magic(filename, &in, magic)) {
+    return false;
+  }
+  edges->clear();
+
+  // Compact traces are already sorted and unique
+  if (memcmp(magic, COMPACT_MAGIC, COMPACT_MAGIC_SIZE) == 0) {
+    CompactTrace compact;
+    if (!compact.Open(filename)) {
+      return false;
+    }
+    edges->reserve(compact.size());
+    return compact.ForEach([&](const compact_edge &e) {
+        edges->push_back(e);
+      });
+  }
+
+  in.close();
+  bbtrace::Trace trace;
+  if (!load_trace(filename, &trace)) {
+    return false;
+  }
+
+  edges->resize(trace.edge_size());
+  for (int i = 0; i < trace.edge_size(); i++) {
+    (*edges)[i].prev = trace.edge(i).prev();
+    (*edges)[i].next = trace.edge(i).next();
+    (*edges)[i].hit = trace.edge(i).hit();
+  }
+  std::sort(edges->begin(), edges->end(),
+            [](const compact_edge &a, const compact_edge &b) {
+              return a.prev < b.prev || (a.prev == b.prev && a.next < b.next);
+            });
+
+  size_t n = 0;
+  for (size_t i = 0; i < edges->size(); i++) {
+    if (n > 0 && (*edges)[n-1].prev == (*edges)[i].prev &&
+        (*edges)[n-1].next == (*edges)[i].next) {
+      (*edges)[n-1].hit += (*edges)[i].hit;
+    } else {
+      (*edges)[n++] = (*edges)[i];
+    }
+  }
+  edges->resize(n);
+  return true;
+}
+
+bool load_collect_traces(const std::string &path,
+                         std::vector<std::string> *filenames) {
+  struct stat st;
+  if (stat(path.c_str(), &st) == -1) {
+    return false;
+  }
+
+  if (!S_ISDIR(st.st_mode)) {
+    filenames->push_back(path);
+    return true;
+  }
+
+  DIR *dir = opendir(path.c_str());
+  if (dir == NULL) {
+    return false;
+  }
+
+  std::vector<std::string> names;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    std::string name = path + "/" + entry->d_name;
+    if (stat(name.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+      names.push_back(name);
+    }
+  }
+  closedir(dir);
+
+  std::sort(names.begin(), names.end());
+  filenames->insert(filenames->end(), names.begin(), names.end());
+  return true;
+}
+
+static std::string load_basename(const std::string &path) {
+  size_t pos = path.rfind('/');
+  return pos == std::string::npos ? path : path.substr(pos + 1);
+}
+
+bool load_output_names(const std::vector<std::string> &filenames,
+                       std::vector<std::string> *names) {
+  std::map<std::string, int> count;
+  for (size_t i = 0; i < filenames.size(); i++) {
+    count[load_basename(filenames[i])]++;
+  }
+
+  std::set<std::string> taken;
+  for (size_t i = 0; i < filenames.size(); i++) {
+    std::string name = load_basename(filenames[i]);
+    if (count[name] > 1) {
+      name = std::to_string(i) + "-" + name;
+    }
+    if (!taken.insert(name).second) {
+      return false;
+    }
+    names->push_back(name);
+  }
+  return true;
+}
@@ -0,0 +1,49 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Load execution traces in any format (protobuf, streaming or compact), as
+// detected from their magic.
+//
+
+#ifndef _COMMON_LOAD_H
+#define _COMMON_LOAD_H
+
+#include <string>
+#include <vector>
+
+#include "./bbtrace.pb.h"
+#include "./compact.h"
+#include "./serialize.h"
+
+// Load a whole trace
+bool load_trace(const std::string &filename, bbtrace::Trace *trace);
+
+// Load a whole trace as an in-memory execution trace, e.g., to serialize it
+// again in another format. Header hashes are not loaded, but computed again
+// from the edges
+bool load_execution_trace(const std::string &filename,
+                          ExecutionTrace *execution_trace);
+
+// Load the header, exceptions and memory regions of a trace only. Edges of
+// compact traces are not even decoded
+bool load_trace_exceptions(const std::string &filename,
+                           bbtrace::Trace *trace);
+
+// Load the edges of a trace only, sorted by (prev, next), with the hits of
+// duplicate edges summed. Compact traces are decoded in place
+bool load_trace_edges(const std::string &filename,
+                      std::vector<compact_edge> *edges);
+
+// Collect trace file names: a directory stands for all the regular files it
+// contains (sorted by name), anything else for itself
+bool load_collect_traces(const std::string &path,
+                         std::vector<std::string> *filenames);
+
+// Names of the files derived from input files (e.g., their traces) within an
+// output directory: the base names of the inputs, prefixed with their index
+// ("<index>-<name>") when several inputs share them. Return false if names
+// still collide
+bool load_output_names(const std::vector<std::string> &filenames,
+                       std::vector<std::string> *names);
+
+#endif  // _COMMON_LOAD_H
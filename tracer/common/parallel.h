@@ -0,0 +1,51 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Minimal parallel loop for the offline tools.
+//
+
+#ifndef _COMMON_PARALLEL_H
+#define _COMMON_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Default number of worker threads: one per CPU
+static inline unsigned int parallel_threads() {
+  return std::max(1U, std::thread::hardware_concurrency());
+}
+
+// Invoke f(worker, i) for each i in [0, n), on up to n_threads threads.
+// worker, in [0, n_threads), identifies the thread running the iteration, to
+// index per-thread state. Iterations are handed out one at a time, so they
+// can have very different costs
+template <typename F>
+static void parallel_for_workers(size_t n, unsigned int n_threads, F f) {
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> threads;
+
+  for (size_t t = 0; t < std::min<size_t>(n_threads, n); t++) {
+    threads.push_back(std::thread([&, t]() {
+          size_t i;
+          while ((i = next++) < n) {
+            f(static_cast<unsigned int>(t), i);
+          }
+        }));
+  }
+  for (size_t t = 0; t < threads.size(); t++) {
+    threads[t].join();
+  }
+}
+
+// Invoke f(i) for each i in [0, n), on up to n_threads threads
+template <typename F>
+static void parallel_for(size_t n, unsigned int n_threads, F f) {
+  parallel_for_workers(n, n_threads, [&](unsigned int worker, size_t i) {
+      f(i);
+    });
+}
+
+#endif  // _COMMON_PARALLEL_H
@@ -0,0 +1,138 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+
+#include "./regions.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <utility>
+
+RegionIndex::RegionIndex() : last_(0) {
+}
+
+void RegionIndex::Build(const std::vector<MemoryRegion> &regions) {
+  entries_.clear();
+  modules_.clear();
+  last_ = 0;
+
+  std::vector<std::string> paths;
+  for (size_t i = 0; i < regions.size(); i++) {
+    if (regions[i].size > 0) {
+      paths.push_back(regions[i].filename);
+    }
+  }
+  std::sort(paths.begin(), paths.end());
+  paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+
+  for (size_t i = 0; i < paths.size(); i++) {
+    module_entry module;
+    module.filename = paths[i];
+    module.id = region_module_id(paths[i]);
+    module.base = std::numeric_limits<target_addr>::max();
+    modules_.push_back(module);
+  }
+
+  // Modules start at the lowest base of their regions
+  for (size_t i = 0; i < regions.size(); i++) {
+    if (regions[i].size == 0) {
+      continue;
+    }
+
+    region_entry entry;
+    entry.base = regions[i].base;
+    entry.end = regions[i].base + regions[i].size - 1;
+    entry.module = std::lower_bound(paths.begin(), paths.end(),
+                                    regions[i].filename) - paths.begin();
+    modules_[entry.module].base = std::min(modules_[entry.module].base,
+                                           entry.base);
+    entries_.push_back(entry);
+  }
+
+  std::sort(entries_.begin(), entries_.end(),
+            [](const region_entry &a, const region_entry &b) {
+              return a.base < b.base ||
+                (a.base == b.base && a.module < b.module);
+            });
+}
+
+bool RegionIndex::LookupModule(target_addr addr, size_t *module,
+                               uint32_t *offset) const {
+  if (entries_.empty()) {
+    return false;
+  }
+
+  const region_entry *entry = &entries_[last_];
+  if (addr < entry->base || addr > entry->end) {
+    // Find the last region starting at or before addr
+    auto it = std::upper_bound(entries_.begin(), entries_.end(), addr,
+                               [](target_addr a, const region_entry &e) {
+                                 return a < e.base;
+                               });
+    if (it == entries_.begin()) {
+      return false;
+    }
+
+    entry = &*(it - 1);
+    if (addr > entry->end) {
+      return false;
+    }
+    last_ = entry - &entries_[0];
+  }
+
+  target_addr base = modules_[entry->module].base;
+  if (addr - base > UINT32_MAX) {
+    return false;
+  }
+
+  *module = entry->module;
+  *offset = addr - base;
+  return true;
+}
+
+bool RegionIndex::Lookup(target_addr addr, uint32_t *id,
+                         uint32_t *offset) const {
+  size_t module;
+  if (!LookupModule(addr, &module, offset)) {
+    return false;
+  }
+  *id = modules_[module].id;
+  return true;
+}
+
+int RegionIndex::Relocate(const BBMap &in, BBMap *out) const {
+  int dropped = 0;
+
+  in.ForEach([&](target_addr prev, target_addr next, unsigned int hit) {
+      uint32_t id_prev, off_prev, id_next, off_next;
+      if (!Lookup(prev, &id_prev, &off_prev) ||
+          !Lookup(next, &id_next, &off_next)) {
+        dropped++;
+        return;
+      }
+      out->AddEdge(region_relative(id_prev, off_prev),
+                   region_relative(id_next, off_next), hit);
+    });
+
+  return dropped;
+}
+
+int regions_relocate_trace(ExecutionTrace *execution_trace) {
+  RegionIndex index;
+  index.Build(execution_trace->memory_regions);
+
+  BBMap relocated;
+  int dropped = index.Relocate(execution_trace->basic_blocks, &relocated);
+  std::swap(execution_trace->basic_blocks, relocated);
+
+  for (auto it = execution_trace->tasks.begin();
+       it != execution_trace->tasks.end(); it++) {
+    BBMap task;
+    index.Relocate(it->second, &task);
+    std::swap(it->second, task);
+  }
+
+  execution_trace->module_relative = true;
+  return dropped;
+}
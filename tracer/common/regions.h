@@ -0,0 +1,105 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Resolution of absolute addresses to module-relative ones.
+//
+// A module-relative address holds the id of a module in its upper 32 bits, and
+// an offset from the base of that module in the lower ones. Unlike absolute
+// addresses, they do not depend on where modules are loaded, so they are
+// stable across runs of ASLR-enabled targets.
+//
+// Modules are the memory regions of the trace, grouped by path: the id of a
+// module is a hash of its path (see region_module_id()), and its base is the
+// lowest base of its regions. Neither depends on the order in which regions
+// were reported (e.g., by different per-CPU rings), nor on the other modules
+// of the run, so a library keeps its id whatever else the target loads.
+// Addresses more than 4 GiB past the base of their module have no
+// module-relative form.
+//
+
+#ifndef _COMMON_REGIONS_H
+#define _COMMON_REGIONS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "./bbmap.h"
+#include "./common.h"
+#include "./serialize.h"
+
+static inline target_addr region_relative(uint32_t id, uint32_t offset) {
+  return (static_cast<uint64_t>(id) << 32) | offset;
+}
+
+static inline uint32_t region_relative_id(target_addr addr) {
+  return static_cast<uint64_t>(addr) >> 32;
+}
+
+static inline uint32_t region_relative_offset(target_addr addr) {
+  return static_cast<uint32_t>(addr);
+}
+
+// Id of the module with path filename: its 32-bit FNV-1a hash. Two paths of
+// the same trace may collide (about once in 2^32 pairs): their edges are then
+// merged
+static inline uint32_t region_module_id(const std::string &filename) {
+  uint32_t h = 0x811c9dc5;
+  for (size_t i = 0; i < filename.length(); i++) {
+    h = (h ^ static_cast<unsigned char>(filename[i])) * 0x01000193;
+  }
+  return h;
+}
+
+// Sorted interval index over a list of memory regions, resolving addresses
+// to modules
+class RegionIndex {
+ public:
+  explicit RegionIndex();
+
+  void Build(const std::vector<MemoryRegion> &regions);
+
+  // Resolve an absolute address to a module id and offset. Return false if it
+  // does not belong to any region, or if its offset does not fit in 32 bits.
+  // If regions overlap, the one with the highest base wins
+  bool Lookup(target_addr addr, uint32_t *id, uint32_t *offset) const;
+
+  // Same as Lookup(), returning the index of the module in the sorted list of
+  // the modules of the trace
+  bool LookupModule(target_addr addr, size_t *module, uint32_t *offset) const;
+
+  // Modules of the trace, sorted by path
+  const std::string &module(size_t i) const { return modules_[i].filename; }
+  uint32_t module_id(size_t i) const { return modules_[i].id; }
+  size_t n_modules() const { return modules_.size(); }
+
+  // Add the edges of in to out, with module-relative endpoints. Edges with
+  // unresolved endpoints are dropped: return how many
+  int Relocate(const BBMap &in, BBMap *out) const;
+
+ private:
+  struct region_entry {
+    target_addr base;
+    target_addr end;            // Last address of the region
+    size_t module;              // Index of the module of the region
+  };
+
+  struct module_entry {
+    std::string filename;
+    uint32_t id;
+    target_addr base;           // Lowest base of the regions of the module
+  };
+
+  std::vector<region_entry> entries_;
+  std::vector<module_entry> modules_;  // Sorted by path, distinct
+
+  // Consecutive lookups often hit the same region
+  mutable size_t last_;
+};
+
+// Replace all the edges of an execution trace (global and per-task) with
+// module-relative ones, resolved against its memory regions. Return the
+// number of dropped global edges
+int regions_relocate_trace(ExecutionTrace *execution_trace);
+
+#endif  // _COMMON_REGIONS_H
@@ -0,0 +1,113 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Resolve the same code locations against the memory regions of two runs
+// that load different sets of modules, at different bases, and check that
+// they get the same module-relative addresses.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "./regions.h"
+
+// Unlike assert(), also evaluated with NDEBUG
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,  \
+              #cond);                                                   \
+      exit(1);                                                          \
+    }                                                                   \
+  } while (0)
+
+static void add_region(std::vector<MemoryRegion> *regions, target_addr base,
+                       uint64_t size, const std::string &filename) {
+  MemoryRegion region;
+  region.base = base;
+  region.size = size;
+  region.filename = filename;
+  regions->push_back(region);
+}
+
+static target_addr relative(const RegionIndex &index, target_addr addr) {
+  uint32_t id, offset;
+  CHECK(index.Lookup(addr, &id, &offset));
+  return region_relative(id, offset);
+}
+
+int main(int argc, char **argv) {
+  // Reference value, shared with viewer/trace.py
+  CHECK(region_module_id("/lib/libc.so.6") == 0xe8046f12);
+
+  // Run A: the target and libc
+  std::vector<MemoryRegion> regions_a;
+  add_region(&regions_a, 0x555555554000ULL, 0x1000, "/bin/target");
+  add_region(&regions_a, 0x555555555000ULL, 0x2000, "/bin/target");
+  add_region(&regions_a, 0x7f0000000000ULL, 0x200000, "/lib/libc.so.6");
+
+  // Run B: elsewhere, with an extra library whose path sorts before libc
+  // (e.g., loaded by dlopen() for this input only), and an empty region
+  std::vector<MemoryRegion> regions_b;
+  add_region(&regions_b, 0x7f1000000000ULL, 0x10000, "/lib/libaudit.so");
+  add_region(&regions_b, 0x7f2000000000ULL, 0x200000, "/lib/libc.so.6");
+  add_region(&regions_b, 0x7f3000000000ULL, 0, "/a/empty");
+  add_region(&regions_b, 0x563000001000ULL, 0x2000, "/bin/target");
+  add_region(&regions_b, 0x563000000000ULL, 0x1000, "/bin/target");
+
+  RegionIndex index_a, index_b;
+  index_a.Build(regions_a);
+  index_b.Build(regions_b);
+  CHECK(index_a.n_modules() == 2);
+  CHECK(index_b.n_modules() == 3);
+
+  CHECK(relative(index_a, 0x555555554010ULL) ==
+        relative(index_b, 0x563000000010ULL));
+  CHECK(relative(index_a, 0x555555556000ULL) ==
+        relative(index_b, 0x563000002000ULL));
+  CHECK(relative(index_a, 0x7f0000001234ULL) ==
+        relative(index_b, 0x7f2000001234ULL));
+  CHECK(region_relative_id(relative(index_b, 0x7f2000001234ULL)) ==
+        region_module_id("/lib/libc.so.6"));
+  CHECK(region_relative_offset(relative(index_b, 0x563000002000ULL)) ==
+        0x2000);
+
+  // Relocated traces are equal, whatever else was loaded
+  ExecutionTrace trace_a, trace_b;
+  trace_a.memory_regions = regions_a;
+  trace_a.basic_blocks.AddEdge(0x555555554010ULL, 0x7f0000001234ULL, 3);
+  trace_a.basic_blocks.AddEdge(0x7f0000001240ULL, 0x555555556000ULL, 1);
+  trace_b.memory_regions = regions_b;
+  trace_b.basic_blocks.AddEdge(0x563000000010ULL, 0x7f2000001234ULL, 3);
+  trace_b.basic_blocks.AddEdge(0x7f2000001240ULL, 0x563000002000ULL, 1);
+  trace_b.basic_blocks.AddEdge(0x7f1000000100ULL, 0x7f1000000200ULL, 1);
+  CHECK(regions_relocate_trace(&trace_a) == 0);
+  CHECK(regions_relocate_trace(&trace_b) == 0);
+  CHECK(trace_b.basic_blocks.size() == 3);
+  std::set<std::tuple<target_addr, target_addr, unsigned int> > edges_b;
+  trace_b.basic_blocks.ForEach(
+    [&](target_addr prev, target_addr next, unsigned int hit) {
+      edges_b.insert(std::make_tuple(prev, next, hit));
+    });
+  trace_a.basic_blocks.ForEach(
+    [&](target_addr prev, target_addr next, unsigned int hit) {
+      CHECK(edges_b.count(std::make_tuple(prev, next, hit)) == 1);
+    });
+
+  // Unknown addresses, and offsets beyond 4 GiB, have no relative form
+  uint32_t id, offset;
+  CHECK(!index_a.Lookup(0x1000, &id, &offset));
+  std::vector<MemoryRegion> regions_large;
+  add_region(&regions_large, 0x100000000ULL, 0x200000000ULL, "/big");
+  RegionIndex index_large;
+  index_large.Build(regions_large);
+  CHECK(index_large.Lookup(0x1ffffffffULL, &id, &offset));
+  CHECK(!index_large.Lookup(0x200000000ULL, &id, &offset));
+
+  printf("regions_test: ok\n");
+  return 0;
+}
@@ -6,7 +6,12 @@
 #include <string>
 
 #include "./bbtrace.pb.h"
+#include "./compact.h"
 #include "./serialize.h"
+#include "./stream.h"
+
+// Maximum number of edges in a chunk of a streaming trace
+static const int STREAM_CHUNK_EDGES = 4096;
 
 // Populate a protobuf Edge object
 static inline void serialize_populate_edge(bbtrace::Edge *output,
@@ -56,6 +61,11 @@ serialize_populate_exception(bbtrace::Exception *output,
          it_stack != exc->stacktrace_end(); it_stack++) {
       output->add_stacktrace(*it_stack);
     }
+
+    if (exc->signature() != 0) {
+      output->set_signature(exc->signature());
+      output->set_fuzzy_signature(exc->fuzzy_signature());
+    }
 }
 
 // Populate a protobuf Exception object
@@ -67,15 +77,66 @@ serialize_populate_region(bbtrace::MemoryRegion *output,
   output->set_name(region.filename);
 }
 
+// Creation time of a trace: now, unless the trace was loaded from a file
+static inline uint64_t
+serialize_timestamp(const ExecutionTrace &execution_trace) {
+  if (execution_trace.timestamp != 0) {
+    return execution_trace.timestamp;
+  }
+  return time(NULL);
+}
+
+// Populate a protobuf TraceHeader object
+static inline void
+serialize_populate_header(bbtrace::TraceHeader *output,
+                          const ExecutionTrace &execution_trace) {
+  output->set_magic(bbtrace::TraceHeader::TRACE_MAGIC);
+  output->set_timestamp(serialize_timestamp(execution_trace));
+  output->set_hash(execution_trace.basic_blocks.ComputeHash());
+  output->set_coverage_hash(execution_trace.basic_blocks.coverage_hash());
+  output->set_coverage_hash_buckets(
+    execution_trace.basic_blocks.ComputeBucketHash());
+  if (execution_trace.module_relative) {
+    output->set_module_relative(true);
+  }
+
+  const RingStats &stats = execution_trace.ring_stats;
+  if (stats.drains > 0) {
+    bbtrace::RingStats *ring = output->mutable_ring();
+    ring->set_pages(stats.pages);
+    ring->set_watermark(stats.watermark);
+    ring->set_lost(stats.lost);
+    ring->set_wakeups(stats.wakeups);
+    ring->set_drains(stats.drains);
+    ring->set_drained_bytes(stats.drained_bytes);
+    ring->set_max_drain(stats.max_drain);
+  }
+
+  if (execution_trace.hang != TraceHangNone) {
+    output->set_hang(static_cast<bbtrace::TraceHeader::HangType>(
+                       execution_trace.hang));
+  }
+}
+
+bool serialize_parse_format(const std::string &name, TraceFormat *format) {
+  if (name == "protobuf") {
+    *format = TraceFormatProtobuf;
+  } else if (name == "stream") {
+    *format = TraceFormatStream;
+  } else if (name == "compact") {
+    *format = TraceFormatCompact;
+  } else {
+    return false;
+  }
+  return true;
+}
+
 void serialize_trace(const std::string &filename,
                      const ExecutionTrace &execution_trace) {
   bbtrace::Trace trace;
 
   // Create the trace header
-  bbtrace::TraceHeader *header = trace.mutable_header();
-  header->set_magic(bbtrace::TraceHeader::TRACE_MAGIC);
-  header->set_timestamp(time(NULL));
-  header->set_hash(execution_trace.basic_blocks.ComputeHash());
+  serialize_populate_header(trace.mutable_header(), execution_trace);
 
   // Output basic block information
   for (bbmap_iterator it = execution_trace.basic_blocks.map_begin();
@@ -98,7 +159,171 @@ void serialize_trace(const std::string &filename,
     serialize_populate_region(region, *it);
   }
 
+  // Output per-task coverage, unless this is a single-task trace
+  if (execution_trace.tasks.size() > 1) {
+    for (auto it = execution_trace.tasks.begin();
+         it != execution_trace.tasks.end(); it++) {
+      bbtrace::Task *task = trace.add_task();
+      task->set_pid(it->first.first);
+      task->set_tid(it->first.second);
+
+      for (bbmap_iterator it_edge = it->second.map_begin();
+           it_edge != it->second.map_end(); it_edge++) {
+        bbtrace::Edge *edge = task->add_edge();
+        serialize_populate_edge(edge, it_edge->first, it_edge->second);
+      }
+    }
+  }
+
   std::fstream outstream(filename.c_str(),
                          std::ios::out | std::ios::trunc | std::ios::binary);
   trace.SerializeToOstream(&outstream);
 }
+
+// Write the edges of a map as a sequence of chunks. With task != NULL, edges
+// are attached to a Task message, otherwise to the chunk itself
+static bool serialize_stream_edges(TraceStreamWriter *writer,
+                                   bbtrace::TraceChunk *chunk,
+                                   const BBMap &basic_blocks,
+                                   const task_id *task) {
+  bool ok = true;
+  google::protobuf::RepeatedPtrField<bbtrace::Edge> *edges;
+
+  // Repeated fields keep their elements when cleared, so the same Edge
+  // objects are reused by all the chunks
+  chunk->Clear();
+  if (task != NULL) {
+    bbtrace::Task *msg = chunk->add_task();
+    msg->set_pid(task->first);
+    msg->set_tid(task->second);
+    edges = msg->mutable_edge();
+  } else {
+    edges = chunk->mutable_edge();
+  }
+
+  // Sorted, like in the other formats: identical runs give identical chunks.
+  // The sorted view is built once, and cached by the map
+  for (bbmap_iterator it = basic_blocks.map_begin();
+       it != basic_blocks.map_end(); it++) {
+    serialize_populate_edge(edges->Add(), it->first, it->second);
+    if (edges->size() == STREAM_CHUNK_EDGES) {
+      ok = ok && writer->Write(*chunk);
+      edges->Clear();
+    }
+  }
+
+  if (edges->size() > 0) {
+    ok = ok && writer->Write(*chunk);
+  }
+  return ok;
+}
+
+bool serialize_trace_stream(const std::string &filename,
+                            const ExecutionTrace &execution_trace) {
+  TraceStreamWriter writer;
+  bbtrace::TraceChunk chunk;
+
+  if (!writer.Open(filename)) {
+    return false;
+  }
+
+  // The header goes first, alone
+  serialize_populate_header(chunk.mutable_header(), execution_trace);
+  bool ok = writer.Write(chunk);
+
+  ok = ok && serialize_stream_edges(&writer, &chunk,
+                                    execution_trace.basic_blocks, NULL);
+
+  // Exceptions and memory regions are few, a single chunk holds them all
+  chunk.Clear();
+  for (exceptions_iterator it = execution_trace.exceptions.begin();
+       it != execution_trace.exceptions.end(); it++) {
+    serialize_populate_exception(chunk.add_exception(), *it);
+  }
+  for (auto it = execution_trace.memory_regions.begin();
+       it != execution_trace.memory_regions.end(); it++) {
+    serialize_populate_region(chunk.add_region(), *it);
+  }
+  if (chunk.exception_size() > 0 || chunk.region_size() > 0) {
+    ok = ok && writer.Write(chunk);
+  }
+
+  if (execution_trace.tasks.size() > 1) {
+    for (auto it = execution_trace.tasks.begin();
+         it != execution_trace.tasks.end(); it++) {
+      ok = ok && serialize_stream_edges(&writer, &chunk, it->second,
+                                        &it->first);
+    }
+  }
+
+  // A stream that failed is left without its end chunk
+  if (!ok) {
+    writer.Close();
+    return false;
+  }
+  return writer.Finish();
+}
+
+bool serialize_trace_compact(const std::string &filename,
+                             const ExecutionTrace &execution_trace) {
+  CompactTraceWriter writer;
+
+  writer.SetHeader(serialize_timestamp(execution_trace),
+                   execution_trace.basic_blocks.ComputeHash(),
+                   execution_trace.module_relative ?
+                   COMPACT_FLAG_MODULE_RELATIVE : 0);
+  writer.SetCoverageHash(execution_trace.basic_blocks.coverage_hash(),
+                         execution_trace.basic_blocks.ComputeBucketHash());
+
+  const RingStats &stats = execution_trace.ring_stats;
+  if (stats.drains > 0) {
+    compact_ring_stats ring;
+    ring.pages = stats.pages;
+    ring.watermark = stats.watermark;
+    ring.lost = stats.lost;
+    ring.wakeups = stats.wakeups;
+    ring.drains = stats.drains;
+    ring.drained_bytes = stats.drained_bytes;
+    ring.max_drain = stats.max_drain;
+    writer.SetRingStats(ring);
+  }
+  writer.SetHang(execution_trace.hang);
+
+  for (auto it = execution_trace.memory_regions.begin();
+       it != execution_trace.memory_regions.end(); it++) {
+    writer.AddImage(it->base, it->size, it->filename);
+  }
+
+  // Exception types are stored with their protobuf values
+  for (exceptions_iterator it = execution_trace.exceptions.begin();
+       it != execution_trace.exceptions.end(); it++) {
+    bbtrace::Exception exc;
+    serialize_populate_exception(&exc, *it);
+    std::vector<uint64_t> frames(exc.stacktrace().begin(),
+                                 exc.stacktrace().end());
+    writer.AddException(exc.tid(), exc.type(), exc.access(), exc.pc(),
+                        exc.faultyaddr(), frames, exc.signature(),
+                        exc.fuzzy_signature());
+  }
+
+  for (bbmap_iterator it = execution_trace.basic_blocks.map_begin();
+       it != execution_trace.basic_blocks.map_end(); it++) {
+    writer.AddEdge(it->first.first, it->first.second, it->second);
+  }
+
+  return writer.Write(filename);
+}
+
+bool serialize_trace_format(const std::string &filename,
+                            const ExecutionTrace &execution_trace,
+                            TraceFormat format) {
+  switch (format) {
+  case TraceFormatStream:
+    return serialize_trace_stream(filename, execution_trace);
+  case TraceFormatCompact:
+    return serialize_trace_compact(filename, execution_trace);
+  default:
+    serialize_trace(filename, execution_trace);
+    return true;
+  }
+}
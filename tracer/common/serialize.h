@@ -7,7 +7,9 @@
 #ifndef _COMMON_SERIALIZE_H
 #define _COMMON_SERIALIZE_H
 
+#include <map>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "./common.h"
@@ -16,22 +18,87 @@
 
 typedef struct {
   target_addr base;
-  unsigned int size;
+  uint64_t size;
   std::string filename;
 } MemoryRegion;
 
+// Statistics of the perf ring buffers a trace was decoded from, see
+// bbtrace::RingStats. No drains: not decoded from rings
+typedef struct {
+  uint32_t pages = 0;
+  uint32_t watermark = 0;
+  uint64_t lost = 0;
+  uint64_t wakeups = 0;
+  uint64_t drains = 0;
+  uint64_t drained_bytes = 0;
+  uint64_t max_drain = 0;
+} RingStats;
+
+// Why the tracer stopped a run that did not terminate on its own, see
+// bbtrace::TraceHeader.hang (same values)
+enum TraceHang {
+  TraceHangNone = 0,
+  TraceHangTimeout = 1,         // The time budget of the run expired
+  TraceHangIdle = 2,            // No new edges for too long
+};
+
+// Task identifier, as a (pid, tid) pair
+typedef std::pair<uint32_t, uint32_t> task_id;
+
 typedef struct {
   // Map of basic block edges
   BBMap basic_blocks;
 
+  // Map of basic block edges, for each task of the target (only serialized,
+  // and not necessarily filled, when the target has a single task)
+  std::map<task_id, BBMap> tasks;
+
   // Tracked exceptions
   exceptions_list exceptions;
 
   // Mapped memory regions
   std::vector<MemoryRegion> memory_regions;
+
+  // Edge endpoints are module-relative addresses (see regions.h)
+  bool module_relative = false;
+
+  // Perf ring buffers
+  RingStats ring_stats;
+
+  // The run hung, and the trace is partial
+  TraceHang hang = TraceHangNone;
+
+  // Creation time of the trace, in seconds since the epoch (0: when
+  // serialized)
+  uint64_t timestamp = 0;
 } ExecutionTrace;
 
+// Output formats of a trace file
+enum TraceFormat {
+  TraceFormatProtobuf = 0,      // A single bbtrace::Trace message
+  TraceFormatStream = 1,        // A stream of bbtrace::TraceChunk messages
+  TraceFormatCompact = 2,       // A compact, mmap()'able trace (compact.h)
+};
+
+// Parse a format name ("protobuf", "stream" or "compact")
+bool serialize_parse_format(const std::string &name, TraceFormat *format);
+
 void serialize_trace(const std::string &filename,
                      const ExecutionTrace &execution_trace);
 
+// Write a streaming trace file, chunk by chunk, straight from the edge tables.
+// Edges are sorted, so that identical runs give identical files: extra memory
+// is the sorted view of each table (see BBMap::map_begin()), and one chunk
+bool serialize_trace_stream(const std::string &filename,
+                            const ExecutionTrace &execution_trace);
+
+// Write a compact trace file. Per-task edges are not included
+bool serialize_trace_compact(const std::string &filename,
+                             const ExecutionTrace &execution_trace);
+
+// Write a trace file in any format
+bool serialize_trace_format(const std::string &filename,
+                            const ExecutionTrace &execution_trace,
+                            TraceFormat format);
+
 #endif  // _COMMON_SERIALIZE_H
@@ -0,0 +1,102 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+
+#include "./stats.h"
+
+#include <sys/stat.h>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+
+RunStats::RunStats() {
+}
+
+void RunStats::SetString(const std::string &name, const std::string &value) {
+  for (size_t i = 0; i < values_.size(); i++) {
+    if (values_[i].first == name) {
+      values_[i].second = value;
+      return;
+    }
+  }
+  values_.push_back(std::make_pair(name, value));
+}
+
+void RunStats::Set(const std::string &name, uint64_t value) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%" PRIu64, value);
+  SetString(name, buf);
+}
+
+void RunStats::SetDouble(const std::string &name, double value) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.3f", value);
+  SetString(name, buf);
+}
+
+void RunStats::Clear() {
+  values_.clear();
+}
+
+bool RunStats::Append(const std::string &filename) const {
+  FILE *f = fopen(filename.c_str(), "a");
+  if (f == NULL) {
+    return false;
+  }
+
+  for (size_t i = 0; i < values_.size(); i++) {
+    fprintf(f, "%s %s\n", values_[i].first.c_str(),
+            values_[i].second.c_str());
+  }
+  fprintf(f, "\n");
+  return fclose(f) == 0;
+}
+
+static inline double stats_timeval_ms(const struct timeval &tv) {
+  return tv.tv_sec * 1e3 + tv.tv_usec / 1e3;
+}
+
+void stats_add_usage(RunStats *stats, const std::string &prefix,
+                     const struct rusage &usage,
+                     const struct rusage *start) {
+  double user = stats_timeval_ms(usage.ru_utime);
+  double sys = stats_timeval_ms(usage.ru_stime);
+  if (start != NULL) {
+    user -= stats_timeval_ms(start->ru_utime);
+    sys -= stats_timeval_ms(start->ru_stime);
+  }
+  stats->SetDouble(prefix + "_user_ms", user);
+  stats->SetDouble(prefix + "_sys_ms", sys);
+}
+
+void stats_add_trace(RunStats *stats, const ExecutionTrace &execution_trace) {
+  const BBMap &edges = execution_trace.basic_blocks;
+  size_t memory = edges.memory();
+  for (auto it = execution_trace.tasks.begin();
+       it != execution_trace.tasks.end(); it++) {
+    memory += it->second.memory();
+  }
+
+  stats->Set("edges", edges.size());
+  stats->Set("tasks", execution_trace.tasks.size());
+  stats->Set("edge_slots", edges.capacity());
+  stats->SetDouble("edge_load", edges.capacity() > 0 ?
+                   static_cast<double>(edges.size()) / edges.capacity() : 0);
+  stats->Set("edge_table_bytes", memory);
+}
+
+bool stats_serialize_trace(RunStats *stats, const std::string &filename,
+                           const ExecutionTrace &execution_trace,
+                           TraceFormat format) {
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  bool ok = serialize_trace_format(filename, execution_trace, format);
+  std::chrono::duration<double, std::milli> elapsed =
+    std::chrono::steady_clock::now() - start;
+
+  struct stat st;
+  stats->SetDouble("serialize_ms", elapsed.count());
+  stats->Set("serialize_bytes",
+             ok && stat(filename.c_str(), &st) == 0 ? st.st_size : 0);
+  return ok;
+}
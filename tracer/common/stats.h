@@ -0,0 +1,60 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Per-run statistics of the tracers, for monitoring where tracing overhead
+// goes.
+//
+// A stats file is a sequence of blocks, one per traced run, appended as each
+// run is over. A block is made of "name value" lines, one per statistic, and
+// ends with an empty line. Times are in milliseconds, sizes in bytes.
+//
+
+#ifndef _COMMON_STATS_H
+#define _COMMON_STATS_H
+
+#include <sys/resource.h>
+#include <stdint.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "./serialize.h"
+
+class RunStats {
+ public:
+  explicit RunStats();
+
+  // Statistics are written in the order they are first set
+  void Set(const std::string &name, uint64_t value);
+  void SetDouble(const std::string &name, double value);
+  void Clear();
+  bool empty() const { return values_.empty(); }
+
+  // Append the block of this run to a stats file
+  bool Append(const std::string &filename) const;
+
+ private:
+  void SetString(const std::string &name, const std::string &value);
+
+  std::vector<std::pair<std::string, std::string> > values_;
+};
+
+// Set "<prefix>_user_ms" and "<prefix>_sys_ms" from a resource usage (e.g.,
+// that of the target, as returned by wait4()). With start, from the
+// difference with a previous getrusage()
+void stats_add_usage(RunStats *stats, const std::string &prefix,
+                     const struct rusage &usage,
+                     const struct rusage *start = NULL);
+
+// Set the size of a trace (edges, tasks) and of its edge tables (slots,
+// load factor of the merged table, bytes of all the tables)
+void stats_add_trace(RunStats *stats, const ExecutionTrace &execution_trace);
+
+// Write a trace file as serialize_trace_format() does, setting
+// "serialize_ms" and "serialize_bytes"
+bool stats_serialize_trace(RunStats *stats, const std::string &filename,
+                           const ExecutionTrace &execution_trace,
+                           TraceFormat format);
+
+#endif  // _COMMON_STATS_H
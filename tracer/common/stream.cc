@@ -0,0 +1,130 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+
+#include "./stream.h"
+
+#include <fcntl.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <unistd.h>
+#include <cstring>
+
+using google::protobuf::io::CodedInputStream;
+using google::protobuf::io::CodedOutputStream;
+using google::protobuf::io::FileInputStream;
+using google::protobuf::io::FileOutputStream;
+
+TraceStreamWriter::TraceStreamWriter() {
+}
+
+TraceStreamWriter::~TraceStreamWriter() {
+  Close();
+}
+
+bool TraceStreamWriter::Open(const std::string &filename) {
+  Close();
+
+  int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    return false;
+  }
+  output_.reset(new FileOutputStream(fd));
+
+  CodedOutputStream coded(output_.get());
+  coded.WriteRaw(TRACE_STREAM_MAGIC, TRACE_STREAM_MAGIC_SIZE);
+  return !coded.HadError();
+}
+
+bool TraceStreamWriter::Write(const bbtrace::TraceChunk &chunk) {
+  // A short-lived coded stream per chunk, sharing the buffer of output_
+  CodedOutputStream coded(output_.get());
+  coded.WriteVarint32(chunk.ByteSizeLong());
+  chunk.SerializeWithCachedSizes(&coded);
+  return !coded.HadError();
+}
+
+bool TraceStreamWriter::Finish() {
+  bbtrace::TraceChunk chunk;
+  chunk.set_end(true);
+  bool ok = Write(chunk);
+  return Close() && ok;
+}
+
+bool TraceStreamWriter::Close() {
+  if (output_ == NULL) {
+    return true;
+  }
+
+  bool ok = output_->Close();
+  output_.reset();
+  return ok;
+}
+
+TraceStreamReader::TraceStreamReader() : error_(false) {
+}
+
+TraceStreamReader::~TraceStreamReader() {
+  Close();
+}
+
+bool TraceStreamReader::Open(const std::string &filename) {
+  Close();
+  error_ = false;
+
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  input_.reset(new FileInputStream(fd));
+  input_->SetCloseOnDelete(true);
+
+  char magic[TRACE_STREAM_MAGIC_SIZE];
+  CodedInputStream coded(input_.get());
+  return coded.ReadRaw(magic, sizeof(magic)) &&
+    memcmp(magic, TRACE_STREAM_MAGIC, sizeof(magic)) == 0;
+}
+
+bool TraceStreamReader::Next(bbtrace::TraceChunk *chunk) {
+  if (input_ == NULL) {
+    return false;
+  }
+
+  // Peek at the input: the file may only end after the end chunk
+  const void *data;
+  int size_data = 0;
+  while (size_data == 0) {
+    if (!input_->Next(&data, &size_data)) {
+      return Stop(true);
+    }
+  }
+  input_->BackUp(size_data);
+
+  // Unread data is given back to input_ when the coded stream is destroyed.
+  // Using a new one for each chunk also keeps its total bytes limit per-chunk
+  CodedInputStream coded(input_.get());
+  uint32_t size;
+  if (!coded.ReadVarint32(&size)) {
+    return Stop(true);
+  }
+
+  CodedInputStream::Limit limit = coded.PushLimit(size);
+  if (!chunk->ParseFromCodedStream(&coded) || !coded.ConsumedEntireMessage()) {
+    return Stop(true);
+  }
+  coded.PopLimit(limit);
+
+  if (chunk->end()) {
+    return Stop(false);
+  }
+  return true;
+}
+
+bool TraceStreamReader::Stop(bool error) {
+  error_ = error;
+  Close();
+  return false;
+}
+
+void TraceStreamReader::Close() {
+  input_.reset();
+}
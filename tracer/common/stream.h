@@ -0,0 +1,68 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Streaming trace files, written and read one chunk at a time (see
+// TraceChunk in bbtrace.proto).
+//
+
+#ifndef _COMMON_STREAM_H
+#define _COMMON_STREAM_H
+
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+
+#include <memory>
+#include <string>
+
+#include "./bbtrace.pb.h"
+
+#define TRACE_STREAM_MAGIC "BBTS"
+#define TRACE_STREAM_MAGIC_SIZE 4
+
+class TraceStreamWriter {
+ public:
+  explicit TraceStreamWriter();
+  ~TraceStreamWriter();
+
+  // Create (or truncate) filename and write the stream magic
+  bool Open(const std::string &filename);
+
+  // Append a chunk to the stream
+  bool Write(const bbtrace::TraceChunk &chunk);
+
+  // Write the end chunk, flush buffered data and close the file. Streams
+  // closed without Finish() (e.g., on errors) read as truncated
+  bool Finish();
+
+  // Flush buffered data and close the file
+  bool Close();
+
+ private:
+  std::unique_ptr<google::protobuf::io::FileOutputStream> output_;
+};
+
+class TraceStreamReader {
+ public:
+  explicit TraceStreamReader();
+  ~TraceStreamReader();
+
+  // Open filename, checking the stream magic
+  bool Open(const std::string &filename);
+
+  // Read the next chunk. Return false at the end of the stream, or if the
+  // stream is truncated or malformed: error() tells which
+  bool Next(bbtrace::TraceChunk *chunk);
+
+  // The stream is truncated (it ends before its end chunk), or malformed
+  bool error() const { return error_; }
+
+  void Close();
+
+ private:
+  // Stop reading, because of an error or not. Return false
+  bool Stop(bool error);
+
+  std::unique_ptr<google::protobuf::io::FileInputStream> input_;
+  bool error_;
+};
+
+#endif  // _COMMON_STREAM_H
@@ -0,0 +1,247 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Write a synthetic execution trace in each format (protobuf, streaming and
+// compact), load it back and compare it with the original.
+//
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "./load.h"
+#include "./serialize.h"
+
+// Unlike CHECK(), also evaluated with NDEBUG
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,  \
+              #cond);                                                   \
+      exit(1);                                                          \
+    }                                                                   \
+  } while (0)
+
+// Enough edges to span several stream chunks and compact blocks
+static const int TRACE_EDGES = 10000;
+
+static void build_trace(ExecutionTrace *trace) {
+  trace->timestamp = 1234567890;
+  trace->module_relative = true;
+  trace->hang = TraceHangIdle;
+
+  for (int i = 0; i < TRACE_EDGES; i++) {
+    // Scattered addresses, some hits above 8 bits, and a saturated counter
+    target_addr prev = 0x400000 + (i * 7919) % 65536;
+    target_addr next = 0x7f0000000000ULL + i * 16;
+    uint64_t hit = (i % 10 == 0) ? 100000 + i : 1 + i % 5;
+    if (i == 0) {
+      hit = 0xffffffffULL;
+    }
+    trace->basic_blocks.AddEdge(prev, next, hit);
+  }
+
+  trace->tasks[task_id(100, 100)].AddEdge(0x400000, 0x400010, 3);
+  trace->tasks[task_id(100, 101)].AddEdge(0x400020, 0x400030, 1);
+  trace->tasks[task_id(100, 101)].AddEdge(0x400040, 0x400050, 2);
+
+  std::shared_ptr<Exception> exc =
+    std::make_shared<Exception>(101, ExceptionAccessViolation, 0x401234,
+                                0xdeadbeef, ExceptionFaultyWrite);
+  exc->stacktrace_push(0x401234);
+  exc->stacktrace_push(0x402000);
+  exc->set_signatures(0x1122334455667788ULL, 0x99aabbccddeeff00ULL);
+  trace->exceptions.push_back(exc);
+
+  MemoryRegion region;
+  region.base = 0x400000;
+  region.size = 0x10000;
+  region.filename = "/bin/target";
+  trace->memory_regions.push_back(region);
+  region.base = 0x7f0000000000ULL;
+  region.size = 0x200000;
+  region.filename = "/lib/libc.so.6";
+  trace->memory_regions.push_back(region);
+
+  trace->ring_stats.pages = 128;
+  trace->ring_stats.watermark = 4096;
+  trace->ring_stats.lost = 2;
+  trace->ring_stats.wakeups = 17;
+  trace->ring_stats.drains = 16;
+  trace->ring_stats.drained_bytes = 1 << 20;
+  trace->ring_stats.max_drain = 65536;
+}
+
+static void compare_edges(const BBMap &a, const BBMap &b) {
+  CHECK(a.size() == b.size());
+  bbmap_iterator it_b = b.map_begin();
+  for (bbmap_iterator it_a = a.map_begin(); it_a != a.map_end();
+       it_a++, it_b++) {
+    CHECK(it_a->first == it_b->first);
+    CHECK(it_a->second == it_b->second);
+  }
+  CHECK(a.coverage_hash() == b.coverage_hash());
+}
+
+static void compare_trace(const ExecutionTrace &a, const ExecutionTrace &b,
+                          bool tasks) {
+  CHECK(a.timestamp == b.timestamp);
+  CHECK(a.module_relative == b.module_relative);
+  CHECK(a.hang == b.hang);
+  compare_edges(a.basic_blocks, b.basic_blocks);
+
+  if (tasks) {
+    CHECK(a.tasks.size() == b.tasks.size());
+    for (auto it = a.tasks.begin(); it != a.tasks.end(); it++) {
+      CHECK(b.tasks.count(it->first) == 1);
+      compare_edges(it->second, b.tasks.find(it->first)->second);
+    }
+  } else {
+    CHECK(b.tasks.empty());
+  }
+
+  CHECK(a.exceptions.size() == b.exceptions.size());
+  for (size_t i = 0; i < a.exceptions.size(); i++) {
+    const Exception &x = *a.exceptions[i];
+    const Exception &y = *b.exceptions[i];
+    CHECK(x.tid() == y.tid() && x.type() == y.type() && x.pc() == y.pc());
+    CHECK(x.faulty_addr() == y.faulty_addr());
+    CHECK(x.faulty_type() == y.faulty_type());
+    CHECK(x.stacktrace() == y.stacktrace());
+    CHECK(x.signature() == y.signature());
+    CHECK(x.fuzzy_signature() == y.fuzzy_signature());
+  }
+
+  CHECK(a.memory_regions.size() == b.memory_regions.size());
+  for (size_t i = 0; i < a.memory_regions.size(); i++) {
+    CHECK(a.memory_regions[i].base == b.memory_regions[i].base);
+    CHECK(a.memory_regions[i].size == b.memory_regions[i].size);
+    CHECK(a.memory_regions[i].filename == b.memory_regions[i].filename);
+  }
+
+  const RingStats &x = a.ring_stats;
+  const RingStats &y = b.ring_stats;
+  CHECK(x.pages == y.pages && x.watermark == y.watermark);
+  CHECK(x.lost == y.lost && x.wakeups == y.wakeups);
+  CHECK(x.drains == y.drains && x.drained_bytes == y.drained_bytes);
+  CHECK(x.max_drain == y.max_drain);
+}
+
+// Write the trace, load it back, and check the sorted edge array as well
+static void check_format(const ExecutionTrace &trace, TraceFormat format,
+                         const std::string &filename) {
+  bool ok = serialize_trace_format(filename, trace, format);
+  CHECK(ok);
+
+  ExecutionTrace loaded;
+  ok = load_execution_trace(filename, &loaded);
+  CHECK(ok);
+  compare_trace(trace, loaded, format != TraceFormatCompact);
+
+  std::vector<compact_edge> edges;
+  ok = load_trace_edges(filename, &edges);
+  CHECK(ok);
+  CHECK(static_cast<int>(edges.size()) == trace.basic_blocks.size());
+  bbmap_iterator it = trace.basic_blocks.map_begin();
+  for (size_t i = 0; i < edges.size(); i++, it++) {
+    CHECK(edges[i].prev == it->first.first);
+    CHECK(edges[i].next == it->first.second);
+    CHECK(edges[i].hit == it->second);
+  }
+
+  // Converting again gives the same trace
+  std::string copy = filename + ".copy";
+  ok = serialize_trace_format(copy, loaded, format);
+  CHECK(ok);
+  ExecutionTrace reloaded;
+  ok = load_execution_trace(copy, &reloaded);
+  CHECK(ok);
+  compare_trace(loaded, reloaded, format != TraceFormatCompact);
+
+  unlink(filename.c_str());
+  unlink(copy.c_str());
+}
+
+// A stream cut anywhere, even right before its end chunk, does not load
+static void check_truncated_stream(const ExecutionTrace &trace,
+                                   const std::string &filename) {
+  bool ok = serialize_trace_format(filename, trace, TraceFormatStream);
+  CHECK(ok);
+  struct stat st;
+  int ret = stat(filename.c_str(), &st);
+  CHECK(ret == 0);
+
+  // The end chunk takes 3 bytes: its size, a tag and a boolean
+  off_t sizes[] = { st.st_size - 1, st.st_size - 3, st.st_size / 2, 5 };
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    ret = truncate(filename.c_str(), sizes[i]);
+    CHECK(ret == 0);
+    ExecutionTrace loaded;
+    ok = load_execution_trace(filename, &loaded);
+    CHECK(!ok);
+    std::vector<compact_edge> edges;
+    ok = load_trace_edges(filename, &edges);
+    CHECK(!ok);
+  }
+  unlink(filename.c_str());
+}
+
+// A compact trace with a corrupt block (here, the last varints of its edge
+// data, at the end of the file, never end) does not load
+static void check_corrupt_compact(const ExecutionTrace &trace,
+                                  const std::string &filename) {
+  bool ok = serialize_trace_format(filename, trace, TraceFormatCompact);
+  CHECK(ok);
+
+  FILE *f = fopen(filename.c_str(), "r+b");
+  CHECK(f != NULL);
+  const unsigned char garbage[8] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+  };
+  int ret = fseek(f, -static_cast<long>(sizeof(garbage)), SEEK_END);
+  CHECK(ret == 0);
+  size_t n = fwrite(garbage, 1, sizeof(garbage), f);
+  CHECK(n == sizeof(garbage));
+  ret = fclose(f);
+  CHECK(ret == 0);
+
+  ExecutionTrace loaded;
+  ok = load_execution_trace(filename, &loaded);
+  CHECK(!ok);
+  std::vector<compact_edge> edges;
+  ok = load_trace_edges(filename, &edges);
+  CHECK(!ok);
+  unlink(filename.c_str());
+}
+
+int main(int argc, char **argv) {
+  char dirname[] = "/tmp/trace_test.XXXXXX";
+  if (mkdtemp(dirname) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+  std::string dir(dirname);
+
+  ExecutionTrace trace;
+  build_trace(&trace);
+  check_format(trace, TraceFormatProtobuf, dir + "/trace.pb");
+  check_format(trace, TraceFormatStream, dir + "/trace.stream");
+  check_format(trace, TraceFormatCompact, dir + "/trace.compact");
+  check_truncated_stream(trace, dir + "/truncated.stream");
+  check_corrupt_compact(trace, dir + "/corrupt.compact");
+
+  // An empty trace survives the round trip too
+  ExecutionTrace empty;
+  empty.timestamp = 1;
+  check_format(empty, TraceFormatProtobuf, dir + "/empty.pb");
+  check_format(empty, TraceFormatStream, dir + "/empty.stream");
+  check_format(empty, TraceFormatCompact, dir + "/empty.compact");
+
+  rmdir(dirname);
+  printf("trace_test: ok\n");
+  return 0;
+}
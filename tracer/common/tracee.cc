@@ -0,0 +1,164 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+
+#include "./tracee.h"
+
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/user.h>
+#include <cerrno>
+#include <cinttypes>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "./logging.h"
+
+static const int MAX_STACKTRACE_SIZE = 16;
+
+pid_t tracee_start(char **argv, int fd_input) {
+  pid_t pid;
+
+  pid = fork();
+  if (pid == -1) {
+    LOG_WARN("Error starting the target: %s", strerror(errno));
+    return -1;
+  }
+
+  if (pid == 0) {
+    // Child. It only leaves through _exit(): exit() would run the handlers
+    // of the tracer
+    if (ptrace(PTRACE_TRACEME, 0, 0, 0) == -1) {
+      _exit(TRACEE_EXEC_FAILED);
+    }
+
+    if (fd_input != -1 && dup2(fd_input, STDIN_FILENO) == -1) {
+      _exit(TRACEE_EXEC_FAILED);
+    }
+
+    raise(SIGTRAP);
+    execvp(argv[0], argv);
+    _exit(TRACEE_EXEC_FAILED);
+  }
+
+  // Parent
+  return pid;
+}
+
+bool tracee_is_fatal(int signum) {
+  switch (signum) {
+  case SIGSEGV:
+  case SIGBUS:
+  case SIGILL:
+  case SIGFPE:
+  case SIGABRT:
+  case SIGSYS:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool tracee_catches(pid_t pid, int signum) {
+  char filename[64];
+  snprintf(filename, sizeof(filename), "/proc/%d/status", pid);
+
+  FILE *f = fopen(filename, "r");
+  if (f == NULL) {
+    return false;
+  }
+
+  // Masks of ignored and caught signals, in hex
+  uint64_t mask = 0, value;
+  char line[256];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (sscanf(line, "SigIgn: %" SCNx64, &value) == 1 ||
+        sscanf(line, "SigCgt: %" SCNx64, &value) == 1) {
+      mask |= value;
+    }
+  }
+  fclose(f);
+
+  return (mask & (1ULL << (signum - 1))) != 0;
+}
+
+// Read a word of the memory of task pid. PTRACE_PEEKDATA returns -1 both on
+// errors and for words holding -1
+static bool tracee_peek(pid_t pid, target_addr addr, target_addr *value) {
+  errno = 0;
+  long word = ptrace(PTRACE_PEEKDATA, pid, addr, NULL);
+  if (word == -1 && errno != 0) {
+    return false;
+  }
+  *value = word;
+  return true;
+}
+
+std::shared_ptr<Exception> tracee_exception(pid_t pid) {
+  LOG_DEBUG("Read signal info (pid %d)", pid);
+  siginfo_t si;
+  if (ptrace(PTRACE_GETSIGINFO, pid, NULL, &si) == -1) {
+    return NULL;
+  }
+
+  // Exception type
+  ExceptionType exc_type;
+  target_addr exc_faulty;
+
+  switch (si.si_signo) {
+  case SIGSEGV:
+    exc_type = ExceptionAccessViolation;
+    exc_faulty = reinterpret_cast<target_addr>(si.si_addr);
+    break;
+  default:
+    exc_type = ExceptionUnknown;
+    exc_faulty = 0;
+    break;
+  }
+
+  LOG_DEBUG("Reading child registers (pid %d)", pid);
+  struct user_regs_struct regs;
+  if (ptrace(PTRACE_GETREGS, pid, NULL, &regs) == -1) {
+    return NULL;
+  }
+
+  std::shared_ptr<Exception>
+    exc(new Exception(pid, exc_type, regs.rip, exc_faulty, 0));
+
+  // Generate a stack trace for this process, following the chain of saved
+  // frame pointers: each frame holds the frame pointer of its caller, then
+  // the return address
+  target_addr fp = regs.rbp;
+  LOG_DEBUG("Starting stack walking at 0x%016lx", fp);
+
+  for (int i = 0; i < MAX_STACKTRACE_SIZE; i++) {
+    // Code built without frame pointers leaves anything in rbp
+    if (fp == 0 || fp % sizeof(target_addr) != 0) {
+      break;
+    }
+
+    target_addr next, retaddr;
+    if (!tracee_peek(pid, fp, &next) ||
+        !tracee_peek(pid, fp + sizeof(target_addr), &retaddr)) {
+      LOG_DEBUG("Failed reading %d-th stack frame @0x%lx, giving up", i, fp);
+      break;
+    }
+    if (retaddr == 0) {
+      break;
+    }
+
+    // Save this return address
+    exc->stacktrace_push(retaddr);
+    LOG_DEBUG("ret%d @0x%lx -> 0x%lx", i, fp+sizeof(target_addr), retaddr);
+
+    // Callers' frames are higher up the stack: anything else is not a frame
+    if (next <= fp) {
+      break;
+    }
+    fp = next;
+  }
+
+  return exc;
+}
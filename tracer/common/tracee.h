@@ -0,0 +1,41 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Helpers shared by the ptrace()-based tracers (BTS and breakpoints): start a
+// traced child, and capture the exceptions of stopped tasks.
+//
+
+#ifndef _COMMON_TRACEE_H
+#define _COMMON_TRACEE_H
+
+#include <unistd.h>
+
+#include <memory>
+
+#include "./exception.h"
+
+// Exit status of a child that could not execute its target (as in shells)
+#define TRACEE_EXEC_FAILED 127
+
+// Start a traced child process, stopped (by SIGTRAP) before executing argv.
+// If fd_input is not -1, it becomes the standard input of the child. Return
+// -1 if the child cannot be created; a child that cannot execute argv exits
+// with status TRACEE_EXEC_FAILED
+pid_t tracee_start(char **argv, int fd_input);
+
+// Signals that terminate the target with a crash
+bool tracee_is_fatal(int signum);
+
+// Check if task pid catches or ignores signal signum, i.e., if delivering it
+// does not terminate the task
+bool tracee_catches(pid_t pid, int signum);
+
+// Describe the signal task pid is stopped by (in signal-delivery-stop), with
+// a stack trace built by walking frame pointers from rbp. The walk stops at
+// the first frame that is unreadable or not above the previous one, so
+// targets built without frame pointers get short (or empty) stack traces
+// rather than stack garbage. Return NULL if the task cannot be inspected
+// (e.g., it has been killed meanwhile)
+std::shared_ptr<Exception> tracee_exception(pid_t pid);
+
+#endif  // _COMMON_TRACEE_H
@@ -0,0 +1,46 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// LEB128 varints and zigzag encoding, as used by the compact trace and index
+// files.
+//
+
+#ifndef _COMMON_VARINT_H
+#define _COMMON_VARINT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+static inline void varint_put(std::string *out, uint64_t value) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+// Decode a varint, without reading past end. Return NULL if truncated
+static inline const unsigned char *
+varint_get(const unsigned char *p, const unsigned char *end, uint64_t *value) {
+  uint64_t v = 0;
+  for (int shift = 0; shift < 64 && p < end; shift += 7) {
+    unsigned char b = *p++;
+    v |= static_cast<uint64_t>(b & 0x7f) << shift;
+    if ((b & 0x80) == 0) {
+      *value = v;
+      return p;
+    }
+  }
+  return NULL;
+}
+
+static inline uint64_t varint_zigzag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^ (value >> 63);
+}
+
+static inline int64_t varint_unzigzag(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+#endif  // _COMMON_VARINT_H
@@ -0,0 +1,186 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+
+#include "./watchdog.h"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+
+#include "./logging.h"
+
+// Interrupting system calls is all the signal is for
+static void watchdog_handler(int signum) {
+}
+
+// Watchdogs share the handler of WATCHDOG_SIGNAL: the first one started
+// installs it, and the last one stopped restores the handler of the host
+static std::mutex gbl_handler_lock;
+static int gbl_handler_users = 0;
+static struct sigaction gbl_handler_saved;
+
+static bool watchdog_handler_acquire() {
+  std::lock_guard<std::mutex> lock(gbl_handler_lock);
+  if (gbl_handler_users == 0) {
+    // No SA_RESTART: the interrupted system call must return to the tracer
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = watchdog_handler;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(WATCHDOG_SIGNAL, &action, &gbl_handler_saved) == -1) {
+      return false;
+    }
+  }
+  gbl_handler_users++;
+  return true;
+}
+
+static void watchdog_handler_release() {
+  std::lock_guard<std::mutex> lock(gbl_handler_lock);
+  if (--gbl_handler_users == 0) {
+    sigaction(WATCHDOG_SIGNAL, &gbl_handler_saved, NULL);
+  }
+}
+
+Watchdog::Watchdog()
+  : timeout_ms_(0), idle_ms_(0), timer_fd_(-1), stop_fd_(-1),
+    stopping_(false), progress_(0), hang_(TraceHangNone) {
+}
+
+Watchdog::~Watchdog() {
+  Stop();
+}
+
+bool Watchdog::Start(unsigned int timeout_ms, unsigned int idle_ms) {
+  Stop();
+  hang_ = TraceHangNone;
+  if (timeout_ms == 0 && idle_ms == 0) {
+    return true;
+  }
+
+  // Check a few times within the shortest limit
+  unsigned int tick_ms = WATCHDOG_MAX_TICK_MS;
+  if (timeout_ms > 0) {
+    tick_ms = std::min(tick_ms, timeout_ms / 4);
+  }
+  if (idle_ms > 0) {
+    tick_ms = std::min(tick_ms, idle_ms / 4);
+  }
+  tick_ms = std::max(tick_ms, 1U);
+
+  struct itimerspec spec;
+  spec.it_interval.tv_sec = tick_ms / 1000;
+  spec.it_interval.tv_nsec = (tick_ms % 1000) * 1000000L;
+  spec.it_value = spec.it_interval;
+
+  timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  stop_fd_ = eventfd(0, EFD_CLOEXEC);
+  if (timer_fd_ == -1 || stop_fd_ == -1 ||
+      timerfd_settime(timer_fd_, 0, &spec, NULL) == -1 ||
+      !watchdog_handler_acquire()) {
+    LOG_WARN("Error starting the watchdog: %s", strerror(errno));
+    Close();
+    return false;
+  }
+
+  timeout_ms_ = timeout_ms;
+  idle_ms_ = idle_ms;
+  target_ = pthread_self();
+  stopping_ = false;
+  thread_ = std::thread(&Watchdog::Run, this);
+  return true;
+}
+
+void Watchdog::Stop() {
+  if (!thread_.joinable()) {
+    return;
+  }
+
+  // The thread also notices stopping_ at its next tick
+  stopping_ = true;
+  uint64_t value = 1;
+  if (write(stop_fd_, &value, sizeof(value)) != sizeof(value)) {
+    LOG_DEBUG("Error waking up the watchdog: %s", strerror(errno));
+  }
+  thread_.join();
+
+  watchdog_handler_release();
+  Close();
+}
+
+void Watchdog::Close() {
+  if (timer_fd_ != -1) {
+    close(timer_fd_);
+  }
+  if (stop_fd_ != -1) {
+    close(stop_fd_);
+  }
+  timer_fd_ = stop_fd_ = -1;
+}
+
+void Watchdog::Run() {
+  struct pollfd fds[2];
+  fds[0].fd = stop_fd_;
+  fds[0].events = POLLIN;
+  fds[1].fd = timer_fd_;
+  fds[1].events = POLLIN;
+
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point last_progress = start;
+  uint64_t progress = progress_.load(std::memory_order_relaxed);
+
+  while (1) {
+    int ret = poll(fds, 2, -1);
+    if (ret == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // The run goes on without a time budget
+      LOG_WARN("Error polling the watchdog timer: %s", strerror(errno));
+      return;
+    }
+
+    if (fds[0].revents != 0 || stopping_) {
+      break;
+    }
+
+    uint64_t expirations;
+    if (read(timer_fd_, &expirations, sizeof(expirations)) !=
+        sizeof(expirations)) {
+      continue;
+    }
+
+    std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+    if (hang_ == TraceHangNone) {
+      uint64_t current = progress_.load(std::memory_order_relaxed);
+      if (current != progress) {
+        progress = current;
+        last_progress = now;
+      }
+
+      if (timeout_ms_ > 0 &&
+          now - start >= std::chrono::milliseconds(timeout_ms_)) {
+        hang_ = TraceHangTimeout;
+      } else if (idle_ms_ > 0 &&
+                 now - last_progress >= std::chrono::milliseconds(idle_ms_)) {
+        hang_ = TraceHangIdle;
+      }
+    }
+
+    // The signal may arrive right before the tracer blocks: repeat it until
+    // the tracer stops watching
+    if (hang_ != TraceHangNone) {
+      pthread_kill(target_, WATCHDOG_SIGNAL);
+    }
+  }
+}
@@ -0,0 +1,75 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Time budget of a traced run, shared by the ptrace()-based tracers.
+//
+// A watchdog thread wakes up periodically (on a timerfd) while the target
+// runs. Once the run has used up its time budget, or has made no progress
+// (e.g., no new edges) for too long, it keeps interrupting the thread that
+// started it with WATCHDOG_SIGNAL: blocking system calls of that thread, such
+// as wait4(), fail with EINTR, and the tracer checks hang() to kill the
+// target.
+//
+// The handler of WATCHDOG_SIGNAL is process-wide: it is installed when the
+// first watchdog starts, and the previous one is restored when the last
+// watchdog stops. Programs that embed a tracer must leave that signal alone
+// while tracing.
+//
+
+#ifndef _COMMON_WATCHDOG_H
+#define _COMMON_WATCHDOG_H
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <thread>
+
+#include "./serialize.h"
+
+// A real-time signal, unlike SIGALRM rarely used by the host program
+#define WATCHDOG_SIGNAL (SIGRTMIN + 4)
+
+// Longest interval between two checks, in milliseconds
+#define WATCHDOG_MAX_TICK_MS 10
+
+class Watchdog {
+ public:
+  explicit Watchdog();
+  ~Watchdog();
+
+  // Start watching a run for the calling thread: the run hangs after
+  // timeout_ms milliseconds, or after idle_ms milliseconds without progress
+  // (0: no limit). Without limits, no thread is started. Return false if
+  // the watchdog cannot be started
+  bool Start(unsigned int timeout_ms, unsigned int idle_ms);
+
+  // Stop watching. The verdict is kept until the next Start()
+  void Stop();
+
+  // Report progress of the run. Can be invoked by any thread
+  void Progress() { progress_.fetch_add(1, std::memory_order_relaxed); }
+
+  // Why the run hangs (TraceHangNone: it does not, or not yet)
+  TraceHang hang() const { return hang_.load(); }
+
+ private:
+  // Body of the watchdog thread
+  void Run();
+
+  // Close the timer and the stop eventfd
+  void Close();
+
+  unsigned int timeout_ms_;
+  unsigned int idle_ms_;
+  pthread_t target_;            // Thread to interrupt
+  int timer_fd_;
+  int stop_fd_;
+  std::atomic<bool> stopping_;  // Stop() has been invoked
+  std::thread thread_;
+  std::atomic<uint64_t> progress_;
+  std::atomic<TraceHang> hang_;
+};
+
+#endif  // _COMMON_WATCHDOG_H
@@ -2,12 +2,10 @@
 // Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
 //
 
-#include <algorithm>
 #include <string>
-#include <utility>
-#include <vector>
 
 #include "images.H"
+#include "common/filter.h"
 #include "common/serialize.h"
 
 extern ExecutionTrace gbl_execution_trace;
@@ -25,41 +23,31 @@ static const std::string gbl_bad_images[] = {
 #endif
 };
 
-// Vector of std::string for blacklisted memory images
-static const std::vector<std::string> gbl_img_blacklist(
-  gbl_bad_images,
-  gbl_bad_images + sizeof(gbl_bad_images) / sizeof(gbl_bad_images[0])
-);
+// Images to trace: all of them, except the blacklisted ones and those
+// excluded from the command line
+static AddressFilter gbl_address_filter;
 
-// Lower/upper bounds of active images (i.e., those we are interested to trace)
-static std::vector<std::pair<ADDRINT, ADDRINT> > gbl_img_active;
+VOID Images_InitFilter() {
+  gbl_address_filter.IncludeAllImages();
+  for (size_t i = 0; i < sizeof(gbl_bad_images) / sizeof(gbl_bad_images[0]);
+       i++) {
+    gbl_address_filter.AddImageRule(false, gbl_bad_images[i]);
+  }
+}
+
+BOOL Images_AddFilterRule(BOOL include, const std::string &rule) {
+  return gbl_address_filter.AddRule(include, rule);
+}
 
 BOOL Images_IsInterestingAddress(ADDRINT addr) {
-  BOOL b = FALSE;
-  for (std::vector<std::pair<ADDRINT, ADDRINT> >::iterator it =
-         gbl_img_active.begin();
-       it != gbl_img_active.end();
-       it++) {
-    if (addr >= it->first && addr <= it->second) {
-      b = TRUE;
-      break;
-    }
-  }
-  return b;
+  return gbl_address_filter.IsInteresting(addr);
 }
 
 VOID Images_CallbackNewImage(IMG img, VOID *v) {
-  // Check if the image is blacklisted
-  const std::string name = IMG_Name(img);
-  if (std::find(gbl_img_blacklist.begin(), gbl_img_blacklist.end(), name)
-      !=  gbl_img_blacklist.end()) {
-    return;
-  }
-
-  // Otherwise, add the image address range to the global "gbl_img_active"
-  // vector, to keep track of which instructions must be processed
-  std::pair<ADDRINT, ADDRINT> range(IMG_LowAddress(img), IMG_HighAddress(img));
-  gbl_img_active.push_back(range);
+  // Let the filter decide which instructions of the image must be processed
+  gbl_address_filter.AddImage(IMG_LowAddress(img),
+                              IMG_HighAddress(img) - IMG_LowAddress(img) + 1,
+                              IMG_Name(img));
 
   MemoryRegion region;
   region.base = IMG_LowAddress(img);
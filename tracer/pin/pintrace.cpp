@@ -13,7 +13,9 @@
 #include "pin.H"
 
 #include "common/bbmap.h"
+#include "common/crash.h"
 #include "common/exception.h"
+#include "common/regions.h"
 #include "common/serialize.h"
 #include "images.H"
 
@@ -38,6 +40,12 @@ static std::map<THREADID, ADDRINT> gbl_last_bb;
 // Command line switches
 KNOB<string> gbl_outfile(KNOB_MODE_WRITEONCE, "pintool", "f", DEFAULT_OUTFILE,
                          "specify file name for FuzzTrace output");
+KNOB<BOOL> gbl_relative(KNOB_MODE_WRITEONCE, "pintool", "r", "0",
+                        "store module-relative edges, stable across runs");
+KNOB<string> gbl_include(KNOB_MODE_APPEND, "pintool", "i", "",
+                         "trace only this image or 0xSTART-0xEND range");
+KNOB<string> gbl_exclude(KNOB_MODE_APPEND, "pintool", "x", "",
+                         "do not trace this image or 0xSTART-0xEND range");
 
 // Print help message
 INT32 Usage() {
@@ -127,6 +135,11 @@ BOOL CallbackSignalLinux(THREADID tid, INT32 sig, CONTEXT *ctxt,
 VOID CallbackFini(INT32 code, VOID *v) {
   string filename = gbl_outfile.Value();
 
+  if (gbl_relative.Value()) {
+    regions_relocate_trace(&gbl_execution_trace);
+  }
+
+  crash_sign_trace(&gbl_execution_trace);
   serialize_trace(filename, gbl_execution_trace);
 }
 
@@ -136,6 +149,18 @@ int main(int argc, char **argv) {
     return Usage();
   }
 
+  Images_InitFilter();
+  for (UINT32 i = 0; i < gbl_include.NumberOfValues(); i++) {
+    if (!Images_AddFilterRule(TRUE, gbl_include.Value(i))) {
+      return Usage();
+    }
+  }
+  for (UINT32 i = 0; i < gbl_exclude.NumberOfValues(); i++) {
+    if (!Images_AddFilterRule(FALSE, gbl_exclude.Value(i))) {
+      return Usage();
+    }
+  }
+
   IMG_AddInstrumentFunction(Images_CallbackNewImage, 0);
   TRACE_AddInstrumentFunction(CallbackTrace, 0);
 
@@ -0,0 +1,409 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Corpus minimization: select a subset of the traces (and of the inputs they
+// were recorded from) that covers all the edges, or all the (edge, hit-count
+// bucket) pairs, of the whole corpus, preferring cheap inputs.
+//
+// Every distinct edge (or pair) gets an id in a global dictionary, and each
+// trace becomes a set of ids: a bitset over the dictionary for traces that
+// cover a large part of it, a list of delta-encoded varint ids otherwise.
+// The subset is chosen by a lazy greedy weighted set cover: the trace with
+// the best ratio of newly covered ids to weight is selected at each step,
+// and stale ratios at the top of the queue are re-evaluated in parallel.
+//
+
+#include <getopt.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common/bbmap.h"
+#include "common/load.h"
+#include "common/logging.h"
+#include "common/parallel.h"
+#include "common/varint.h"
+
+enum CminWeight {
+  CminWeightHits,               // Total hits of the trace (execution time)
+  CminWeightSize,               // Size of the input file
+  CminWeightCount,              // Number of inputs
+};
+
+// A coverage element: an edge, and the hit-count bucket of the trace
+struct cmin_key {
+  uint64_t prev;
+  uint64_t next;
+  uint32_t bucket;
+
+  bool operator==(const cmin_key &other) const {
+    return prev == other.prev && next == other.next && bucket == other.bucket;
+  }
+};
+
+struct cmin_key_hash {
+  size_t operator()(const cmin_key &k) const {
+    uint64_t h = k.prev * 0x9e3779b97f4a7c15ULL;
+    h ^= (k.next + k.bucket) + (h << 6) + (h >> 2);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return static_cast<size_t>(h);
+  }
+};
+
+// Concurrent dictionary of coverage elements, split in independently locked
+// shards. Ids are dense, in order of first insertion
+class CminDictionary {
+ public:
+  explicit CminDictionary() : size_(0) {}
+
+  uint32_t Lookup(const cmin_key &key) {
+    size_t h = cmin_key_hash()(key);
+    shard &s = shards_[(h >> 32) % kShards];
+    std::lock_guard<std::mutex> lock(s.lock);
+    std::pair<std::unordered_map<cmin_key, uint32_t, cmin_key_hash>::iterator,
+              bool> it = s.ids.insert(std::make_pair(key, 0));
+    if (it.second) {
+      it.first->second = size_++;
+    }
+    return it.first->second;
+  }
+
+  uint32_t size() const { return size_; }
+
+ private:
+  static const int kShards = 64;
+
+  struct shard {
+    std::mutex lock;
+    std::unordered_map<cmin_key, uint32_t, cmin_key_hash> ids;
+  };
+
+  shard shards_[kShards];
+  std::atomic<uint32_t> size_;
+};
+
+struct cmin_trace {
+  std::string name;
+  std::string input;
+  double weight;
+  uint32_t n_ids;
+  std::vector<uint64_t> bits;   // Dense traces: bitset over the dictionary
+  std::string ids;              // Sparse traces: sorted ids, varint deltas
+};
+
+// Queue entry of the greedy cover. The score is the ratio of newly covered
+// ids to weight, as of the given number of selected traces
+struct cmin_candidate {
+  double score;
+  uint32_t gain;
+  uint32_t trace;
+  uint32_t round;
+};
+
+struct cmin_candidate_less {
+  bool operator()(const cmin_candidate &a, const cmin_candidate &b) const {
+    return a.score < b.score || (a.score == b.score && a.trace > b.trace);
+  }
+};
+
+static unsigned int gbl_threads = 0;
+
+// Invoke f(id) for each id of a trace
+template <typename F>
+static void cmin_for_each_id(const cmin_trace &trace, F f) {
+  if (!trace.bits.empty()) {
+    for (size_t w = 0; w < trace.bits.size(); w++) {
+      uint64_t word = trace.bits[w];
+      while (word != 0) {
+        f(static_cast<uint32_t>(w * 64 + __builtin_ctzll(word)));
+        word &= word - 1;
+      }
+    }
+    return;
+  }
+
+  const unsigned char *p =
+    reinterpret_cast<const unsigned char *>(trace.ids.data());
+  const unsigned char *end = p + trace.ids.size();
+  uint64_t id = 0, delta;
+  while ((p = varint_get(p, end, &delta)) != NULL) {
+    id += delta;
+    f(static_cast<uint32_t>(id));
+  }
+}
+
+// Number of ids of a trace that are not covered yet
+static uint32_t cmin_gain(const cmin_trace &trace,
+                          const std::vector<uint64_t> &covered) {
+  uint32_t gain = 0;
+
+  if (!trace.bits.empty()) {
+    for (size_t w = 0; w < trace.bits.size(); w++) {
+      gain += __builtin_popcountll(trace.bits[w] & ~covered[w]);
+    }
+    return gain;
+  }
+
+  cmin_for_each_id(trace, [&](uint32_t id) {
+      gain += !(covered[id / 64] & (1ULL << (id % 64)));
+    });
+  return gain;
+}
+
+static double cmin_score(uint32_t gain, double weight) {
+  return gain / weight;
+}
+
+// Load a trace and turn it into a list of dictionary ids
+static bool cmin_load(const std::string &filename, bool buckets,
+                      CminDictionary *dictionary, cmin_trace *trace) {
+  std::vector<compact_edge> edges;
+  if (!load_trace_edges(filename, &edges)) {
+    return false;
+  }
+
+  std::vector<uint32_t> ids(edges.size());
+  uint64_t hits = 0;
+  for (size_t i = 0; i < edges.size(); i++) {
+    cmin_key key = { edges[i].prev, edges[i].next,
+                     buckets ? bbmap_bucket(edges[i].hit) : 0 };
+    ids[i] = dictionary->Lookup(key);
+    hits += edges[i].hit;
+  }
+  std::sort(ids.begin(), ids.end());
+
+  for (size_t i = 0; i < ids.size(); i++) {
+    varint_put(&trace->ids, ids[i] - (i > 0 ? ids[i-1] : 0));
+  }
+  trace->n_ids = ids.size();
+  trace->weight = hits;
+  return true;
+}
+
+static void show_help(char **argv) {
+  fprintf(stderr,
+          "Syntax: %s [-b] [-w <weight>] [-i <inputs>] [-r <report>] "
+          "[-j <threads>] <trace|dir>...\n"
+          "\n"
+          "Print the traces (or inputs) of a minimal subset of the corpus\n"
+          "with the same coverage.\n"
+          "\n"
+          "  -b           cover (edge, AFL hit-count bucket) pairs, rather\n"
+          "               than edges only\n"
+          "  -w <weight>  cost of an input: 'hits' (total hits in its trace,\n"
+          "               i.e., execution time; default), 'size' (size of\n"
+          "               the input, requires -i) or 'count'\n"
+          "  -i <inputs>  directory of the inputs: the input of trace\n"
+          "               <name>.trace is <inputs>/<name> (see bts_trace -B)\n"
+          "  -r <report>  write a coverage report to file <report>\n"
+          "  -j <n>       number of threads (default: one per CPU)\n",
+          argv[0]);
+}
+
+int main(int argc, char **argv) {
+  CminWeight weight = CminWeightHits;
+  bool buckets = false;
+  std::string inputs, report;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "bw:i:r:j:h")) != -1) {
+    switch (opt) {
+    case 'b':
+      buckets = true;
+      break;
+    case 'w':
+      if (std::string(optarg) == "hits") {
+        weight = CminWeightHits;
+      } else if (std::string(optarg) == "size") {
+        weight = CminWeightSize;
+      } else if (std::string(optarg) == "count") {
+        weight = CminWeightCount;
+      } else {
+        LOG_FATAL("Unknown weight '%s'", optarg);
+      }
+      break;
+    case 'i':
+      inputs = optarg;
+      break;
+    case 'r':
+      report = optarg;
+      break;
+    case 'j':
+      gbl_threads = strtoul(optarg, NULL, 0);
+      break;
+    default:
+    case 'h':
+      show_help(argv);
+      exit(1);
+    }
+  }
+
+  if (optind == argc || (weight == CminWeightSize && inputs.empty())) {
+    show_help(argv);
+    exit(1);
+  }
+
+  if (gbl_threads == 0) {
+    gbl_threads = parallel_threads();
+  }
+
+  std::vector<std::string> filenames;
+  for (int i = optind; i < argc; i++) {
+    if (!load_collect_traces(argv[i], &filenames)) {
+      LOG_FATAL("Cannot access '%s'", argv[i]);
+    }
+  }
+
+  // Load all the traces as id lists
+  CminDictionary dictionary;
+  std::vector<cmin_trace> traces(filenames.size());
+  std::vector<char> loaded(filenames.size(), 0);
+  parallel_for(filenames.size(), gbl_threads, [&](size_t i) {
+      cmin_trace &trace = traces[i];
+      trace.name = filenames[i];
+      loaded[i] = cmin_load(filenames[i], buckets, &dictionary, &trace);
+      if (!loaded[i] || inputs.empty()) {
+        return;
+      }
+
+      // Map trace <name>.trace to input <name>
+      std::string name = filenames[i].substr(filenames[i].rfind('/') + 1);
+      if (name.size() > 6 && name.compare(name.size() - 6, 6, ".trace") == 0) {
+        name.resize(name.size() - 6);
+      }
+      trace.input = inputs + "/" + name;
+
+      struct stat st;
+      if (weight == CminWeightSize) {
+        loaded[i] = (stat(trace.input.c_str(), &st) == 0);
+        trace.weight = st.st_size;
+      }
+    });
+
+  for (size_t i = 0; i < filenames.size(); i++) {
+    if (!loaded[i]) {
+      LOG_FATAL("Error reading trace '%s' (or its input)",
+                filenames[i].c_str());
+    }
+    if (weight == CminWeightCount) {
+      traces[i].weight = 1;
+    }
+    // Empty inputs and traces still cost something
+    traces[i].weight = std::max(traces[i].weight, 1.0);
+  }
+
+  // Switch to bitsets when they are smaller than id lists
+  uint32_t n_ids = dictionary.size();
+  size_t n_words = (n_ids + 63) / 64;
+  parallel_for(traces.size(), gbl_threads, [&](size_t i) {
+      cmin_trace &trace = traces[i];
+      if (trace.ids.size() <= n_words * sizeof(uint64_t)) {
+        return;
+      }
+      std::vector<uint64_t> bits(n_words, 0);
+      cmin_for_each_id(trace, [&](uint32_t id) {
+          bits[id / 64] |= 1ULL << (id % 64);
+        });
+      trace.bits.swap(bits);
+      std::string().swap(trace.ids);
+    });
+
+  // Lazy greedy cover: scores only decrease as ids are covered, so a
+  // candidate whose score is up to date and still the best can be selected
+  std::priority_queue<cmin_candidate, std::vector<cmin_candidate>,
+                      cmin_candidate_less> queue;
+  for (size_t i = 0; i < traces.size(); i++) {
+    if (traces[i].n_ids > 0) {
+      cmin_candidate c = { cmin_score(traces[i].n_ids, traces[i].weight),
+                           traces[i].n_ids, static_cast<uint32_t>(i), 0 };
+      queue.push(c);
+    }
+  }
+
+  std::vector<uint64_t> covered(n_words, 0);
+  std::vector<cmin_candidate> selected;
+  std::vector<cmin_candidate> stale;
+  uint32_t round = 0;
+
+  while (!queue.empty()) {
+    if (queue.top().round == round) {
+      cmin_candidate c = queue.top();
+      queue.pop();
+      cmin_for_each_id(traces[c.trace], [&](uint32_t id) {
+          covered[id / 64] |= 1ULL << (id % 64);
+        });
+      selected.push_back(c);
+      round++;
+      continue;
+    }
+
+    // Re-evaluate the stale candidates at the top of the queue
+    stale.clear();
+    while (!queue.empty() && queue.top().round != round &&
+           stale.size() < gbl_threads * 4) {
+      stale.push_back(queue.top());
+      queue.pop();
+    }
+    parallel_for(stale.size(), gbl_threads, [&](size_t i) {
+        stale[i].gain = cmin_gain(traces[stale[i].trace], covered);
+        stale[i].score = cmin_score(stale[i].gain,
+                                    traces[stale[i].trace].weight);
+        stale[i].round = round;
+      });
+    for (size_t i = 0; i < stale.size(); i++) {
+      if (stale[i].gain > 0) {
+        queue.push(stale[i]);
+      }
+    }
+  }
+
+  double total_weight = 0, selected_weight = 0;
+  for (size_t i = 0; i < traces.size(); i++) {
+    total_weight += traces[i].weight;
+  }
+  for (size_t i = 0; i < selected.size(); i++) {
+    const cmin_trace &trace = traces[selected[i].trace];
+    selected_weight += trace.weight;
+    printf("%s\n", inputs.empty() ? trace.name.c_str() : trace.input.c_str());
+  }
+
+  LOG_INFO("Selected %zu of %zu traces (%.2f%% of the weight), covering %u "
+           "%s", selected.size(), traces.size(),
+           total_weight > 0 ? 100 * selected_weight / total_weight : 0.0,
+           n_ids, buckets ? "edge/bucket pairs" : "edges");
+
+  if (report.length() > 0) {
+    FILE *f = fopen(report.c_str(), "w");
+    if (f == NULL) {
+      LOG_FATAL("Error writing report file '%s'", report.c_str());
+    }
+
+    fprintf(f, "traces %zu\nselected %zu\n%s %u\nweight %.0f\n"
+            "selected_weight %.0f\n", traces.size(), selected.size(),
+            buckets ? "pairs" : "edges", n_ids, total_weight,
+            selected_weight);
+
+    // Selected traces, in order of selection, with the ids they added
+    fprintf(f, "# trace weight ids new_ids coverage\n");
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < selected.size(); i++) {
+      const cmin_trace &trace = traces[selected[i].trace];
+      cumulative += selected[i].gain;
+      fprintf(f, "%s %.0f %u %u %.2f%%\n", trace.name.c_str(), trace.weight,
+              trace.n_ids, selected[i].gain,
+              n_ids > 0 ? 100.0 * cumulative / n_ids : 0.0);
+    }
+    fclose(f);
+  }
+
+  return 0;
+}
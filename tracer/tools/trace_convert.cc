@@ -0,0 +1,63 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Convert execution traces among the protobuf, streaming and compact formats.
+// The format of the input trace is detected from its magic.
+//
+
+#include <getopt.h>
+#include <cstdio>
+#include <cstdlib>
+
+#include "common/load.h"
+#include "common/logging.h"
+#include "common/serialize.h"
+
+static void show_help(char **argv) {
+  fprintf(stderr,
+          "Syntax: %s [-O <format>] <input> <output>\n"
+          "\n"
+          "  -O <format>    format of the output trace: 'protobuf' (default),\n"
+          "                 'stream' or 'compact'\n",
+          argv[0]);
+}
+
+int main(int argc, char **argv) {
+  TraceFormat format = TraceFormatProtobuf;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "O:h")) != -1) {
+    switch (opt) {
+    case 'O':
+      if (!serialize_parse_format(optarg, &format)) {
+        LOG_FATAL("Unknown trace format '%s'", optarg);
+      }
+      break;
+    default:
+    case 'h':
+      show_help(argv);
+      exit(1);
+    }
+  }
+
+  if (argc - optind != 2) {
+    show_help(argv);
+    exit(1);
+  }
+
+  // Traces are written by the same code as the tracers write them
+  ExecutionTrace trace;
+  if (!load_execution_trace(argv[optind], &trace)) {
+    LOG_FATAL("Error reading trace file '%s'", argv[optind]);
+  }
+
+  if (format == TraceFormatCompact && trace.tasks.size() > 1) {
+    LOG_WARN("Per-task edges are not stored in compact traces");
+  }
+
+  if (!serialize_trace_format(argv[optind+1], trace, format)) {
+    LOG_FATAL("Error writing trace file '%s'", argv[optind+1]);
+  }
+
+  return 0;
+}
@@ -0,0 +1,203 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Crash deduplication: assign the crash of each trace (its last exception)
+// to a bucket of a persistent index, by crash signature (see common/crash.h
+// and common/bucket.h). Signatures stored in the traces are used as they
+// are; older traces are signed from their stack traces and memory regions.
+//
+
+#include <sys/stat.h>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "common/bucket.h"
+#include "common/crash.h"
+#include "common/load.h"
+#include "common/logging.h"
+#include "common/parallel.h"
+
+enum CrashStatus {
+  CrashStatusError,             // Unreadable trace
+  CrashStatusNone,              // The trace has no exceptions
+  CrashStatusStored,            // Signatures read from the trace
+  CrashStatusComputed,          // Signatures computed from the stack trace
+};
+
+struct crash_info {
+  CrashStatus status;
+  uint64_t signature;
+  uint64_t fuzzy_signature;
+};
+
+// Read (or compute) the signatures of the last exception of a trace
+static void crash_load(const std::string &filename, crash_info *info) {
+  bbtrace::Trace trace;
+  if (!load_trace_exceptions(filename, &trace)) {
+    info->status = CrashStatusError;
+    return;
+  }
+  if (trace.exception_size() == 0) {
+    info->status = CrashStatusNone;
+    return;
+  }
+
+  const bbtrace::Exception &exc = trace.exception(trace.exception_size() - 1);
+  if (exc.has_signature()) {
+    info->status = CrashStatusStored;
+    info->signature = exc.signature();
+    info->fuzzy_signature = exc.fuzzy_signature();
+    return;
+  }
+
+  std::vector<MemoryRegion> regions(trace.region_size());
+  for (int i = 0; i < trace.region_size(); i++) {
+    regions[i].base = trace.region(i).base();
+    regions[i].size = trace.region(i).size();
+    regions[i].filename = trace.region(i).name();
+  }
+  std::vector<target_addr> frames(exc.stacktrace().begin(),
+                                  exc.stacktrace().end());
+
+  CrashNormalizer normalizer(regions);
+  normalizer.Sign(exc.type(), exc.access(), exc.pc(), frames,
+                  &info->signature, &info->fuzzy_signature);
+  info->status = CrashStatusComputed;
+}
+
+// Load all the traces named by argv, in parallel
+static void crash_load_all(int argc, char **argv,
+                           std::vector<std::string> *filenames,
+                           std::vector<crash_info> *infos) {
+  for (int i = 0; i < argc; i++) {
+    if (!load_collect_traces(argv[i], filenames)) {
+      LOG_FATAL("Cannot access '%s'", argv[i]);
+    }
+  }
+
+  infos->resize(filenames->size());
+  parallel_for(filenames->size(), parallel_threads(), [&](size_t i) {
+      crash_load((*filenames)[i], &(*infos)[i]);
+    });
+}
+
+static int cmd_bucket(const std::string &filename, int argc, char **argv) {
+  CrashBucketIndex index;
+  struct stat st;
+  if (stat(filename.c_str(), &st) == 0 && !index.Load(filename)) {
+    LOG_FATAL("Error reading bucket index '%s'", filename.c_str());
+  }
+
+  std::vector<std::string> filenames;
+  std::vector<crash_info> infos;
+  crash_load_all(argc, argv, &filenames, &infos);
+
+  uint32_t n_crashes = 0, n_created = 0;
+  for (size_t i = 0; i < filenames.size(); i++) {
+    if (infos[i].status == CrashStatusError) {
+      LOG_WARN("Skipping unreadable trace '%s'", filenames[i].c_str());
+      continue;
+    } else if (infos[i].status == CrashStatusNone) {
+      continue;
+    }
+
+    bool created;
+    uint32_t id = index.Assign(infos[i].signature, infos[i].fuzzy_signature,
+                               filenames[i], &created);
+    printf("%u %u %s %s\n", id, index.bucket(id).group,
+           created ? "new" : "dup", filenames[i].c_str());
+    n_crashes++;
+    n_created += created;
+  }
+
+  if (!index.Save(filename)) {
+    LOG_FATAL("Error writing bucket index '%s'", filename.c_str());
+  }
+
+  LOG_INFO("%u crashes, %u new buckets, %u buckets in index '%s'", n_crashes,
+           n_created, index.size(), filename.c_str());
+  return 0;
+}
+
+static int cmd_list(const std::string &filename, int argc, char **argv) {
+  if (argc != 0) {
+    return -1;
+  }
+
+  CrashBucketIndex index;
+  if (!index.Load(filename)) {
+    LOG_FATAL("Error reading bucket index '%s'", filename.c_str());
+  }
+
+  for (uint32_t id = 0; id < index.size(); id++) {
+    const bucket_record &bucket = index.bucket(id);
+    printf("%u %u %" PRIu64 " %016" PRIx64 " %016" PRIx64 " %s\n", id,
+           bucket.group, bucket.count, bucket.signature,
+           bucket.fuzzy_signature, index.bucket_trace(id).c_str());
+  }
+  return 0;
+}
+
+static int cmd_show(int argc, char **argv) {
+  std::vector<std::string> filenames;
+  std::vector<crash_info> infos;
+  crash_load_all(argc, argv, &filenames, &infos);
+
+  for (size_t i = 0; i < filenames.size(); i++) {
+    switch (infos[i].status) {
+    case CrashStatusError:
+      LOG_WARN("Skipping unreadable trace '%s'", filenames[i].c_str());
+      break;
+    case CrashStatusNone:
+      break;
+    default:
+      printf("%016" PRIx64 " %016" PRIx64 " %s %s\n", infos[i].signature,
+             infos[i].fuzzy_signature,
+             infos[i].status == CrashStatusStored ? "stored" : "computed",
+             filenames[i].c_str());
+      break;
+    }
+  }
+  return 0;
+}
+
+static void show_help(char **argv) {
+  fprintf(stderr,
+          "Syntax: %s <command> [args]\n"
+          "\n"
+          "  bucket <index> <trace|dir>...  assign crashes to buckets (one\n"
+          "                                 line per crash: bucket, group,\n"
+          "                                 new/dup, trace), creating the\n"
+          "                                 index if needed\n"
+          "  list <index>                   list buckets (id, group, count,\n"
+          "                                 signatures, first trace)\n"
+          "  show <trace|dir>...            print crash signatures\n",
+          argv[0]);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    show_help(argv);
+    exit(1);
+  }
+
+  std::string cmd = argv[1];
+  int ret = -1;
+
+  if (cmd == "bucket" && argc > 3) {
+    ret = cmd_bucket(argv[2], argc - 3, argv + 3);
+  } else if (cmd == "list") {
+    ret = cmd_list(argv[2], argc - 3, argv + 3);
+  } else if (cmd == "show") {
+    ret = cmd_show(argc - 2, argv + 2);
+  }
+
+  if (ret == -1) {
+    show_help(argv);
+    exit(1);
+  }
+  return ret;
+}
@@ -0,0 +1,236 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Build and query an inverted coverage index over a corpus of traces (see
+// common/index.h): which traces hit an edge, and which edges are hit by few
+// traces only.
+//
+
+#include <sys/stat.h>
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "common/index.h"
+#include "common/load.h"
+#include "common/logging.h"
+#include "common/parallel.h"
+
+// Traces loaded in parallel before being added to the index
+static const size_t INDEX_BATCH_TRACES = 256;
+
+static void open_index(const std::string &filename, InvertedIndex *index) {
+  if (!index->Open(filename)) {
+    LOG_FATAL("Error reading index file '%s'", filename.c_str());
+  }
+}
+
+// Load the edges of filenames[first, first + n) with one thread per CPU
+static void index_load_batch(const std::vector<std::string> &filenames,
+                             size_t first, size_t n,
+                             std::vector<std::vector<compact_edge> > *edges,
+                             std::vector<char> *loaded) {
+  edges->resize(n);
+  loaded->assign(n, 0);
+  parallel_for(n, parallel_threads(), [&](size_t i) {
+      (*loaded)[i] = load_trace_edges(filenames[first + i], &(*edges)[i]);
+    });
+}
+
+static int cmd_add(const std::string &filename, int argc, char **argv) {
+  InvertedIndexWriter writer;
+  std::set<std::string> names;
+
+  // Add to an existing index, rewriting it
+  struct stat st;
+  if (stat(filename.c_str(), &st) == 0) {
+    InvertedIndex index;
+    open_index(filename, &index);
+    if (!writer.AddIndex(index)) {
+      LOG_FATAL("Corrupted index file '%s'", filename.c_str());
+    }
+    for (uint32_t id = 0; id < index.n_traces(); id++) {
+      names.insert(index.trace_name(id));
+    }
+  }
+
+  std::vector<std::string> filenames;
+  for (int i = 0; i < argc; i++) {
+    std::vector<std::string> collected;
+    if (!load_collect_traces(argv[i], &collected)) {
+      LOG_FATAL("Cannot access '%s'", argv[i]);
+    }
+    for (size_t j = 0; j < collected.size(); j++) {
+      if (names.insert(collected[j]).second) {
+        filenames.push_back(collected[j]);
+      }
+    }
+  }
+
+  uint32_t n_added = 0;
+  std::vector<std::vector<compact_edge> > edges;
+  std::vector<char> loaded;
+  for (size_t first = 0; first < filenames.size();
+       first += INDEX_BATCH_TRACES) {
+    size_t n = std::min(INDEX_BATCH_TRACES, filenames.size() - first);
+    index_load_batch(filenames, first, n, &edges, &loaded);
+
+    for (size_t i = 0; i < n; i++) {
+      if (!loaded[i]) {
+        LOG_WARN("Skipping unreadable trace '%s'",
+                 filenames[first + i].c_str());
+        continue;
+      }
+      writer.AddTrace(filenames[first + i], edges[i]);
+      n_added++;
+    }
+  }
+
+  if (!writer.Write(filename)) {
+    LOG_FATAL("Error writing index file '%s'", filename.c_str());
+  }
+
+  LOG_INFO("Added %u traces, %u traces in index '%s'", n_added,
+           writer.n_traces(), filename.c_str());
+  return 0;
+}
+
+static int cmd_query(const std::string &filename, int argc, char **argv) {
+  if (argc != 2) {
+    return -1;
+  }
+
+  InvertedIndex index;
+  open_index(filename, &index);
+
+  const index_edge *edge = index.Find(strtoull(argv[0], NULL, 0),
+                                      strtoull(argv[1], NULL, 0));
+  if (edge == NULL) {
+    return 1;
+  }
+
+  index.ForEachPosting(*edge, [&](uint32_t id) {
+      printf("%s\n", index.trace_name(id));
+    });
+  return 0;
+}
+
+static int cmd_rare(const std::string &filename, int argc, char **argv) {
+  if (argc > 1) {
+    return -1;
+  }
+
+  InvertedIndex index;
+  open_index(filename, &index);
+  uint32_t max_count = (argc > 0) ? strtoul(argv[0], NULL, 0) : 1;
+
+  for (uint64_t i = 0; i < index.n_edges(); i++) {
+    const index_edge &edge = index.edge(i);
+    if (edge.count > max_count) {
+      continue;
+    }
+
+    printf("0x%" PRIx64 " 0x%" PRIx64 " %u", edge.prev, edge.next,
+           edge.count);
+    index.ForEachPosting(edge, [&](uint32_t id) {
+        printf(" %s", index.trace_name(id));
+      });
+    printf("\n");
+  }
+  return 0;
+}
+
+static int cmd_list(const std::string &filename, int argc, char **argv) {
+  if (argc != 0) {
+    return -1;
+  }
+
+  InvertedIndex index;
+  open_index(filename, &index);
+
+  for (uint32_t id = 0; id < index.n_traces(); id++) {
+    printf("%u %u %s\n", id, index.trace(id).n_edges, index.trace_name(id));
+  }
+  return 0;
+}
+
+static int cmd_stats(const std::string &filename, int argc, char **argv) {
+  if (argc != 0) {
+    return -1;
+  }
+
+  InvertedIndex index;
+  open_index(filename, &index);
+
+  // Histogram of the number of traces hitting each edge, in powers of 2
+  std::vector<uint64_t> histogram(33, 0);
+  uint64_t n_postings = 0;
+  for (uint64_t i = 0; i < index.n_edges(); i++) {
+    uint32_t count = index.edge(i).count;
+    histogram[32 - __builtin_clz(count)]++;
+    n_postings += count;
+  }
+
+  printf("traces   %u\n", index.n_traces());
+  printf("edges    %" PRIu64 "\n", index.n_edges());
+  printf("postings %" PRIu64 " (%.2f bytes each)\n", n_postings,
+         n_postings > 0 ?
+         static_cast<double>(index.header().file_size -
+                             index.header().postings_offset) / n_postings : 0);
+  for (int i = 1; i < 33; i++) {
+    if (histogram[i] > 0) {
+      printf("hit by %u-%u traces: %" PRIu64 " edges\n", 1U << (i - 1),
+             (i < 32) ? (1U << i) - 1 : UINT32_MAX, histogram[i]);
+    }
+  }
+  return 0;
+}
+
+static void show_help(char **argv) {
+  fprintf(stderr,
+          "Syntax: %s <command> <index> [args]\n"
+          "\n"
+          "  add <index> <trace|dir>...  add traces (or all the traces in a\n"
+          "                              directory) to the index, creating\n"
+          "                              it if needed\n"
+          "  query <index> <prev> <next> list the traces that hit an edge\n"
+          "  rare <index> [max]          list the edges hit by at most <max>\n"
+          "                              traces (default: 1), and the traces\n"
+          "                              that hit them\n"
+          "  list <index>                list the traces (id, #edges, name)\n"
+          "  stats <index>               summarize the index\n",
+          argv[0]);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    show_help(argv);
+    exit(1);
+  }
+
+  std::string cmd = argv[1], filename = argv[2];
+  int ret = -1;
+
+  if (cmd == "add" && argc > 3) {
+    ret = cmd_add(filename, argc - 3, argv + 3);
+  } else if (cmd == "query") {
+    ret = cmd_query(filename, argc - 3, argv + 3);
+  } else if (cmd == "rare") {
+    ret = cmd_rare(filename, argc - 3, argv + 3);
+  } else if (cmd == "list") {
+    ret = cmd_list(filename, argc - 3, argv + 3);
+  } else if (cmd == "stats") {
+    ret = cmd_stats(filename, argc - 3, argv + 3);
+  }
+
+  if (ret == -1) {
+    show_help(argv);
+    exit(1);
+  }
+  return ret;
+}
@@ -0,0 +1,311 @@
+//
+// Copyright 2015, Roberto Paleari (@rpaleari) and Aristide Fattori (@joystick)
+//
+// Set operations over the edges of many traces: union, intersection,
+// difference, and the edges unique to each trace. Traces are loaded as
+// sorted edge arrays, then reduced pairwise, with a tree of merges that run
+// in parallel at each level.
+//
+
+#include <getopt.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "common/load.h"
+#include "common/logging.h"
+#include "common/parallel.h"
+#include "common/serialize.h"
+
+// An edge of a partial result: its total hits, the number of traces that hit
+// it, and the last of them
+struct merge_edge {
+  uint64_t prev;
+  uint64_t next;
+  uint64_t hit;
+  uint32_t count;
+  uint32_t owner;
+};
+
+typedef std::vector<merge_edge> merge_set;
+
+static unsigned int gbl_threads = 0;
+
+static inline bool merge_less(const merge_edge &a, const merge_edge &b) {
+  return a.prev < b.prev || (a.prev == b.prev && a.next < b.next);
+}
+
+static inline bool merge_equal(const merge_edge &a, const merge_edge &b) {
+  return a.prev == b.prev && a.next == b.next;
+}
+
+static inline merge_edge merge_combine(const merge_edge &a,
+                                       const merge_edge &b) {
+  merge_edge e = { a.prev, a.next, a.hit + b.hit, a.count + b.count, b.owner };
+  return e;
+}
+
+// Union of two sorted sets
+static void merge_union(const merge_set &a, const merge_set &b,
+                        merge_set *out) {
+  out->clear();
+  out->reserve(a.size() + b.size());
+
+  size_t i = 0, j = 0;
+  while (i < a.size() && j < b.size()) {
+    if (merge_less(a[i], b[j])) {
+      out->push_back(a[i++]);
+    } else if (merge_less(b[j], a[i])) {
+      out->push_back(b[j++]);
+    } else {
+      out->push_back(merge_combine(a[i++], b[j++]));
+    }
+  }
+  out->insert(out->end(), a.begin() + i, a.end());
+  out->insert(out->end(), b.begin() + j, b.end());
+}
+
+// Intersection of two sorted sets. When a set is much smaller than the
+// other, look up its edges with an exponential search
+static void merge_intersect(const merge_set &a, const merge_set &b,
+                            merge_set *out) {
+  const merge_set &small = (a.size() <= b.size()) ? a : b;
+  const merge_set &large = (a.size() <= b.size()) ? b : a;
+  out->clear();
+
+  if (small.size() * 16 < large.size()) {
+    merge_set::const_iterator lo = large.begin();
+    for (size_t i = 0; i < small.size() && lo != large.end(); i++) {
+      size_t step = 1;
+      merge_set::const_iterator hi = lo;
+      while (hi != large.end() && merge_less(*hi, small[i])) {
+        lo = hi;
+        hi = (static_cast<size_t>(large.end() - hi) > step) ?
+          hi + step : large.end();
+        step *= 2;
+      }
+      lo = std::lower_bound(lo, hi, small[i], merge_less);
+      if (lo != large.end() && merge_equal(*lo, small[i])) {
+        out->push_back(merge_combine(*lo, small[i]));
+      }
+    }
+    return;
+  }
+
+  size_t i = 0, j = 0;
+  while (i < a.size() && j < b.size()) {
+    if (merge_less(a[i], b[j])) {
+      i++;
+    } else if (merge_less(b[j], a[i])) {
+      j++;
+    } else {
+      out->push_back(merge_combine(a[i++], b[j++]));
+    }
+  }
+}
+
+// Edges of a that are not in b
+static void merge_difference(const merge_set &a, const merge_set &b,
+                             merge_set *out) {
+  out->clear();
+
+  size_t i = 0, j = 0;
+  while (i < a.size()) {
+    while (j < b.size() && merge_less(b[j], a[i])) {
+      j++;
+    }
+    if (j == b.size() || !merge_equal(a[i], b[j])) {
+      out->push_back(a[i]);
+    }
+    i++;
+  }
+}
+
+// Load traces [first, last) as sets, owned by their index
+static void merge_load(const std::vector<std::string> &filenames, size_t first,
+                       size_t last, std::vector<merge_set> *sets) {
+  sets->resize(last - first);
+  std::vector<char> loaded(last - first, 0);
+
+  parallel_for(last - first, gbl_threads, [&](size_t i) {
+      std::vector<compact_edge> edges;
+      if (!load_trace_edges(filenames[first + i], &edges)) {
+        return;
+      }
+      merge_set &set = (*sets)[i];
+      set.resize(edges.size());
+      for (size_t j = 0; j < edges.size(); j++) {
+        merge_edge e = { edges[j].prev, edges[j].next, edges[j].hit, 1,
+                         static_cast<uint32_t>(first + i) };
+        set[j] = e;
+      }
+      loaded[i] = 1;
+    });
+
+  for (size_t i = 0; i < loaded.size(); i++) {
+    if (!loaded[i]) {
+      LOG_FATAL("Error reading trace file '%s'",
+                filenames[first + i].c_str());
+    }
+  }
+}
+
+// Reduce sets pairwise with op, level by level. Sets are consumed
+static void merge_reduce(std::vector<merge_set> *sets,
+                         void (*op)(const merge_set &, const merge_set &,
+                                    merge_set *),
+                         merge_set *out) {
+  if (sets->empty()) {
+    out->clear();
+    return;
+  }
+
+  while (sets->size() > 1) {
+    size_t n = sets->size() / 2;
+    std::vector<merge_set> reduced(n + sets->size() % 2);
+
+    parallel_for(n, gbl_threads, [&](size_t i) {
+        op((*sets)[2*i], (*sets)[2*i+1], &reduced[i]);
+        merge_set().swap((*sets)[2*i]);
+        merge_set().swap((*sets)[2*i+1]);
+      });
+    if (sets->size() % 2) {
+      reduced[n].swap(sets->back());
+    }
+    sets->swap(reduced);
+  }
+  out->swap((*sets)[0]);
+}
+
+static bool merge_save(const std::string &filename, const merge_set &set,
+                       TraceFormat format) {
+  ExecutionTrace trace;
+  for (size_t i = 0; i < set.size(); i++) {
+    trace.basic_blocks.AddEdge(set[i].prev, set[i].next, set[i].hit);
+  }
+
+  return serialize_trace_format(filename, trace, format);
+}
+
+static void show_help(char **argv) {
+  fprintf(stderr,
+          "Syntax: %s [-O <format>] [-j <threads>] <operation> <output> "
+          "<trace|dir>...\n"
+          "\n"
+          "  union       edges hit by any trace, with their total hits\n"
+          "  intersect   edges hit by all the traces, with their total hits\n"
+          "  diff        edges of the first trace hit by no other trace\n"
+          "  unique      for each trace, the edges hit by no other trace,\n"
+          "              saved to <output>/<name> (<output> is a directory,\n"
+          "              <name> is the base name of the trace, prefixed with\n"
+          "              its index when several traces share it)\n"
+          "\n"
+          "  -O <format> format of the output traces: 'protobuf' (default),\n"
+          "              'stream' or 'compact'\n"
+          "  -j <n>      number of threads (default: one per CPU)\n",
+          argv[0]);
+}
+
+int main(int argc, char **argv) {
+  TraceFormat format = TraceFormatProtobuf;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "O:j:h")) != -1) {
+    switch (opt) {
+    case 'O':
+      if (!serialize_parse_format(optarg, &format)) {
+        LOG_FATAL("Unknown trace format '%s'", optarg);
+      }
+      break;
+    case 'j':
+      gbl_threads = strtoul(optarg, NULL, 0);
+      break;
+    default:
+    case 'h':
+      show_help(argv);
+      exit(1);
+    }
+  }
+
+  if (argc - optind < 3) {
+    show_help(argv);
+    exit(1);
+  }
+
+  if (gbl_threads == 0) {
+    gbl_threads = parallel_threads();
+  }
+
+  std::string op = argv[optind], output = argv[optind+1];
+  std::vector<std::string> filenames;
+  for (int i = optind + 2; i < argc; i++) {
+    if (!load_collect_traces(argv[i], &filenames)) {
+      LOG_FATAL("Cannot access '%s'", argv[i]);
+    }
+  }
+  if (filenames.empty()) {
+    LOG_FATAL("No input traces");
+  }
+
+  std::vector<merge_set> sets;
+  merge_set result;
+
+  if (op == "union") {
+    merge_load(filenames, 0, filenames.size(), &sets);
+    merge_reduce(&sets, merge_union, &result);
+  } else if (op == "intersect") {
+    merge_load(filenames, 0, filenames.size(), &sets);
+    merge_reduce(&sets, merge_intersect, &result);
+  } else if (op == "diff") {
+    merge_set first, others;
+    merge_load(filenames, 0, 1, &sets);
+    first.swap(sets[0]);
+    merge_load(filenames, 1, filenames.size(), &sets);
+    merge_reduce(&sets, merge_union, &others);
+    merge_difference(first, others, &result);
+  } else if (op == "unique") {
+    merge_set all;
+    merge_load(filenames, 0, filenames.size(), &sets);
+    merge_reduce(&sets, merge_union, &all);
+
+    // Split the edges hit by a single trace among their owners
+    std::vector<merge_set> unique(filenames.size());
+    for (size_t i = 0; i < all.size(); i++) {
+      if (all[i].count == 1) {
+        unique[all[i].owner].push_back(all[i]);
+      }
+    }
+
+    // Outputs are written in parallel, and must not overwrite each other
+    std::vector<std::string> names;
+    if (!load_output_names(filenames, &names)) {
+      LOG_FATAL("Input traces have colliding output names");
+    }
+
+    std::vector<char> saved(filenames.size(), 0);
+    parallel_for(filenames.size(), gbl_threads, [&](size_t i) {
+        saved[i] = merge_save(output + "/" + names[i], unique[i], format);
+      });
+
+    for (size_t i = 0; i < filenames.size(); i++) {
+      if (!saved[i]) {
+        LOG_FATAL("Error writing unique edges of '%s'", filenames[i].c_str());
+      }
+      printf("%zu %s %s\n", unique[i].size(), filenames[i].c_str(),
+             names[i].c_str());
+    }
+    return 0;
+  } else {
+    show_help(argv);
+    exit(1);
+  }
+
+  if (!merge_save(output, result, format)) {
+    LOG_FATAL("Error writing trace file '%s'", output.c_str());
+  }
+
+  LOG_INFO("%zu edges from %zu traces", result.size(), filenames.size());
+  return 0;
+}
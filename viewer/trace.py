@@ -12,6 +12,51 @@ import struct
 
 import bbtrace_pb2
 
+# Magic of streaming trace files, followed by size-prefixed TraceChunk messages
+TRACE_STREAM_MAGIC = "BBTS"
+
+def read_varint(f):
+    """Read a varint from file f. Return None at the end of the file."""
+    value = 0
+    shift = 0
+    while True:
+        c = f.read(1)
+        if c == "":
+            if shift == 0:
+                return None
+            raise ValueError("Truncated chunk size")
+        b = ord(c)
+        value |= (b & 0x7f) << shift
+        if not b & 0x80:
+            return value
+        shift += 7
+
+def read_chunks(f):
+    """Yield the chunks of a streaming trace file, one at a time.
+
+    File f must be positioned after the stream magic.
+    """
+    while True:
+        size = read_varint(f)
+        if size is None:
+            raise ValueError("Truncated stream, without its end chunk")
+        data = f.read(size)
+        if len(data) != size:
+            raise ValueError("Truncated chunk")
+        chunk = bbtrace_pb2.TraceChunk()
+        chunk.ParseFromString(data)
+        if chunk.end:
+            return
+        yield chunk
+
+def module_id(filename):
+    """Id of a module in module-relative addresses: the 32-bit FNV-1a hash of
+    its path."""
+    h = 0x811c9dc5
+    for c in bytearray(filename.encode("utf-8")):
+        h = ((h ^ c) * 0x01000193) & 0xffffffff
+    return h
+
 class MemoryRegion(object):
     """Mapped memory region, possibly associated to a filename."""
     def __init__(self, obj):
@@ -43,8 +88,11 @@ class CrashException(object):
         self.access = obj.access
         self.hashz = None
 
-        # Update hash value for this exception
-        self.__update_hash()
+        # Use the crash signature computed by the tracer, if any
+        if obj.HasField("signature"):
+            self.hashz = "%016x" % obj.signature
+        else:
+            self.__update_hash()
         assert self.hashz is not None
 
     def is_valid(self):
@@ -101,39 +149,88 @@ class ExecutionTrace(object):
             assert all([os.path.exists(x) for x in deps])
             self.deps |= deps
 
-        # Read data
+        # Read data. A streaming trace is consumed one chunk at a time,
+        # otherwise the whole trace is a single object. Both kinds of object
+        # have the same fields
         self.tracefile = tracefile
         f = open(tracefile, "rb")
-        data = f.read()
+        if f.read(len(TRACE_STREAM_MAGIC)) == TRACE_STREAM_MAGIC:
+            objs = read_chunks(f)
+        else:
+            f.seek(0)
+            obj = bbtrace_pb2.Trace()
+            obj.ParseFromString(f.read())
+            objs = [obj]
+
+        edges = set()
+        exceptions = []
+        self.regions = []
+        tasks = {}
+        header = None
+
+        for obj in objs:
+            if obj.HasField("header"):
+                header = obj.header
+
+            # NOTE: We ignore the execution order of CFG edges
+            edges.update([(e.prev, e.next, e.hit) for e in obj.edge])
+            exceptions.extend(obj.exception)
+
+            # Parse memory-mapped regions
+            for m in obj.region:
+                region = MemoryRegion(m)
+                self.regions.append(region)
+
+            # Per-task CFG edges, only available for multi-task executions
+            for t in obj.task:
+                tasks.setdefault((t.pid, t.tid), set()).update(
+                    [(e.prev, e.next, e.hit) for e in t.edge])
         f.close()
 
-        # Parse object
-        obj = bbtrace_pb2.Trace()
-        obj.ParseFromString(data)
-        assert obj.header.magic == bbtrace_pb2.TraceHeader.TRACE_MAGIC
+        assert header is not None
+        assert header.magic == bbtrace_pb2.TraceHeader.TRACE_MAGIC
+
+        self.timestamp = datetime.datetime.fromtimestamp(header.timestamp)
+        if header.HasField("coverage_hash"):
+            self.hashz = "%016x" % header.coverage_hash
+        else:
+            self.hashz = "%x" % header.hash
 
-        self.timestamp = datetime.datetime.fromtimestamp(obj.header.timestamp)
-        self.hashz = "%x" % obj.header.hash
+        # Module-relative edge endpoints refer to modules by a hash of their
+        # path (see tracer/common/regions.h)
+        self.module_relative = header.module_relative
+        self.modules = dict((module_id(r.get_name()), r.get_name())
+                            for r in self.regions if r.size > 0)
 
         # Prepare the list of CFG edges observed in this execution
-        # NOTE: We ignore the execution order of CFG edges
-        self.edges = list(set([(e.prev, e.next, e.hit) for e in obj.edge]))
+        self.edges = list(edges)
         self.edges.sort()
 
         # Create the list of CrashException object, representing exceptions
         # risen during this execution
         self.exceptions = []
-        for e in obj.exception:
+        for e in exceptions:
             exception = CrashException(e, self.timestamp)
             self.exceptions.append(exception)
 
-        # Parse memory-mapped regions
-        self.regions = []
-        for m in obj.region:
-            region = MemoryRegion(m)
-            self.regions.append(region)
         self.regions.sort(cmp=lambda a,b: cmp(a.base, b.base))
 
+        self.tasks = {}
+        for task, task_edges in tasks.items():
+            self.tasks[task] = sorted(task_edges)
+
+    def address_str(self, addr):
+        """Return a printable representation of an edge endpoint."""
+        if not self.module_relative:
+            return "%08x" % addr
+
+        module, offset = addr >> 32, addr & 0xffffffff
+        if module in self.modules:
+            name = os.path.basename(self.modules[module])
+        else:
+            name = "#%d" % module
+        return "%s+%x" % (name, offset)
+
     @staticmethod
     def exception_type_str(n):
         return ExecutionTrace.MAP_EXCEPTION_TYPE.get(n)
@@ -196,7 +293,8 @@ class ExecutionTrace(object):
 
         print " - CFG edges"
         for e_prev, e_next, e_hit in trace.edges:
-            print " [%08x -> %08x] %d hit" % (e_prev, e_next, e_hit)
+            print " [%s -> %s] %d hit" % (self.address_str(e_prev),
+                                          self.address_str(e_next), e_hit)
 
         if len(trace.exceptions) > 0:
             print
@@ -216,6 +314,13 @@ class ExecutionTrace(object):
                                                 region.get_upper(),
                                                 region.get_name())
 
+        for (pid, tid), edges in sorted(trace.tasks.items()):
+            print
+            print " - CFG edges of task %d (thread %d)" % (pid, tid)
+            for e_prev, e_next, e_hit in edges:
+                print " [%s -> %s] %d hit" % (self.address_str(e_prev),
+                                              self.address_str(e_next), e_hit)
+
 
 if __name__ == "__main__":
     # Parse an execution trace and print it out, optionally performing a "diff"